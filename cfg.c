@@ -0,0 +1,337 @@
+#include "cfg.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+#include "instruction.h"
+#include "x16.h"
+
+// Where xas places the code it assembles
+#define XAS_START 0x3000
+
+// How an instruction passes on control
+typedef struct {
+  bool valid;       // false for opcodes that are never used
+  bool ends_block;  // BR, JMP, JSR and TRAP
+  bool falls;       // control may go on to the next instruction
+  bool has_target;  // a branch or JSR to target
+  uint16_t target;
+  cfg_edge_t kind;
+} flow_t;
+
+static uint16_t sext(uint16_t value, int bits) {
+  return sign_extend(value & ((1 << bits) - 1), bits);
+}
+
+static flow_t flow_of(uint16_t address, uint16_t word) {
+  flow_t f = {true, false, true, false, 0, CFG_FALL};
+  uint16_t next = address + 1;
+  int nzp = (word >> 9) & 7;
+  switch (word >> 12) {
+    case OP_BR:
+      // No flags at all branches always, as it does in control.c
+      f.ends_block = true;
+      f.falls = nzp != 0 && nzp != 7;
+      f.has_target = true;
+      f.target = next + sext(word, 9);
+      f.kind = CFG_BRANCH;
+      break;
+
+    case OP_JMP:
+      f.ends_block = true;
+      f.falls = false;
+      break;
+
+    case OP_JSR:
+      f.ends_block = true;
+      if (word & 0x800) {
+        f.has_target = true;
+        f.target = next + sext(word, 11);
+        f.kind = CFG_CALL;
+      }
+      break;
+
+    case OP_TRAP:
+      f.ends_block = true;
+      f.falls = (word & 0xff) != TRAP_HALT;
+      break;
+
+    case OP_RTI:
+    case OP_RES:
+      f.valid = false;
+      break;
+  }
+  return f;
+}
+
+// Is this an instruction whose PC relative operand is an address of data
+static bool has_data_target(uint16_t word) {
+  switch (word >> 12) {
+    case OP_LD:
+    case OP_LDI:
+    case OP_LEA:
+    case OP_ST:
+    case OP_STI:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Index of an address in the image, or -1
+static long index_of(const cfg_t* cfg, uint16_t address) {
+  uint16_t i = address - cfg->origin;
+  return i < cfg->count ? (long)i : -1;
+}
+
+// Mark everything reachable from the origin as code
+static void traverse(cfg_t* cfg) {
+  uint16_t* stack = (uint16_t*)malloc((2 * cfg->count + 1) * sizeof(uint16_t));
+  size_t top = 0;
+  stack[top++] = cfg->origin;
+  cfg->flags[0] |= CFG_JUMP_TARGET;
+  while (top > 0) {
+    uint16_t address = stack[--top];
+    long i = index_of(cfg, address);
+    if (i < 0 || (cfg->flags[i] & CFG_CODE)) {
+      continue;
+    }
+    uint16_t word = cfg->words[i];
+    flow_t f = flow_of(address, word);
+    if (!f.valid) {
+      continue;
+    }
+    cfg->flags[i] |= CFG_CODE;
+    if (has_data_target(word)) {
+      long t = index_of(cfg, address + 1 + sext(word, 9));
+      if (t >= 0) {
+        cfg->flags[t] |= CFG_DATA_TARGET;
+      }
+    }
+    if (f.has_target) {
+      long t = index_of(cfg, f.target);
+      if (t >= 0) {
+        cfg->flags[t] |= CFG_JUMP_TARGET;
+        stack[top++] = f.target;
+      }
+    }
+    if (f.falls) {
+      stack[top++] = address + 1;
+    }
+  }
+  free(stack);
+}
+
+static void add_succ(cfg_t* cfg, cfg_block_t* block, uint16_t address,
+                     cfg_edge_t kind) {
+  long i = index_of(cfg, address);
+  if (i >= 0 && cfg->block_of[i] >= 0) {
+    block->succ[block->nsucc] = cfg->block_of[i];
+    block->succ_kind[block->nsucc] = kind;
+    block->nsucc++;
+  }
+}
+
+// Split the code into blocks and link them up
+static void make_blocks(cfg_t* cfg) {
+  cfg->blocks = (cfg_block_t*)malloc(cfg->count * sizeof(cfg_block_t));
+  cfg->nblocks = 0;
+  bool ended = true;
+  for (size_t i = 0; i < cfg->count; i++) {
+    uint16_t address = cfg->origin + i;
+    if (!(cfg->flags[i] & CFG_CODE)) {
+      cfg->block_of[i] = -1;
+      ended = true;
+      continue;
+    }
+    if (ended || (cfg->flags[i] & CFG_JUMP_TARGET)) {
+      cfg_block_t* block = &cfg->blocks[cfg->nblocks++];
+      block->start = address;
+      block->nsucc = 0;
+    }
+    cfg->blocks[cfg->nblocks - 1].end = address;
+    cfg->block_of[i] = cfg->nblocks - 1;
+    ended = flow_of(address, cfg->words[i]).ends_block;
+  }
+
+  for (int b = 0; b < cfg->nblocks; b++) {
+    cfg_block_t* block = &cfg->blocks[b];
+    flow_t f = flow_of(block->end, cfg->words[index_of(cfg, block->end)]);
+    if (f.has_target) {
+      add_succ(cfg, block, f.target, f.kind);
+    }
+    if (f.falls) {
+      add_succ(cfg, block, block->end + 1, CFG_FALL);
+    }
+  }
+}
+
+// Build the graph
+cfg_t* cfg_build(const uint16_t* words, size_t count, uint16_t origin) {
+  cfg_t* cfg = (cfg_t*)calloc(1, sizeof(cfg_t));
+  // Words past the end of memory are never reached
+  if (count > (size_t)MAX_MEMORY - origin) {
+    count = MAX_MEMORY - origin;
+  }
+  cfg->origin = origin;
+  cfg->count = count;
+  cfg->words = words;
+  cfg->flags = (uint8_t*)calloc(count > 0 ? count : 1, 1);
+  cfg->block_of = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+  if (count > 0) {
+    traverse(cfg);
+  }
+  make_blocks(cfg);
+  return cfg;
+}
+
+void cfg_free(cfg_t* cfg) {
+  free(cfg->flags);
+  free(cfg->block_of);
+  free(cfg->blocks);
+  free(cfg);
+}
+
+// Get the block of an address
+const cfg_block_t* cfg_block_at(const cfg_t* cfg, uint16_t address) {
+  long i = index_of(cfg, address);
+  return i >= 0 && cfg->block_of[i] >= 0 ? &cfg->blocks[cfg->block_of[i]]
+                                         : NULL;
+}
+
+// Get the flags of an address
+int cfg_flags(const cfg_t* cfg, uint16_t address) {
+  long i = index_of(cfg, address);
+  return i >= 0 ? cfg->flags[i] : 0;
+}
+
+// Label an address
+size_t cfg_label(const cfg_t* cfg, uint16_t address, char* out) {
+  return sprintf(out, "%c%u", (cfg_flags(cfg, address) & CFG_CODE) ? 'L' : 'D',
+                 (unsigned int)address);
+}
+
+// Would xas assemble the instruction back to the same word. It only
+// makes the encodings in instruction.c, with unused bits as they set them.
+static bool assembles_back(uint16_t word) {
+  reg_t dst = (reg_t)((word >> 9) & 7);
+  reg_t src = (reg_t)((word >> 6) & 7);
+  switch (word >> 12) {
+    case OP_ADD:
+    case OP_AND:
+      return (word & 0x20) || (word & 0x18) == 0;
+    case OP_NOT:
+      return word == emit_not(dst, src);
+    case OP_JMP:
+      return word == emit_jmp(src);
+    case OP_JSR:
+      return (word & 0x800) || word == emit_jsrr(src);
+    case OP_TRAP:
+      return (word & 0x0f00) == 0;
+    case OP_RTI:
+    case OP_RES:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// Format a word as xas source
+size_t cfg_format(const cfg_t* cfg, uint16_t address, char* out) {
+  long i = index_of(cfg, address);
+  uint16_t word = i >= 0 ? cfg->words[i] : 0;
+  if (i < 0 || !(cfg->flags[i] & CFG_CODE) || !assembles_back(word)) {
+    int len = sprintf(out, "val $%u", (unsigned int)word);
+    len += sprintf(out + len, "%*s# 0x%04x", 8 - len > 1 ? 8 - len : 1, "",
+                   (unsigned int)word);
+    if (word >= 0x20 && word < 0x7f) {
+      len += sprintf(out + len, " '%c'", (char)word);
+    }
+    return len;
+  }
+
+  size_t len = decode_into(word, out);
+  int opcode = word >> 12;
+  if (opcode == OP_TRAP && out[0] == '-') {
+    return sprintf(out, "trap $%u", (unsigned int)(word & 0xff));
+  }
+  flow_t f = flow_of(address, word);
+  bool pc_relative = f.has_target || has_data_target(word);
+  uint16_t target = f.has_target ? f.target : address + 1 + sext(word, 9);
+  if (pc_relative && index_of(cfg, target) >= 0) {
+    // The offset is last; put the label of its target in its place
+    char* offset = strrchr(out, '$');
+    len = offset - out;
+    len += cfg_label(cfg, target, offset);
+  }
+  return len;
+}
+
+// Write source that xas assembles back to the image
+void cfg_write_source(const cfg_t* cfg, const char* name, FILE* out) {
+  fprintf(out, "# %s, disassembled by xod\n", name);
+  if (cfg->origin != XAS_START) {
+    fprintf(out, "# The image was at 0x%x, xas places it at 0x%x\n",
+            cfg->origin, XAS_START);
+  }
+  char line[64];
+  for (size_t i = 0; i < cfg->count; i++) {
+    uint16_t address = cfg->origin + i;
+    bool labeled = cfg->flags[i] & (CFG_JUMP_TARGET | CFG_DATA_TARGET);
+    bool new_block = i > 0 && cfg->block_of[i] != cfg->block_of[i - 1];
+    if (labeled || new_block) {
+      fputc('\n', out);
+    }
+    if (labeled) {
+      cfg_label(cfg, address, line);
+      fprintf(out, "%s:\n", line);
+    }
+    cfg_format(cfg, address, line);
+    fprintf(out, "        %s\n", line);
+  }
+}
+
+// Write a string inside double quotes, escaped for DOT
+static void put_escaped(const char* str, FILE* out) {
+  for (; *str != '\0'; str++) {
+    if (*str == '"' || *str == '\\') {
+      fputc('\\', out);
+    }
+    fputc(*str, out);
+  }
+}
+
+// Write the graph in DOT
+void cfg_write_dot(const cfg_t* cfg, const char* name, FILE* out) {
+  static const char* edge_style[] = {
+      [CFG_FALL] = "",
+      [CFG_BRANCH] = " [label=\"taken\"]",
+      [CFG_CALL] = " [label=\"call\", style=dashed]",
+  };
+  char line[64];
+  fputs("digraph \"", out);
+  put_escaped(name, out);
+  fputs("\" {\n  node [shape=box, fontname=\"monospace\"];\n", out);
+  for (int b = 0; b < cfg->nblocks; b++) {
+    const cfg_block_t* block = &cfg->blocks[b];
+    cfg_label(cfg, block->start, line);
+    fprintf(out, "  b%d [label=\"%s:\\l", b, line);
+    for (uint16_t a = block->start;; a++) {
+      cfg_format(cfg, a, line);
+      fputs("  ", out);
+      put_escaped(line, out);
+      fputs("\\l", out);
+      if (a == block->end) {
+        break;
+      }
+    }
+    fputs("\"];\n", out);
+    for (int s = 0; s < block->nsucc; s++) {
+      fprintf(out, "  b%d -> b%d%s;\n", b, block->succ[s],
+              edge_style[block->succ_kind[s]]);
+    }
+  }
+  fputs("}\n", out);
+}
@@ -0,0 +1,80 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Control flow graph of an image, recovered by recursive traversal: from
+// the origin, follow fall through, branch and JSR targets. Words never
+// reached are data. Blocks end at BR, JMP, JSR and TRAP, the same
+// boundaries the differential runner uses, or where a jump target starts
+// a new one. JMP, RET and JSRR go to addresses that are only known at run
+// time, so code reached only through them is seen as data.
+//
+// Besides the disassembler, tools can use the graph as a basic block map:
+// cfg_block_at finds the block of any address in constant time.
+
+// What is known about a word of the image
+enum {
+  CFG_CODE = 1,         // reached as an instruction
+  CFG_JUMP_TARGET = 2,  // the origin, or a branch or JSR target
+  CFG_DATA_TARGET = 4   // address used by LD, LDI, LEA, ST or STI
+};
+
+// How control gets from one block to another
+typedef enum {
+  CFG_FALL,    // on to the next instruction
+  CFG_BRANCH,  // a BR taken
+  CFG_CALL     // a JSR
+} cfg_edge_t;
+
+typedef struct {
+  uint16_t start;  // address of the first instruction
+  uint16_t end;    // address of the last instruction
+  int nsucc;
+  int succ[2];  // indexes of the successor blocks
+  cfg_edge_t succ_kind[2];
+} cfg_block_t;
+
+typedef struct {
+  uint16_t origin;
+  size_t count;       // words of the image
+  const uint16_t* words;
+  uint8_t* flags;     // per word, CFG_CODE and so on
+  int* block_of;      // per word, index of its block or -1 for data
+  cfg_block_t* blocks;
+  int nblocks;
+} cfg_t;
+
+// Build the graph of an image of count words, in host byte order, placed
+// at origin. The words must outlive the graph.
+cfg_t* cfg_build(const uint16_t* words, size_t count, uint16_t origin);
+
+// Free a graph
+void cfg_free(cfg_t* cfg);
+
+// Get the block containing address, or NULL if it is not code
+const cfg_block_t* cfg_block_at(const cfg_t* cfg, uint16_t address);
+
+// Get the flags of the word at address, 0 outside the image
+int cfg_flags(const cfg_t* cfg, uint16_t address);
+
+// Put the label of an address in out, e.g. L12288 for code and D12300 for
+// data, and return its length. Labels are plain letters and digits that
+// xas cannot mistake for anything else.
+size_t cfg_label(const cfg_t* cfg, uint16_t address, char* out);
+
+// Format the word at address as a line of xas source, without the
+// indentation: an instruction with its PC relative operand as a label if
+// the target is in the image, or val for data and for words xas could not
+// assemble back to the same value. out needs room for 64 characters.
+size_t cfg_format(const cfg_t* cfg, uint16_t address, char* out);
+
+// Write xas source for the image that assembles back to the same words
+void cfg_write_source(const cfg_t* cfg, const char* name, FILE* out);
+
+// Write the graph in Graphviz DOT, one node per block
+void cfg_write_dot(const cfg_t* cfg, const char* name, FILE* out);
+
+#endif  // CFG_H_
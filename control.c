@@ -22,6 +22,42 @@ void update_cond(x16_t *machine, reg_t reg) {
   }
 }
 
+// Run instructions until the machine stops or the limit is reached
+x16_exit_t x16_run(x16_t *machine, uint64_t limit) {
+  for (uint64_t i = 0; limit == 0 || i < limit; i++) {
+    int rv = execute_instruction(machine);
+    if (rv == 1) {
+      return X16_WAIT;
+    }
+    if (rv == -2) {
+      return X16_FAULT;
+    }
+    if (rv != 0) {
+      return x16_io(machine)->eof ? X16_EOF : X16_HALT;
+    }
+  }
+  return X16_LIMIT;
+}
+
+// Go back one instruction
+int x16_reverse_step(x16_t *machine) {
+  uint64_t count = x16_icount(machine);
+  if (count == x16_history_start(machine)) {
+    return -1;
+  }
+  return x16_travel(machine, count - 1);
+}
+
+// Go back until stop says so or the history runs out
+int x16_reverse_continue(x16_t *machine, x16_stop_fn stop, void *arg) {
+  while (x16_reverse_step(machine) == 0) {
+    if (stop(machine, arg)) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
 // Execute a single instruction in the given X16 machine. Update
 // memory and registers as required. PC is advanced as appropriate.
 // Return 0 on success, or -1 if an error or HALT is encountered.
@@ -30,9 +66,14 @@ int execute_instruction(x16_t *machine) {
   uint16_t pc = x16_pc(machine);
   uint16_t instruction = x16_memread(machine, pc);
   x16_set(machine, R_PC, pc + 1);
+  x16_tick(machine);
+  x16_cover(machine, pc);
 
-  if (LOG) {
-    fprintf(LOGFP, "0x%x: %s\n", pc, decode(instruction));
+  FILE *log = x16_log(machine);
+  if (log != NULL) {
+    char str[DECODE_SIZE];
+    decode_into(instruction, str);
+    fprintf(log, "0x%x: %s\n", pc, str);
   }
 
   // Variables we might need in various instructions
@@ -254,9 +295,14 @@ int execute_instruction(x16_t *machine) {
 
     case OP_RTI:
     default:
-      // Bad codes, never used
-      abort();
+      // Bad codes, never used. The guest faults at the instruction
+      x16_rewind(machine);
+      return -2;
   }
 
+  // A guest polling a keyboard that will never have a key stops here
+  if (x16_input_ended(machine)) {
+    return -1;
+  }
   return 0;
 }
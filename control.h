@@ -5,9 +5,39 @@
 
 // Execute a single instruction in the given X16 machine. Update
 // memory and registers as required. PC is advanced as appropriate.
-// Return 0 on success, or -1 if an error or HALT is encountered.
+// Return 0 on success, or -1 if an error or HALT is encountered. Return 1
+// if the instruction waits for input that has not been fed yet, or -2 if
+// it is not a valid instruction (RTI, the reserved opcode or an unknown
+// trap vector): the machine is left unchanged at the instruction, so it
+// can be executed again later.
 int execute_instruction(x16_t* machine);
 
+// Why x16_run returned
+typedef enum {
+  X16_LIMIT = 0,  // the instruction limit was reached
+  X16_HALT,       // the guest halted
+  X16_EOF,        // the guest read past the end of its input
+  X16_WAIT,       // the guest waits for input, see io_feed_input
+  X16_FAULT       // the guest ran an invalid instruction, left at it
+} x16_exit_t;
+
+// Run up to limit instructions, or until the machine stops if limit is 0.
+// Return why the run ended. After X16_WAIT, feed input and call x16_run
+// again to resume where the guest left off.
+x16_exit_t x16_run(x16_t* machine, uint64_t limit);
+
+// Go back one instruction, undoing it. Needs history, see
+// x16_set_history. Return 0 on success or -1 if there is no more history.
+int x16_reverse_step(x16_t* machine);
+
+// Decides whether going back in time should stop at the current state
+typedef bool (*x16_stop_fn)(x16_t* machine, void* arg);
+
+// Go back one instruction at a time until stop returns true. Return 0 if
+// it did, or -1 if the history ran out first; the machine is then at the
+// earliest state it has.
+int x16_reverse_continue(x16_t* machine, x16_stop_fn stop, void* arg);
+
 // Update condition code in R_COND based on result in the given register
 void update_cond(x16_t* machine, reg_t reg);
 
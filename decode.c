@@ -1,157 +1,213 @@
 #include "decode.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "instruction.h"
 
-char* decode(uint16_t instruction) {
-  // The string is returned in this static buffer
-  char* buf;
-  char br[1024];
-  br[0] = '\0';
-
-  reg_t dst, src1, src2, base;
-  uint16_t cond, vec;
-  int16_t offset;
-  int16_t value;
-
-  opcode_t opcode = getopcode(instruction);
-  switch (opcode) {
-    case OP_ADD:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      src1 = (reg_t)getbits(instruction, 6, 3);
-      if (getimmediate(instruction) == 1) {
-        value = sign_extend(getbits(instruction, 0, 5), 5);
-        asprintf(&buf, "add    %%r%d, %%r%d, $%d", (int)dst, (int)src1,
-                 (int)value);
-      } else {
-        src2 = (reg_t)getbits(instruction, 0, 3);
-        asprintf(&buf, "add    %%r%d, %%r%d, %%r%d", (int)dst, (int)src1,
-                 (int)src2);
-      }
-      break;
+// How the operands of an instruction are laid out
+typedef enum {
+  FMT_OPERATE,     // %rD, %rS, then %rT or $imm5: add, and
+  FMT_NOT,         // %rD, %rS
+  FMT_BR,          // condition in the name, $offset9
+  FMT_JMP,         // %rBase
+  FMT_JSR,         // $offset11, or jsrr %rBase
+  FMT_PC_RELATIVE, // %rD, $offset9: ld, ldi, lea, st, sti
+  FMT_BASE_OFFSET, // %rD, %rBase, $offset6: ldr, str
+  FMT_TRAP,        // named by the vector
+  FMT_VALUE        // not an instruction
+} format_t;
+
+static const struct {
+  const char* name;
+  format_t format;
+} formats[16] = {
+    [OP_BR] = {"br", FMT_BR},
+    [OP_ADD] = {"add", FMT_OPERATE},
+    [OP_LD] = {"ld", FMT_PC_RELATIVE},
+    [OP_ST] = {"st", FMT_PC_RELATIVE},
+    [OP_JSR] = {"jsr", FMT_JSR},
+    [OP_AND] = {"and", FMT_OPERATE},
+    [OP_LDR] = {"ldr", FMT_BASE_OFFSET},
+    [OP_STR] = {"str", FMT_BASE_OFFSET},
+    [OP_RTI] = {"val", FMT_VALUE},
+    [OP_NOT] = {"not", FMT_NOT},
+    [OP_LDI] = {"ldi", FMT_PC_RELATIVE},
+    [OP_STI] = {"sti", FMT_PC_RELATIVE},
+    [OP_JMP] = {"jmp", FMT_JMP},
+    [OP_RES] = {"val", FMT_VALUE},
+    [OP_LEA] = {"lea", FMT_PC_RELATIVE},
+    [OP_TRAP] = {"-", FMT_TRAP},
+};
+
+// Names of the traps, by vector less TRAP_GETC
+static const char* trap_names[] = {"getc", "putc", "puts",
+                                   "enter", "putsp", "halt"};
+
+// Mnemonics are padded to this many columns
+#define NAME_WIDTH 7
+
+static char* put_str(char* out, const char* str) {
+  while (*str != '\0') {
+    *out++ = *str++;
+  }
+  return out;
+}
+
+// Put a mnemonic, padded for the operands that follow
+static char* put_name(char* out, const char* name) {
+  char* end = out + NAME_WIDTH;
+  out = put_str(out, name);
+  while (out < end) {
+    *out++ = ' ';
+  }
+  return out;
+}
+
+static char* put_reg(char* out, int reg) {
+  out[0] = '%';
+  out[1] = 'r';
+  out[2] = '0' + reg;
+  return out + 3;
+}
+
+// Put an immediate as $ and signed decimal
+static char* put_imm(char* out, int value) {
+  char digits[8];
+  int n = 0;
+  *out++ = '$';
+  if (value < 0) {
+    *out++ = '-';
+    value = -value;
+  }
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value > 0);
+  while (n > 0) {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+static char* put_sep(char* out) {
+  out[0] = ',';
+  out[1] = ' ';
+  return out + 2;
+}
+
+// Put a value in hex without leading zeros
+char* decode_hex(char* out, uint32_t value) {
+  static const char hex[] = "0123456789abcdef";
+  int shift = 28;
+  while (shift > 0 && (value >> shift) == 0) {
+    shift -= 4;
+  }
+  for (; shift >= 0; shift -= 4) {
+    *out++ = hex[(value >> shift) & 15];
+  }
+  return out;
+}
 
-    case OP_AND:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      src1 = (reg_t)getbits(instruction, 6, 3);
-      if (getimmediate(instruction) == 1) {
-        value = (uint16_t)sign_extend(getbits(instruction, 0, 5), 5);
-        asprintf(&buf, "and    %%r%d, %%r%d, $%d", (int)dst, (int)src1,
-                 (int)value);
+// Sign extended field of the instruction
+static int field(uint16_t instruction, int bits) {
+  return (int16_t)sign_extend(instruction & ((1 << bits) - 1), bits);
+}
+
+// Decode an instruction into out, driven by the format of its opcode
+size_t decode_into(uint16_t instruction, char* out) {
+  char* start = out;
+  int dst = (instruction >> 9) & 7;
+  int src = (instruction >> 6) & 7;
+  int opcode = instruction >> 12;
+  const char* name = formats[opcode].name;
+
+  switch (formats[opcode].format) {
+    case FMT_OPERATE:
+      out = put_name(out, name);
+      out = put_sep(put_reg(out, dst));
+      out = put_sep(put_reg(out, src));
+      if (instruction & 0x20) {
+        out = put_imm(out, field(instruction, 5));
       } else {
-        src2 = (reg_t)getbits(instruction, 0, 3);
-        asprintf(&buf, "and    %%r%d, %%r%d, %%r%d", (int)dst, (int)src1,
-                 (int)src2);
+        out = put_reg(out, instruction & 7);
       }
       break;
 
-    case OP_NOT:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      src1 = (reg_t)getbits(instruction, 6, 3);
-      asprintf(&buf, "not    %%r%d, %%r%d", (int)dst, (int)src1);
+    case FMT_NOT:
+      out = put_name(out, name);
+      out = put_sep(put_reg(out, dst));
+      out = put_reg(out, src);
       break;
 
-    case OP_BR:
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      cond = (uint16_t)getbits(instruction, 9, 3);
-      snprintf(br, sizeof(br), "br");
-      if (cond & FL_NEG) {
-        strcat(br, "n");
+    case FMT_BR: {
+      char br[6] = "br";
+      char* p = br + 2;
+      if (dst & FL_NEG) {
+        *p++ = 'n';
       }
-      if (cond & FL_ZRO) {
-        strcat(br, "z");
+      if (dst & FL_ZRO) {
+        *p++ = 'z';
       }
-      if (cond & FL_POS) {
-        strcat(br, "p");
+      if (dst & FL_POS) {
+        *p++ = 'p';
       }
-      asprintf(&buf, "%-6s $%d", br, offset);
+      *p = '\0';
+      out = put_name(out, br);
+      out = put_imm(out, field(instruction, 9));
       break;
+    }
 
-    case OP_JMP:
-      base = getbits(instruction, 6, 3);
-      asprintf(&buf, "jmp    %%r%d", base);
+    case FMT_JMP:
+      out = put_name(out, name);
+      out = put_reg(out, src);
       break;
 
-    case OP_JSR:
-      if (getbit(instruction, 11) == 1) {
-        offset = sign_extend(getbits(instruction, 0, 11), 11);
-        asprintf(&buf, "jsr    $%d", offset);
+    case FMT_JSR:
+      if (instruction & 0x800) {
+        out = put_name(out, name);
+        out = put_imm(out, field(instruction, 11));
       } else {
-        base = getbits(instruction, 6, 3);
-        asprintf(&buf, "jsrr   %%r%d", base);
+        out = put_name(out, "jsrr");
+        out = put_reg(out, src);
       }
       break;
 
-    case OP_LD:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      asprintf(&buf, "ld     %%r%d, $%d", dst, offset);
-      break;
-
-    case OP_LDI:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      asprintf(&buf, "ldi    %%r%d, $%d", dst, offset);
-      break;
-
-    case OP_LDR:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      base = getbits(instruction, 6, 3);
-      offset = sign_extend(getbits(instruction, 0, 6), 6);
-      asprintf(&buf, "ldr    %%r%d, %%r%d, $%d", dst, base, offset);
-      break;
-
-    case OP_LEA:
-      dst = (reg_t)getbits(instruction, 9, 3);
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      asprintf(&buf, "lea    %%r%d, $%d", dst, offset);
+    case FMT_PC_RELATIVE:
+      out = put_name(out, name);
+      out = put_sep(put_reg(out, dst));
+      out = put_imm(out, field(instruction, 9));
       break;
 
-    case OP_ST:
-      src1 = (reg_t)getbits(instruction, 9, 3);
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      asprintf(&buf, "st     %%r%d, $%d", src1, offset);
+    case FMT_BASE_OFFSET:
+      out = put_name(out, name);
+      out = put_sep(put_reg(out, dst));
+      out = put_sep(put_reg(out, src));
+      out = put_imm(out, field(instruction, 6));
       break;
 
-    case OP_STI:
-      src1 = (reg_t)getbits(instruction, 9, 3);
-      offset = sign_extend(getbits(instruction, 0, 9), 9);
-      asprintf(&buf, "sti    %%r%d, $%d", src1, offset);
+    case FMT_TRAP: {
+      unsigned int vec = (instruction & 0xff) - TRAP_GETC;
+      out = put_str(out, vec < sizeof(trap_names) / sizeof(trap_names[0])
+                             ? trap_names[vec]
+                             : name);
       break;
+    }
 
-    case OP_STR:
-      src1 = (reg_t)getbits(instruction, 9, 3);
-      base = (reg_t)getbits(instruction, 6, 3);
-      offset = sign_extend(getbits(instruction, 0, 6), 6);
-      asprintf(&buf, "str    %%r%d, %%r%d, $%d", src1, base, offset);
-      break;
-
-    case OP_TRAP:
-      vec = getbits(instruction, 0, 8);
-      if (vec == TRAP_GETC) {
-        asprintf(&buf, "getc");
-      } else if (vec == TRAP_OUT) {
-        asprintf(&buf, "putc");
-      } else if (vec == TRAP_PUTS) {
-        asprintf(&buf, "puts");
-      } else if (vec == TRAP_IN) {
-        asprintf(&buf, "enter");
-      } else if (vec == TRAP_PUTSP) {
-        asprintf(&buf, "putsp");
-      } else if (vec == TRAP_HALT) {
-        asprintf(&buf, "halt");
-      } else {
-        asprintf(&buf, "-");
-      }
-      break;
-
-    // case OP_RES:
-    // case OP_RTI:
     default:
       // Consider everything else a value
-      asprintf(&buf, "val    0x%x", (unsigned int)instruction);
+      out = put_name(out, name);
+      out = put_str(out, "0x");
+      out = decode_hex(out, instruction);
       break;
   }
 
-  return buf;
+  *out = '\0';
+  return out - start;
+}
+
+char* decode(uint16_t instruction) {
+  char buf[DECODE_SIZE];
+  decode_into(instruction, buf);
+  return strdup(buf);
 }
@@ -1,7 +1,20 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
-// Decode instruction and return a pointer to an internal buffer
-// that shows the representation of the instruction
+// Room decode_into needs for any instruction, with the terminating NUL
+#define DECODE_SIZE 32
+
+// Decode instruction and return a newly allocated string that shows the
+// representation of the instruction. The caller frees it.
 char* decode(uint16_t instruction);
+
+// Decode instruction into out, which has room for DECODE_SIZE
+// characters. Return the length of the representation, which is NUL
+// terminated.
+size_t decode_into(uint16_t instruction, char* out);
+
+// Put value in lower case hex without leading zeros and return the end
+// of what was put. Not NUL terminated.
+char* decode_hex(char* out, uint32_t value);
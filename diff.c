@@ -0,0 +1,184 @@
+#include "diff.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode.h"
+#include "instruction.h"
+
+// Number of instructions shown before a divergence
+#define WINDOW 16
+
+static const char* REG_NAMES[MAX_REGISTERS] = {
+    "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND"};
+
+// The last instructions the reference backend executed
+typedef struct {
+  uint16_t pc[WINDOW];
+  uint16_t instruction[WINDOW];
+  uint64_t count;
+} trail_t;
+
+// Does the instruction end a basic block
+static bool ends_block(uint16_t instruction) {
+  switch (getopcode(instruction)) {
+    case OP_BR:
+    case OP_JMP:
+    case OP_JSR:
+    case OP_TRAP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Create a machine with the image and input, collecting output in memory
+static x16_t* setup_machine(const image_t* image, const uint8_t* input,
+                            size_t len) {
+  x16_t* machine = x16_create();
+  image_place(machine, image);
+  io_t* io = x16_io(machine);
+  io_set_headless(io);
+  io_set_input_buffer(io, input, len);
+  io_set_output_buffer(io);
+  return machine;
+}
+
+// Run up to max instructions, stopping at the end of a basic block or when
+// the machine stops. Return the result of the last instruction and store
+// the number executed in count. Instructions are added to trail, if any.
+static int run_block(x16_t* machine, step_fn step, uint64_t max,
+                     uint64_t* count, trail_t* trail) {
+  int rv;
+  uint16_t instruction;
+  *count = 0;
+  do {
+    uint16_t pc = x16_pc(machine);
+    instruction = *x16_memory(machine, pc);
+    if (trail != NULL) {
+      trail->pc[trail->count % WINDOW] = pc;
+      trail->instruction[trail->count % WINDOW] = instruction;
+      trail->count++;
+    }
+    rv = step(machine);
+    ++*count;
+  } while (rv == 0 && !ends_block(instruction) && *count < max);
+  return rv;
+}
+
+// Start the report of a divergence
+static void diverge(uint64_t total, FILE* report) {
+  fprintf(report, "Backends diverge after instruction %llu\n",
+          (unsigned long long)total);
+}
+
+// Describe the first difference between the two machines, if any. Return
+// true if they differ.
+static bool report_difference(x16_t* ref, x16_t* alt, int ref_rv,
+                              int alt_rv, uint64_t total, FILE* report) {
+  if (ref_rv != alt_rv) {
+    diverge(total, report);
+    fprintf(report, "  result: reference %d, alternative %d\n", ref_rv,
+            alt_rv);
+    return true;
+  }
+  for (int i = 0; i < MAX_REGISTERS; i++) {
+    uint16_t a = x16_reg(ref, (reg_t)i);
+    uint16_t b = x16_reg(alt, (reg_t)i);
+    if (a != b) {
+      diverge(total, report);
+      fprintf(report, "  %s: reference 0x%04x, alternative 0x%04x\n",
+              REG_NAMES[i], a, b);
+      return true;
+    }
+  }
+  if (x16_icount(ref) != x16_icount(alt)) {
+    diverge(total, report);
+    fprintf(report, "  clock: reference %llu, alternative %llu\n",
+            (unsigned long long)x16_icount(ref),
+            (unsigned long long)x16_icount(alt));
+    return true;
+  }
+
+  uint16_t* a = x16_memory(ref, 0);
+  uint16_t* b = x16_memory(alt, 0);
+  size_t size = MAX_MEMORY * sizeof(uint16_t);
+  if (memcmp(a, b, size) != 0) {
+    int address = 0;
+    while (a[address] == b[address]) {
+      address++;
+    }
+    diverge(total, report);
+    fprintf(report, "  memory: reference hash %016llx, alternative %016llx\n",
+            (unsigned long long)image_hash((const uint8_t*)a, size),
+            (unsigned long long)image_hash((const uint8_t*)b, size));
+    fprintf(report,
+            "  first difference at 0x%04x: reference 0x%04x, alternative "
+            "0x%04x\n",
+            address, a[address], b[address]);
+    return true;
+  }
+
+  size_t ref_len, alt_len;
+  const char* ref_out = io_output(x16_io(ref), &ref_len);
+  const char* alt_out = io_output(x16_io(alt), &alt_len);
+  if (ref_len != alt_len || memcmp(ref_out, alt_out, ref_len) != 0) {
+    diverge(total, report);
+    fprintf(report, "  output: reference %zu bytes, alternative %zu bytes\n",
+            ref_len, alt_len);
+    return true;
+  }
+  return false;
+}
+
+// Print the last instructions the reference executed
+static void report_trail(const trail_t* trail, FILE* report) {
+  uint64_t first = trail->count > WINDOW ? trail->count - WINDOW : 0;
+  for (uint64_t i = first; i < trail->count; i++) {
+    char* str = decode(trail->instruction[i % WINDOW]);
+    fprintf(report, "%c 0x%04x: %s\n", i + 1 == trail->count ? '>' : ' ',
+            trail->pc[i % WINDOW], str);
+    free(str);
+  }
+}
+
+// Run the image on both backends, comparing them after every basic block
+int diff_run(const image_t* image, const uint8_t* input, size_t len,
+             uint64_t limit, step_fn ref, step_fn alt, FILE* report) {
+  x16_t* ref_machine = setup_machine(image, input, len);
+  x16_t* alt_machine = setup_machine(image, input, len);
+  trail_t trail;
+  trail.count = 0;
+
+  int rv = 0;
+  uint64_t total = 0;
+  while (limit == 0 || total < limit) {
+    uint64_t max = limit == 0 ? UINT64_MAX : limit - total;
+    uint64_t ref_count, alt_count;
+    int ref_rv = run_block(ref_machine, ref, max, &ref_count, &trail);
+    int alt_rv = run_block(alt_machine, alt, ref_count, &alt_count, NULL);
+    total += ref_count;
+
+    if (ref_count != alt_count) {
+      diverge(total, report);
+      fprintf(report, "  block length: reference %llu, alternative %llu\n",
+              (unsigned long long)ref_count, (unsigned long long)alt_count);
+      rv = -1;
+    } else if (report_difference(ref_machine, alt_machine, ref_rv, alt_rv,
+                                 total, report)) {
+      rv = -1;
+    }
+    if (rv != 0) {
+      report_trail(&trail, report);
+      break;
+    }
+    if (ref_rv != 0) {
+      break;
+    }
+  }
+
+  x16_free(ref_machine);
+  x16_free(alt_machine);
+  return rv;
+}
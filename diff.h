@@ -0,0 +1,27 @@
+#ifndef DIFF_H_
+#define DIFF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "loader.h"
+#include "x16.h"
+
+// Differential testing of execution backends. The same image runs with
+// the same input on a reference backend and on an alternative one, a
+// basic block at a time. After each block (a branch, jump, subroutine
+// call or trap ends one) the full architectural state is compared:
+// registers, R_COND, the clock, memory and the output so far.
+
+// Executes one instruction, with the contract of execute_instruction
+typedef int (*step_fn)(x16_t* machine);
+
+// Run the image on both backends until it stops, or for limit
+// instructions if limit is not 0. Return 0 if the backends agree. At the
+// first divergence describe it on report, along with the instructions
+// leading up to it, and return -1.
+int diff_run(const image_t* image, const uint8_t* input, size_t len,
+             uint64_t limit, step_fn ref, step_fn alt, FILE* report);
+
+#endif  // DIFF_H_
@@ -0,0 +1,264 @@
+#include "expr.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Deepest nesting of parentheses and unary operators
+#define MAX_DEPTH 64
+
+typedef struct {
+  const char *p;
+  expr_lookup_t lookup;
+  void *ctx;
+  char *error;
+  size_t error_size;
+  bool failed;
+  int depth;
+} parser_t;
+
+static int32_t parse_or(parser_t *parser);
+
+// Report the first error only
+static int32_t fail(parser_t *parser, const char *message) {
+  if (!parser->failed) {
+    snprintf(parser->error, parser->error_size, "%s", message);
+    parser->failed = true;
+  }
+  return 0;
+}
+
+static void skip_space(parser_t *parser) {
+  while (*parser->p == ' ' || *parser->p == '\t') {
+    parser->p++;
+  }
+}
+
+// Does the input go on with op; if so, consume it
+static bool accept(parser_t *parser, const char *op) {
+  skip_space(parser);
+  size_t len = strlen(op);
+  if (strncmp(parser->p, op, len) != 0) {
+    return false;
+  }
+  // Not the first half of << or >>
+  if (len == 1 && (op[0] == '<' || op[0] == '>') && parser->p[1] == op[0]) {
+    return false;
+  }
+  parser->p += len;
+  return true;
+}
+
+static int32_t parse_number(parser_t *parser) {
+  const char *p = parser->p;
+  int base = 10;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    base = 16;
+    p += 2;
+  } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+    base = 2;
+    p += 2;
+  }
+  uint32_t value = 0;
+  int digits = 0;
+  for (;; p++, digits++) {
+    int digit;
+    if (isdigit((unsigned char)*p)) {
+      digit = *p - '0';
+    } else if (isxdigit((unsigned char)*p) && base == 16) {
+      digit = tolower((unsigned char)*p) - 'a' + 10;
+    } else {
+      break;
+    }
+    if (digit >= base) {
+      return fail(parser, "bad digit in number");
+    }
+    value = value * base + digit;
+  }
+  if (digits == 0 || isalnum((unsigned char)*p) || *p == '_') {
+    return fail(parser, "bad number");
+  }
+  parser->p = p;
+  return (int32_t)value;
+}
+
+// 'c' or an escape: \n \t \r \0 \\ \'
+static int32_t parse_char(parser_t *parser) {
+  const char *p = parser->p + 1;
+  int32_t value;
+  if (*p == '\\') {
+    p++;
+    switch (*p) {
+      case 'n':
+        value = '\n';
+        break;
+      case 't':
+        value = '\t';
+        break;
+      case 'r':
+        value = '\r';
+        break;
+      case '0':
+        value = 0;
+        break;
+      case '\\':
+      case '\'':
+        value = *p;
+        break;
+      default:
+        return fail(parser, "bad escape in character");
+    }
+  } else if (*p == '\0' || *p == '\'') {
+    return fail(parser, "empty character");
+  } else {
+    value = (unsigned char)*p;
+  }
+  if (p[1] != '\'') {
+    return fail(parser, "character not closed");
+  }
+  parser->p = p + 2;
+  return value;
+}
+
+static int32_t parse_name(parser_t *parser) {
+  char name[EXPR_NAME_SIZE];
+  size_t len = 0;
+  while (isalnum((unsigned char)*parser->p) || *parser->p == '_') {
+    if (len + 1 >= sizeof(name)) {
+      return fail(parser, "name too long");
+    }
+    name[len++] = *parser->p++;
+  }
+  name[len] = '\0';
+  int32_t value;
+  if (parser->lookup == NULL ||
+      parser->lookup(parser->ctx, name, &value) != 0) {
+    char message[EXPR_NAME_SIZE + 16];
+    snprintf(message, sizeof(message), "unknown name %s", name);
+    return fail(parser, message);
+  }
+  return value;
+}
+
+static int32_t parse_unary(parser_t *parser) {
+  if (++parser->depth > MAX_DEPTH) {
+    return fail(parser, "expression too deep");
+  }
+  int32_t value;
+  skip_space(parser);
+  char c = *parser->p;
+  if (c == '-' || c == '~' || c == '+') {
+    parser->p++;
+    value = parse_unary(parser);
+    value = c == '-' ? (int32_t)(0u - (uint32_t)value)
+            : c == '~' ? ~value
+                       : value;
+  } else if (c == '(') {
+    parser->p++;
+    value = parse_or(parser);
+    if (!accept(parser, ")")) {
+      value = fail(parser, "missing )");
+    }
+  } else if (isdigit((unsigned char)c)) {
+    value = parse_number(parser);
+  } else if (c == '\'') {
+    value = parse_char(parser);
+  } else if (isalpha((unsigned char)c) || c == '_') {
+    value = parse_name(parser);
+  } else {
+    value = fail(parser,
+                 c == '\0' ? "missing operand" : "unexpected character");
+  }
+  parser->depth--;
+  return value;
+}
+
+static int32_t parse_mul(parser_t *parser) {
+  int32_t value = parse_unary(parser);
+  while (!parser->failed) {
+    if (accept(parser, "*")) {
+      value = (int32_t)((uint32_t)value * (uint32_t)parse_unary(parser));
+    } else if (accept(parser, "/")) {
+      int32_t divisor = parse_unary(parser);
+      if (divisor == 0) {
+        return fail(parser, "division by zero");
+      }
+      // The one quotient that does not fit
+      if (value == INT32_MIN && divisor == -1) {
+        return fail(parser, "division overflows");
+      }
+      value /= divisor;
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+static int32_t parse_add(parser_t *parser) {
+  int32_t value = parse_mul(parser);
+  while (!parser->failed) {
+    if (accept(parser, "+")) {
+      value = (int32_t)((uint32_t)value + (uint32_t)parse_mul(parser));
+    } else if (accept(parser, "-")) {
+      value = (int32_t)((uint32_t)value - (uint32_t)parse_mul(parser));
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+static int32_t parse_shift(parser_t *parser) {
+  int32_t value = parse_add(parser);
+  while (!parser->failed) {
+    if (accept(parser, "<<")) {
+      value = (int32_t)((uint32_t)value << (parse_add(parser) & 31));
+    } else if (accept(parser, ">>")) {
+      value >>= parse_add(parser) & 31;
+    } else {
+      break;
+    }
+  }
+  return value;
+}
+
+static int32_t parse_and(parser_t *parser) {
+  int32_t value = parse_shift(parser);
+  while (!parser->failed && accept(parser, "&")) {
+    value &= parse_shift(parser);
+  }
+  return value;
+}
+
+static int32_t parse_xor(parser_t *parser) {
+  int32_t value = parse_and(parser);
+  while (!parser->failed && accept(parser, "^")) {
+    value ^= parse_and(parser);
+  }
+  return value;
+}
+
+static int32_t parse_or(parser_t *parser) {
+  int32_t value = parse_xor(parser);
+  while (!parser->failed && accept(parser, "|")) {
+    value |= parse_xor(parser);
+  }
+  return value;
+}
+
+int expr_eval(const char *text, expr_lookup_t lookup, void *ctx,
+              int32_t *value, char *error, size_t error_size) {
+  parser_t parser = {text, lookup, ctx, error, error_size, false, 0};
+  int32_t result = parse_or(&parser);
+  skip_space(&parser);
+  if (!parser.failed && *parser.p != '\0') {
+    fail(&parser, *parser.p == ')' ? "unexpected )" : "unexpected character");
+  }
+  if (parser.failed) {
+    return -1;
+  }
+  *value = result;
+  return 0;
+}
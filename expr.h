@@ -0,0 +1,27 @@
+#ifndef EXPR_H_
+#define EXPR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Constant expressions for the assembler. Operators, from the loosest:
+//
+//   |   ^   &   << >>   + -   * /   unary - ~ +
+//
+// with parentheses. Operands are decimal, hex (0x1f) or binary (0b101)
+// numbers, character literals ('A', '\n') and names, which the caller
+// looks up. There is no %, it starts a register in xas. Values are 32
+// bits and wrap around, except that dividing the smallest by -1 fails.
+
+// Look up a name. Return 0 and set value, or -1 if there is no such name.
+typedef int (*expr_lookup_t)(void *ctx, const char *name, int32_t *value);
+
+// Most characters in a name
+#define EXPR_NAME_SIZE 64
+
+// Evaluate an expression. Return 0 on success, or -1 with a message in
+// error.
+int expr_eval(const char *text, expr_lookup_t lookup, void *ctx,
+              int32_t *value, char *error, size_t error_size);
+
+#endif  // EXPR_H_
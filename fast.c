@@ -0,0 +1,179 @@
+#include "fast.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "decode.h"
+#include "instruction.h"
+#include "trap.h"
+
+// First address of the memory mapped registers. Everything below it is
+// plain memory.
+#define MMIO_BASE 0xfe00
+
+// Sign extend the low bits of a value
+static inline uint16_t sext(uint16_t value, int bits) {
+  uint16_t sign = 1 << (bits - 1);
+  value &= (1 << bits) - 1;
+  return (value ^ sign) - sign;
+}
+
+// Plain memory is accessed directly, unless the machine has to see every
+// access (see x16_direct_memory); memory is NULL then
+static inline uint16_t load(x16_t* machine, uint16_t* memory,
+                            uint16_t address) {
+  return memory != NULL && address < MMIO_BASE
+             ? memory[address]
+             : x16_memread(machine, address);
+}
+
+static inline void store(x16_t* machine, uint16_t* memory, uint16_t address,
+                         uint16_t value) {
+  if (memory != NULL && address < MMIO_BASE) {
+    memory[address] = value;
+  } else {
+    x16_memwrite(machine, address, value);
+  }
+}
+
+// Set R_COND from a result
+static inline void setcc(uint16_t* reg, uint16_t value) {
+  reg[R_COND] = value == 0 ? FL_ZRO : (value & 0x8000) ? FL_NEG : FL_POS;
+}
+
+// Execute a single instruction
+int fast_execute(x16_t* machine) {
+  uint16_t* reg = x16_registers(machine);
+  uint16_t* memory =
+      x16_direct_memory(machine) ? x16_memory(machine, 0) : NULL;
+
+  uint16_t pc = reg[R_PC];
+  uint16_t instruction = load(machine, memory, pc);
+  reg[R_PC] = ++pc;
+  x16_tick(machine);
+  x16_cover(machine, pc - 1);
+
+  FILE* log = x16_log(machine);
+  if (log != NULL) {
+    char str[DECODE_SIZE];
+    decode_into(instruction, str);
+    fprintf(log, "0x%x: %s\n", pc - 1, str);
+  }
+
+  int dst = (instruction >> 9) & 7;
+  int src = (instruction >> 6) & 7;
+  uint16_t value;
+  switch (instruction >> 12) {
+    case OP_ADD:
+      value = reg[src] + ((instruction & 0x20) ? sext(instruction, 5)
+                                               : reg[instruction & 7]);
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_AND:
+      value = reg[src] & ((instruction & 0x20) ? sext(instruction, 5)
+                                               : reg[instruction & 7]);
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_NOT:
+      value = ~reg[src];
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_BR:
+      // No condition bits means always. The n, z and p bits line up with
+      // FL_NEG, FL_ZRO and FL_POS.
+      if (dst == 0 || (dst & reg[R_COND]) != 0) {
+        reg[R_PC] = pc + sext(instruction, 9);
+      }
+      break;
+
+    case OP_JMP:
+      reg[R_PC] = reg[src];
+      break;
+
+    case OP_JSR:
+      // R7 is saved first, so JSRR R7 jumps to the next instruction
+      reg[R_R7] = pc;
+      if (instruction & 0x800) {
+        reg[R_PC] = pc + sext(instruction, 11);
+      } else {
+        reg[R_PC] = reg[src];
+      }
+      break;
+
+    case OP_LD:
+      value = load(machine, memory, pc + sext(instruction, 9));
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_LDI:
+      value = load(machine, memory, pc + sext(instruction, 9));
+      value = load(machine, memory, value);
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_LDR:
+      value = load(machine, memory, reg[src] + sext(instruction, 6));
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_LEA:
+      value = pc + sext(instruction, 9);
+      reg[dst] = value;
+      setcc(reg, value);
+      break;
+
+    case OP_ST:
+      store(machine, memory, pc + sext(instruction, 9), reg[dst]);
+      break;
+
+    case OP_STI:
+      value = load(machine, memory, pc + sext(instruction, 9));
+      store(machine, memory, value, reg[dst]);
+      break;
+
+    case OP_STR:
+      store(machine, memory, reg[src] + sext(instruction, 6), reg[dst]);
+      break;
+
+    case OP_TRAP:
+      return trap(machine, instruction);
+
+    default:
+      // OP_RTI and OP_RES are never used, the guest faults
+      x16_rewind(machine);
+      return -2;
+  }
+
+  // A guest polling a keyboard that will never have a key stops here
+  if (x16_input_ended(machine)) {
+    return -1;
+  }
+  return 0;
+}
+
+// Run instructions until the machine stops or the limit is reached
+x16_exit_t fast_run(x16_t* machine, uint64_t limit) {
+  for (uint64_t i = 0; limit == 0 || i < limit; i++) {
+    int rv = fast_execute(machine);
+    if (rv == 1) {
+      return X16_WAIT;
+    }
+    if (rv == -2) {
+      return X16_FAULT;
+    }
+    if (rv != 0) {
+      return x16_io(machine)->eof ? X16_EOF : X16_HALT;
+    }
+  }
+  return X16_LIMIT;
+}
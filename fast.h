@@ -0,0 +1,20 @@
+#ifndef FAST_H_
+#define FAST_H_
+
+#include "control.h"
+#include "x16.h"
+
+// A second interpreter. It decodes with shifts and masks inline and
+// reaches the register file and ordinary memory directly, going through
+// x16_memread/x16_memwrite only for the page of memory mapped registers or
+// when the machine has to see every access (x16_direct_memory).
+// It must behave exactly like execute_instruction, which the differential
+// runner in diff.h checks.
+
+// Execute a single instruction. Same contract as execute_instruction.
+int fast_execute(x16_t* machine);
+
+// Run up to limit instructions on the fast interpreter, like x16_run
+x16_exit_t fast_run(x16_t* machine, uint64_t limit);
+
+#endif  // FAST_H_
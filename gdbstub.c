@@ -0,0 +1,620 @@
+#include "gdbstub.h"
+
+#include <ctype.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+
+// Largest packet either side sends, as advertised in qSupported
+#define PACKET_SIZE 4096
+
+// Instructions run between checks for an interrupt from the debugger
+#define CHUNK 65536
+
+// Words per page of the breakpoint bitmap
+#define PAGE_BITS 8
+
+// Software breakpoints. A page without breakpoints costs a single load to
+// check, and with no breakpoints at all the guest runs through x16_run.
+typedef struct {
+  uint16_t per_page[MAX_MEMORY >> PAGE_BITS];
+  uint64_t bits[MAX_MEMORY / 64];
+  int count;
+} breakpoints_t;
+
+typedef struct session session_t;
+
+// A watchpoint set by the debugger, on the bytes from address on
+typedef struct {
+  session_t* session;
+  uint32_t address;
+  uint32_t len;
+  char type;  // '2' write, '3' read, '4' access, 0 if the slot is free
+  int id;     // of the machine's watchpoint
+} gdb_watch_t;
+
+struct session {
+  x16_t* machine;
+  int fd;
+  char in[PACKET_SIZE];
+  size_t in_pos;
+  size_t in_len;
+  bool ack;     // acknowledge packets, until QStartNoAckMode
+  bool exited;  // the guest halted or ran out of input
+  x16_exit_t reason;
+  breakpoints_t breakpoints;
+  gdb_watch_t watches[X16_MAX_WATCHES];
+  int nwatches;
+  const gdb_watch_t* hit;  // the watchpoint that triggered, if any
+  uint16_t hit_address;
+};
+
+static bool breakpoint_at(const breakpoints_t* bp, uint16_t address) {
+  return bp->per_page[address >> PAGE_BITS] != 0 &&
+         (bp->bits[address / 64] >> (address % 64)) & 1;
+}
+
+static void set_breakpoint(breakpoints_t* bp, uint16_t address, bool on) {
+  if (breakpoint_at(bp, address) == on) {
+    return;
+  }
+  bp->bits[address / 64] ^= (uint64_t)1 << (address % 64);
+  bp->per_page[address >> PAGE_BITS] += on ? 1 : -1;
+  bp->count += on ? 1 : -1;
+}
+
+static bool stop_at_breakpoint(x16_t* machine, void* arg) {
+  return breakpoint_at((const breakpoints_t*)arg, x16_pc(machine));
+}
+
+// Note the first watchpoint that triggers, to stop after the instruction
+static void watch_hit(x16_t* machine, uint16_t address, uint16_t value,
+                      x16_watch_t kind, void* arg) {
+  gdb_watch_t* watch = (gdb_watch_t*)arg;
+  if (watch->session->hit == NULL) {
+    watch->session->hit = watch;
+    watch->session->hit_address = address;
+  }
+}
+
+// Add or remove a watchpoint of the given type. Return 0 on success or -1
+// if there is no room for it or no such watchpoint.
+static int set_watch(session_t* s, char type, uint32_t address, uint32_t len,
+                     bool on) {
+  static const x16_watch_t kinds[] = {X16_WATCH_WRITE, X16_WATCH_READ,
+                                      X16_WATCH_ACCESS};
+  for (int i = 0; i < X16_MAX_WATCHES; i++) {
+    gdb_watch_t* w = &s->watches[i];
+    if (on && w->type == 0) {
+      uint16_t first = (address / 2) & 0xffff;
+      uint16_t last = ((address + (len > 0 ? len : 1) - 1) / 2) & 0xffff;
+      w->id = x16_watch(s->machine, first, last < first ? 0xffff : last,
+                        kinds[type - '2'], watch_hit, w);
+      if (w->id < 0) {
+        return -1;
+      }
+      w->session = s;
+      w->address = address;
+      w->len = len;
+      w->type = type;
+      s->nwatches++;
+      return 0;
+    }
+    if (!on && w->type == type && w->address == address && w->len == len) {
+      x16_unwatch(s->machine, w->id);
+      w->type = 0;
+      s->nwatches--;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Read a byte from the debugger. Return -1 when it disconnected.
+static int read_byte(session_t* s) {
+  if (s->in_pos == s->in_len) {
+    ssize_t n = read(s->fd, s->in, sizeof(s->in));
+    if (n <= 0) {
+      return -1;
+    }
+    s->in_pos = 0;
+    s->in_len = n;
+  }
+  return (unsigned char)s->in[s->in_pos++];
+}
+
+// Has the debugger sent an interrupt (Ctrl-C) while the guest runs
+static bool interrupted(session_t* s) {
+  struct pollfd pfd = {s->fd, POLLIN, 0};
+  while (s->in_pos < s->in_len || poll(&pfd, 1, 0) > 0) {
+    int ch = read_byte(s);
+    if (ch == 0x03 || ch < 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int hex_value(int ch) {
+  if (ch >= '0' && ch <= '9') {
+    return ch - '0';
+  }
+  ch = tolower(ch);
+  return ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : -1;
+}
+
+// Read a packet into buf. Return its length or -1 when the debugger
+// disconnected.
+static int read_packet(session_t* s, char* buf) {
+  for (;;) {
+    int ch;
+    do {
+      ch = read_byte(s);
+    } while (ch >= 0 && ch != '$');
+    if (ch < 0) {
+      return -1;
+    }
+    int len = 0;
+    uint8_t sum = 0;
+    while ((ch = read_byte(s)) >= 0 && ch != '#') {
+      if (len < PACKET_SIZE - 1) {
+        buf[len++] = ch;
+      }
+      sum += ch;
+    }
+    int hi = read_byte(s), lo = read_byte(s);
+    if (ch < 0 || lo < 0) {
+      return -1;
+    }
+    buf[len] = '\0';
+    bool valid = hex_value(hi) * 16 + hex_value(lo) == sum;
+    if (s->ack && write(s->fd, valid ? "+" : "-", 1) != 1) {
+      return -1;
+    }
+    if (valid || !s->ack) {
+      return len;
+    }
+  }
+}
+
+// Send a packet, again until the debugger acknowledges it
+static int send_packet(session_t* s, const char* data) {
+  static const char digits[] = "0123456789abcdef";
+  size_t len = strlen(data);
+  char out[PACKET_SIZE + 4];
+  uint8_t sum = 0;
+  out[0] = '$';
+  for (size_t i = 0; i < len; i++) {
+    out[i + 1] = data[i];
+    sum += (uint8_t)data[i];
+  }
+  out[len + 1] = '#';
+  out[len + 2] = digits[sum >> 4];
+  out[len + 3] = digits[sum & 15];
+  for (;;) {
+    if (write(s->fd, out, len + 4) != (ssize_t)(len + 4)) {
+      return -1;
+    }
+    if (!s->ack) {
+      return 0;
+    }
+    int ch;
+    do {
+      ch = read_byte(s);
+    } while (ch >= 0 && ch != '+' && ch != '-');
+    if (ch != '-') {
+      return ch < 0 ? -1 : 0;
+    }
+  }
+}
+
+// Parse hex digits up to a character that is not one. Return the value
+// and leave p past the digits.
+static uint32_t parse_hex(const char** p) {
+  uint32_t value = 0;
+  int digit;
+  while ((digit = hex_value(**p)) >= 0) {
+    value = value * 16 + digit;
+    (*p)++;
+  }
+  return value;
+}
+
+// Append a 16 bit value as little endian hex
+static char* put_word(char* out, uint16_t value) {
+  sprintf(out, "%02x%02x", value & 0xff, value >> 8);
+  return out + 4;
+}
+
+// Parse a 16 bit little endian hex value
+static uint16_t get_word(const char* in) {
+  int v[4];
+  for (int i = 0; i < 4; i++) {
+    v[i] = hex_value(in[i]);
+    if (v[i] < 0) {
+      return 0;
+    }
+  }
+  return (v[0] << 4 | v[1]) | (v[2] << 4 | v[3]) << 8;
+}
+
+// Read debugger bytes, each word once, through x16_memread
+static void read_memory(session_t* s, uint32_t address, uint32_t len,
+                        char* out) {
+  uint16_t word = 0;
+  for (uint32_t i = 0; i < len; i++, address++) {
+    if (i == 0 || address % 2 == 0) {
+      word = x16_memread(s->machine, (address / 2) & 0xffff);
+    }
+    uint8_t byte = address % 2 ? word >> 8 : word & 0xff;
+    out += sprintf(out, "%02x", byte);
+  }
+}
+
+// Write debugger bytes through x16_memwrite, merging a lone byte into the
+// word it belongs to
+static void write_memory(session_t* s, uint32_t address, uint32_t len,
+                         const char* in) {
+  for (uint32_t i = 0; i < len; i++, address++) {
+    uint16_t word_address = (address / 2) & 0xffff;
+    uint8_t byte = hex_value(in[2 * i]) << 4 | hex_value(in[2 * i + 1]);
+    if (address % 2 == 0 && i + 1 < len) {
+      uint8_t high = hex_value(in[2 * i + 2]) << 4 | hex_value(in[2 * i + 3]);
+      x16_memwrite(s->machine, word_address, byte | high << 8);
+      i++;
+      address++;
+    } else {
+      uint16_t word = x16_memread(s->machine, word_address);
+      word = address % 2 ? (word & 0xff) | byte << 8 : (word & 0xff00) | byte;
+      x16_memwrite(s->machine, word_address, word);
+    }
+  }
+}
+
+// Write the stop reply for the guest having stopped with the given signal
+static void stop_reply(session_t* s, const char* signal, char* reply) {
+  static const char* names[] = {"watch", "rwatch", "awatch"};
+  if (s->exited) {
+    strcpy(reply, s->reason == X16_EOF ? "W03" : "W00");
+  } else if (s->hit != NULL) {
+    sprintf(reply, "T05%s:%x;", names[s->hit->type - '2'],
+            s->hit_address * 2);
+  } else {
+    strcpy(reply, signal);
+  }
+}
+
+// Run the guest a step at a time, or on to a breakpoint, and write the
+// stop reply
+static void resume(session_t* s, bool step, char* reply) {
+  x16_t* machine = s->machine;
+  s->hit = NULL;
+  if (s->exited) {
+    stop_reply(s, NULL, reply);
+    return;
+  }
+  for (;;) {
+    x16_exit_t reason = X16_LIMIT;
+    if (step) {
+      reason = x16_run(machine, 1);
+    } else if (s->breakpoints.count == 0 && s->nwatches == 0) {
+      reason = x16_run(machine, CHUNK);
+    } else {
+      for (int i = 0; i < CHUNK && reason == X16_LIMIT; i++) {
+        reason = x16_run(machine, 1);
+        if (reason == X16_LIMIT &&
+            (s->hit != NULL ||
+             breakpoint_at(&s->breakpoints, x16_pc(machine)))) {
+          stop_reply(s, "S05", reply);
+          return;
+        }
+      }
+    }
+    if (reason == X16_FAULT) {
+      stop_reply(s, "S04", reply);  // SIGILL, at the instruction
+      return;
+    }
+    if (reason == X16_HALT || reason == X16_EOF) {
+      s->exited = true;
+      s->reason = reason;
+      stop_reply(s, NULL, reply);
+      return;
+    }
+    if (step) {
+      stop_reply(s, "S05", reply);
+      return;
+    }
+    if (interrupted(s)) {
+      strcpy(reply, "S02");
+      return;
+    }
+  }
+}
+
+// Run the guest backwards a step at a time, or back to a breakpoint
+static const char* reverse(session_t* s, bool step) {
+  int rv = step ? x16_reverse_step(s->machine)
+                : x16_reverse_continue(s->machine, stop_at_breakpoint,
+                                       &s->breakpoints);
+  s->exited = false;
+  s->hit = NULL;
+  return rv == 0 ? "S05" : "T05replaylog:begin;";
+}
+
+// What to do once a packet is handled
+typedef enum {
+  CARRY_ON,
+  STOP_ACKING,  // after replying, QStartNoAckMode
+  KILLED,       // no reply
+  DETACHED
+} action_t;
+
+// Handle one packet and fill in the reply
+static action_t handle(session_t* s, const char* packet, char* reply) {
+  x16_t* machine = s->machine;
+  const char* p = packet + 1;
+  uint32_t address, len;
+  char type;
+  reply[0] = '\0';
+  switch (packet[0]) {
+    case '?':
+      stop_reply(s, "S05", reply);
+      break;
+
+    case 'g':
+      for (int r = 0; r < MAX_REGISTERS; r++) {
+        reply = put_word(reply, x16_reg(machine, (reg_t)r));
+      }
+      break;
+
+    case 'G':
+      if (strlen(p) < 4 * MAX_REGISTERS) {
+        strcpy(reply, "E01");
+        break;
+      }
+      for (int r = 0; r < MAX_REGISTERS; r++) {
+        x16_set(machine, (reg_t)r, get_word(p + 4 * r));
+      }
+      strcpy(reply, "OK");
+      break;
+
+    case 'p':
+      address = parse_hex(&p);
+      if (address >= MAX_REGISTERS) {
+        strcpy(reply, "E01");
+      } else {
+        put_word(reply, x16_reg(machine, (reg_t)address));
+      }
+      break;
+
+    case 'P':
+      address = parse_hex(&p);
+      if (address >= MAX_REGISTERS || *p != '=' || strlen(p + 1) < 4) {
+        strcpy(reply, "E01");
+      } else {
+        x16_set(machine, (reg_t)address, get_word(p + 1));
+        strcpy(reply, "OK");
+      }
+      break;
+
+    case 'm':
+      address = parse_hex(&p);
+      len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+      if (len > PACKET_SIZE / 2 - 1) {
+        len = PACKET_SIZE / 2 - 1;
+      }
+      read_memory(s, address, len, reply);
+      break;
+
+    case 'M':
+      address = parse_hex(&p);
+      len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+      if (*p != ':' || strlen(p + 1) < 2 * len) {
+        strcpy(reply, "E01");
+      } else {
+        write_memory(s, address, len, p + 1);
+        strcpy(reply, "OK");
+      }
+      break;
+
+    case 'c':
+    case 's':
+      if (*p != '\0') {
+        x16_set(machine, R_PC, (parse_hex(&p) / 2) & 0xffff);
+      }
+      resume(s, packet[0] == 's', reply);
+      break;
+
+    case 'b':
+      if (strcmp(p, "s") == 0 || strcmp(p, "c") == 0) {
+        strcpy(reply, reverse(s, *p == 's'));
+      }
+      break;
+
+    case 'Z':
+    case 'z':
+      type = *p;
+      if (type < '0' || type > '4') {
+        break;
+      }
+      p++;
+      if (*p++ != ',') {
+        strcpy(reply, "E01");
+        break;
+      }
+      address = parse_hex(&p);
+      len = *p == ',' ? (p++, parse_hex(&p)) : 0;
+      if (type >= '2') {
+        bool ok = set_watch(s, type, address, len, packet[0] == 'Z') == 0;
+        strcpy(reply, ok ? "OK" : "E01");
+        break;
+      }
+      // Software and hardware breakpoints are the same thing here
+      set_breakpoint(&s->breakpoints, (address / 2) & 0xffff,
+                     packet[0] == 'Z');
+      strcpy(reply, "OK");
+      break;
+
+    case 'H':
+    case 'T':
+      strcpy(reply, "OK");
+      break;
+
+    case 'q':
+      if (strncmp(p, "Supported", 9) == 0) {
+        sprintf(reply,
+                "PacketSize=%x;QStartNoAckMode+;ReverseStep+;"
+                "ReverseContinue+",
+                PACKET_SIZE);
+      } else if (strcmp(p, "Attached") == 0) {
+        strcpy(reply, "1");
+      } else if (strcmp(p, "C") == 0) {
+        strcpy(reply, "QC1");
+      } else if (strcmp(p, "fThreadInfo") == 0) {
+        strcpy(reply, "m1");
+      } else if (strcmp(p, "sThreadInfo") == 0) {
+        strcpy(reply, "l");
+      }
+      break;
+
+    case 'Q':
+      if (strcmp(p, "StartNoAckMode") == 0) {
+        strcpy(reply, "OK");
+        return STOP_ACKING;
+      }
+      break;
+
+    case 'D':
+      strcpy(reply, "OK");
+      return DETACHED;
+
+    case 'k':
+      return KILLED;
+
+    default:
+      // An empty reply tells the debugger the packet is not supported
+      break;
+  }
+  return CARRY_ON;
+}
+
+// Serve a debugger on a connection
+int gdb_session(x16_t* machine, int fd) {
+  session_t* s = (session_t*)calloc(1, sizeof(session_t));
+  s->machine = machine;
+  s->fd = fd;
+  s->ack = true;
+  // History the session turns on for reverse execution is its own to
+  // turn off again
+  bool own_history = x16_direct_memory(machine);
+  if (own_history) {
+    x16_set_history(machine, GDB_HISTORY);
+  }
+
+  char* packet = (char*)malloc(PACKET_SIZE);
+  char* reply = (char*)malloc(2 * PACKET_SIZE);
+  // A debugger that just goes away leaves the guest where it was
+  int rv = 0;
+  while (read_packet(s, packet) >= 0) {
+    action_t action = handle(s, packet, reply);
+    if (action == KILLED) {
+      break;
+    }
+    if (send_packet(s, reply) != 0) {
+      rv = -1;
+      break;
+    }
+    if (action == STOP_ACKING) {
+      s->ack = false;
+    } else if (action == DETACHED) {
+      // A guest that already stopped has nothing left to run
+      rv = s->exited ? 0 : GDB_DETACHED;
+      break;
+    }
+  }
+  for (int i = 0; i < X16_MAX_WATCHES; i++) {
+    if (s->watches[i].type != 0) {
+      x16_unwatch(machine, s->watches[i].id);
+    }
+  }
+  if (own_history) {
+    x16_set_history(machine, 0);
+  }
+  free(packet);
+  free(reply);
+  free(s);
+  return rv;
+}
+
+// Listen on a port or a socket path and accept one connection. Return
+// the connection or -1.
+static int accept_debugger(const char* where) {
+  bool is_port = *where != '\0' && strspn(where, "0123456789") == strlen(where);
+  int listen_fd;
+  if (is_port) {
+    if (strlen(where) > 5 || atol(where) < 1 || atol(where) > 65535) {
+      return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)atol(where));
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      return -1;
+    }
+    int on = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(listen_fd);
+      return -1;
+    }
+  } else {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(where) >= sizeof(addr.sun_path)) {
+      return -1;
+    }
+    strcpy(addr.sun_path, where);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+      return -1;
+    }
+    unlink(where);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(listen_fd);
+      return -1;
+    }
+  }
+  int fd = -1;
+  if (listen(listen_fd, 1) == 0) {
+    fprintf(stderr, "Waiting for GDB on %s\n", where);
+    fd = accept(listen_fd, NULL, NULL);
+  }
+  close(listen_fd);
+  if (!is_port) {
+    unlink(where);
+  }
+  return fd;
+}
+
+// Wait for a debugger and serve it
+int gdb_serve(x16_t* machine, const char* where) {
+  int fd = accept_debugger(where);
+  if (fd < 0) {
+    return -1;
+  }
+  int rv = gdb_session(machine, fd);
+  close(fd);
+  return rv;
+}
@@ -0,0 +1,34 @@
+#ifndef GDBSTUB_H_
+#define GDBSTUB_H_
+
+#include "x16.h"
+
+// A stub for the GDB remote serial protocol, so a debugger can drive a
+// machine: read and write registers and memory, single step, continue to
+// software breakpoints or watchpoints (see x16_watch) and, with history
+// (x16_set_history), step and continue backwards.
+//
+// Registers are R0-R7, PC and COND, numbered 0 to 9, each 16 bits and
+// sent little endian. The debugger sees memory as bytes: word address a
+// is byte address 2 * a, low byte first.
+
+// Memory budget of the history kept for reverse execution, in bytes
+#define GDB_HISTORY (16 << 20)
+
+// gdb_session and gdb_serve return this when the debugger detached and
+// left a guest that has not stopped to run on
+#define GDB_DETACHED 1
+
+// Serve a debugger on a connected socket until it kills the guest,
+// detaches or disconnects. A machine without history gets GDB_HISTORY
+// for the session, and none again once it ends. Return 0, GDB_DETACHED,
+// or -1 if the connection failed.
+int gdb_session(x16_t* machine, int fd);
+
+// Wait for a debugger on a TCP port of the loopback interface, if where
+// is a number from 1 to 65535, or else on a Unix domain socket at that
+// path, and serve it. Return as gdb_session does, or -1 if it cannot
+// listen.
+int gdb_serve(x16_t* machine, const char* where);
+
+#endif  // GDBSTUB_H_
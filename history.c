@@ -0,0 +1,228 @@
+#include "history.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Most snapshots kept, spread over the window of frames
+#define MAX_SNAPSHOTS 8
+
+// Registers before an instruction ran, at the given clock
+typedef struct {
+  uint64_t count;
+  uint16_t registers[MAX_REGISTERS];
+} frame_t;
+
+// A memory write made at the given clock, and the value it replaced
+typedef struct {
+  uint64_t count;
+  uint16_t address;
+  uint16_t value;
+} undo_t;
+
+// Memory at the given clock
+typedef struct {
+  uint64_t count;
+  uint16_t memory[MAX_MEMORY];
+} snapshot_t;
+
+// A ring buffer of fixed size records. The newest is at head - 1.
+typedef struct {
+  char *items;
+  size_t size;  // bytes per record
+  size_t cap;
+  size_t head;
+  size_t len;
+} ring_t;
+
+struct history {
+  ring_t frames;
+  ring_t undos;
+  ring_t snapshots;
+  uint64_t interval;  // instructions between snapshots
+  uint64_t start;     // earliest clock that can be reached
+};
+
+static void ring_init(ring_t *ring, size_t size, size_t cap) {
+  ring->items = cap > 0 ? (char *)malloc(size * cap) : NULL;
+  ring->size = size;
+  ring->cap = cap;
+  ring->head = 0;
+  ring->len = 0;
+}
+
+// Get the record that is n places from the newest
+static void *ring_at(ring_t *ring, size_t n) {
+  return ring->items + ((ring->head + ring->cap - 1 - n) % ring->cap) *
+                           ring->size;
+}
+
+// Make room for a new record and return it. If the ring is full the
+// oldest record is copied to dropped first, if given, and overwritten.
+static void *ring_push(ring_t *ring, void *dropped, bool *lost) {
+  void *item = ring->items + ring->head * ring->size;
+  *lost = ring->len == ring->cap;
+  if (*lost) {
+    if (dropped != NULL) {
+      memcpy(dropped, item, ring->size);
+    }
+  } else {
+    ring->len++;
+  }
+  ring->head = (ring->head + 1) % ring->cap;
+  return item;
+}
+
+static void ring_pop(ring_t *ring) {
+  ring->head = (ring->head + ring->cap - 1) % ring->cap;
+  ring->len--;
+}
+
+// Create the history, splitting the budget between frames, the undo log
+// and snapshots
+history_t *history_create(size_t budget, uint64_t count) {
+  history_t *history = (history_t *)malloc(sizeof(history_t));
+  size_t snapshots = budget / 4 / sizeof(snapshot_t);
+  if (snapshots > MAX_SNAPSHOTS) {
+    snapshots = MAX_SNAPSHOTS;
+  }
+  size_t rest = budget - snapshots * sizeof(snapshot_t);
+  size_t frames = rest * 2 / 3 / sizeof(frame_t);
+  size_t undos = rest / 3 / sizeof(undo_t);
+  ring_init(&history->frames, sizeof(frame_t), frames > 0 ? frames : 1);
+  ring_init(&history->undos, sizeof(undo_t), undos > 0 ? undos : 1);
+  ring_init(&history->snapshots, sizeof(snapshot_t), snapshots);
+  history->interval = snapshots > 0 ? frames / snapshots : 0;
+  if (snapshots > 0 && history->interval == 0) {
+    history->interval = 1;
+  }
+  history->start = count;
+  return history;
+}
+
+void history_free(history_t *history) {
+  free(history->frames.items);
+  free(history->undos.items);
+  free(history->snapshots.items);
+  free(history);
+}
+
+// Forget all history
+void history_reset(history_t *history, uint64_t count) {
+  history->frames.len = 0;
+  history->undos.len = 0;
+  history->snapshots.len = 0;
+  history->start = count;
+}
+
+// Raise the start of the history past a record that was dropped
+static void drop_before(history_t *history, uint64_t count) {
+  if (count > history->start) {
+    history->start = count;
+  }
+}
+
+// Record the registers before the instruction, and every interval
+// instructions the memory as well
+void history_step(history_t *history, x16_t *machine) {
+  uint64_t count = x16_icount(machine);
+  frame_t dropped;
+  bool lost;
+  frame_t *frame = (frame_t *)ring_push(&history->frames, &dropped, &lost);
+  if (lost) {
+    drop_before(history, dropped.count + 1);
+  }
+  frame->count = count;
+  memcpy(frame->registers, x16_registers(machine), sizeof(frame->registers));
+  frame->registers[R_PC]--;
+
+  if (history->interval > 0 && count % history->interval == 0) {
+    snapshot_t *snap =
+        (snapshot_t *)ring_push(&history->snapshots, NULL, &lost);
+    snap->count = count;
+    memcpy(snap->memory, x16_memory(machine, 0), sizeof(snap->memory));
+  }
+}
+
+// Drop the frame and snapshot of an instruction that will run again
+void history_unstep(history_t *history, uint64_t count) {
+  while (history->frames.len > 0 &&
+         ((frame_t *)ring_at(&history->frames, 0))->count >= count) {
+    ring_pop(&history->frames);
+  }
+  while (history->snapshots.len > 0 &&
+         ((snapshot_t *)ring_at(&history->snapshots, 0))->count >= count) {
+    ring_pop(&history->snapshots);
+  }
+}
+
+// Add a write to the undo log
+void history_write(history_t *history, uint64_t count, uint16_t address,
+                   uint16_t old) {
+  undo_t dropped;
+  bool lost;
+  undo_t *undo = (undo_t *)ring_push(&history->undos, &dropped, &lost);
+  if (lost) {
+    drop_before(history, dropped.count);
+  }
+  undo->count = count;
+  undo->address = address;
+  undo->value = old;
+}
+
+// Earliest reachable clock
+uint64_t history_start(history_t *history) { return history->start; }
+
+// Go back to the given clock
+int history_travel(history_t *history, x16_t *machine, uint64_t count) {
+  uint64_t now = x16_icount(machine);
+  if (count > now || count < history->start) {
+    return -1;
+  }
+  uint16_t *memory = x16_memory(machine, 0);
+  uint16_t *registers = x16_registers(machine);
+
+  // Start from the earliest snapshot at or after the target, if any. The
+  // writes it already undoes are dropped.
+  snapshot_t *best = NULL;
+  for (size_t i = 0; i < history->snapshots.len; i++) {
+    snapshot_t *snap = (snapshot_t *)ring_at(&history->snapshots, i);
+    if (snap->count < count) {
+      break;
+    }
+    best = snap;
+  }
+  if (best != NULL) {
+    memcpy(memory, best->memory, sizeof(best->memory));
+    while (history->undos.len > 0 &&
+           ((undo_t *)ring_at(&history->undos, 0))->count >
+               best->count) {
+      ring_pop(&history->undos);
+    }
+  }
+
+  // Undo the remaining writes, newest first
+  while (history->undos.len > 0) {
+    undo_t *undo = (undo_t *)ring_at(&history->undos, 0);
+    if (undo->count <= count) {
+      break;
+    }
+    memory[undo->address] = undo->value;
+    ring_pop(&history->undos);
+  }
+
+  // The frame of the instruction that ran at the target has its registers
+  while (history->frames.len > 0) {
+    frame_t *frame = (frame_t *)ring_at(&history->frames, 0);
+    if (frame->count < count) {
+      break;
+    }
+    if (frame->count == count) {
+      memcpy(registers, frame->registers, sizeof(frame->registers));
+    }
+    ring_pop(&history->frames);
+  }
+  history_unstep(history, count);
+  x16_set_icount(machine, count);
+  return 0;
+}
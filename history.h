@@ -0,0 +1,50 @@
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x16.h"
+
+// The history of a machine lets it go back in time. It keeps, within a
+// memory budget:
+//
+//   - a frame per instruction: the clock and registers before it ran
+//   - an undo log of memory writes: the clock and the previous value
+//   - periodic snapshots of memory, so going far back does not have to
+//     undo every write on the way
+//
+// When the budget is used up the oldest history is dropped. Console input
+// and output, and the countdown timer, are not rewound.
+
+typedef struct history history_t;
+
+// Create a history for a machine whose clock is at count
+history_t *history_create(size_t budget, uint64_t count);
+
+// Free a history
+void history_free(history_t *history);
+
+// Forget everything before the clock at count, e.g. after a snapshot was
+// restored
+void history_reset(history_t *history, uint64_t count);
+
+// Record the instruction that is about to run. Called after the fetch, so
+// the PC already points past it.
+void history_step(history_t *history, x16_t *machine);
+
+// Forget the instruction that was fetched last, see x16_rewind
+void history_unstep(history_t *history, uint64_t count);
+
+// Record a memory write at the given clock
+void history_write(history_t *history, uint64_t count, uint16_t address,
+                   uint16_t old);
+
+// Earliest clock the machine can go back to
+uint64_t history_start(history_t *history);
+
+// Put the machine back in its state at the given clock. Return 0 on
+// success or -1 if that is outside the history.
+int history_travel(history_t *history, x16_t *machine, uint64_t count);
+
+#endif  // HISTORY_H_
@@ -1,29 +1,242 @@
 #include "io.h"
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
 #include <termios.h>
 #include <unistd.h>
 
-/* Input Buffering */
-struct termios original_tio;
+// Initial size of the output buffer in buffer mode
+#define IO_OUTBUF_SIZE 4096
 
-void disable_input_buffering() {
-  tcgetattr(STDIN_FILENO, &original_tio);
-  struct termios new_tio = original_tio;
-  new_tio.c_lflag &= ~ICANON & ~ECHO;
-  tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+// Initialize the console to use the terminal
+void io_init(io_t* io) {
+  memset(io, 0, sizeof(io_t));
+  io->in_fp = stdin;
+  io->out_fp = stdout;
+}
+
+// Free the input and output buffers
+void io_free(io_t* io) {
+  free(io->in_store);
+  io->in_store = NULL;
+  io->in_cap = 0;
+  free(io->out_buf);
+  io->out_buf = NULL;
+  io->out_len = 0;
+  io->out_cap = 0;
+}
+
+// Switch to headless mode
+void io_set_headless(io_t* io) { io->headless = true; }
+
+// Read input from a file
+void io_set_input_file(io_t* io, FILE* fp) {
+  io->in_fp = fp;
+  io->in_buf = NULL;
+  io->in_len = 0;
+  io->in_pos = 0;
+  io->in_open = false;
+  io->eof = false;
+  io->eof_polls = 0;
+}
+
+// Read input from a memory buffer
+void io_set_input_buffer(io_t* io, const uint8_t* buf, size_t len) {
+  io->in_fp = NULL;
+  io->in_buf = buf;
+  io->in_len = len;
+  io->in_pos = 0;
+  io->in_open = false;
+  io->eof = false;
+  io->eof_polls = 0;
+}
+
+// Start an empty input that is fed piece by piece
+void io_open_input(io_t* io) {
+  io_set_input_buffer(io, io->in_store, 0);
+  io->in_open = true;
+}
+
+// Append to the fed input
+void io_feed_input(io_t* io, const uint8_t* data, size_t len) {
+  // Drop what was already read before growing the buffer
+  if (io->in_pos > 0) {
+    memmove(io->in_store, io->in_store + io->in_pos, io->in_len - io->in_pos);
+    io->in_len -= io->in_pos;
+    io->in_pos = 0;
+  }
+  if (io->in_len + len > io->in_cap) {
+    io->in_cap = io->in_len + len > 2 * io->in_cap ? io->in_len + len
+                                                   : 2 * io->in_cap;
+    io->in_store = (uint8_t*)realloc(io->in_store, io->in_cap);
+  }
+  memcpy(io->in_store + io->in_len, data, len);
+  io->in_len += len;
+  io->in_buf = io->in_store;
+}
+
+// No more input will be fed
+void io_close_input(io_t* io) { io->in_open = false; }
+
+// Would reading have to wait for more input
+bool io_would_block(io_t* io) {
+  return io->in_open && io->in_pos == io->in_len;
+}
+
+// Write output to a file
+void io_set_output_file(io_t* io, FILE* fp) { io->out_fp = fp; }
+
+// Collect output in memory
+void io_set_output_buffer(io_t* io) {
+  io->out_fp = NULL;
+  io->out_len = 0;
+}
+
+// Get the collected output
+const char* io_output(io_t* io, size_t* len) {
+  *len = io->out_len;
+  return io->out_buf;
+}
+
+// Read one character
+int io_getc(io_t* io) {
+  int c;
+  if (io_would_block(io)) {
+    return IO_WAIT;
+  }
+  if (io->in_fp == NULL) {
+    c = io->in_pos < io->in_len ? io->in_buf[io->in_pos++] : IO_EOF;
+  } else {
+    c = getc(io->in_fp);
+    if (c == EOF) {
+      c = IO_EOF;
+    }
+  }
+  if (c == IO_EOF) {
+    io->eof = true;
+  }
+  return c;
+}
+
+// Check the terminal for a pending key without blocking
+static bool terminal_key_ready(FILE* fp) {
+  int fd = fileno(fp);
+  fd_set readfds;
+  FD_ZERO(&readfds);
+  FD_SET(fd, &readfds);
+
+  struct timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 0;
+  return select(fd + 1, &readfds, NULL, NULL, &timeout) != 0;
+}
+
+// Return true if a character can be read without blocking
+bool io_key_ready(io_t* io) {
+  if (io->in_fp == NULL) {
+    return io->in_pos < io->in_len;
+  }
+  if (!io->headless) {
+    return terminal_key_ready(io->in_fp);
+  }
+  // A headless stream always has its next character available, unless
+  // it is at the end. Peek at it so the answer does not depend on timing.
+  int c = getc(io->in_fp);
+  if (c == EOF) {
+    return false;
+  }
+  ungetc(c, io->in_fp);
+  return true;
+}
+
+// Has all of the input been read, for good
+bool io_input_ended(io_t* io) {
+  // A terminal may still get a key, and so may an input that is open
+  if ((!io->headless && io->in_fp != NULL) || io->in_open) {
+    return false;
+  }
+  return io->in_fp != NULL ? feof(io->in_fp) : io->in_pos == io->in_len;
+}
+
+// Count a poll of an empty keyboard
+bool io_idle_poll(io_t* io, bool ended) {
+  io->idle_polls++;
+  if (!ended) {
+    io->eof_polls = 0;
+    return false;
+  }
+  if (++io->eof_polls < IO_EOF_POLLS) {
+    return false;
+  }
+  io->eof = true;
+  return true;
+}
+
+// Write one character
+void io_putc(io_t* io, char c) {
+  if (io->out_fp != NULL) {
+    putc(c, io->out_fp);
+    return;
+  }
+  if (io->out_len == io->out_cap) {
+    io->out_cap = io->out_cap == 0 ? IO_OUTBUF_SIZE : io->out_cap * 2;
+    io->out_buf = (char*)realloc(io->out_buf, io->out_cap);
+  }
+  io->out_buf[io->out_len++] = c;
+}
+
+// Write a string
+void io_puts(io_t* io, const char* s) {
+  while (*s != '\0') {
+    io_putc(io, *s++);
+  }
 }
 
-void restore_input_buffering() {
-  tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
-  // set back to canonical
-  // tcsetattr(0, TCSANOW, &original_tio_out);
+// Flush output
+void io_flush(io_t* io) {
+  if (io->out_fp != NULL) {
+    fflush(io->out_fp);
+  }
 }
 
+/* Input Buffering */
+
+// The context whose terminal Control-C has to restore. The terminal is a
+// resource of the whole process, so only one context can own it at a time.
+static io_t* volatile terminal_owner = NULL;
+
 /* Handle Interrupt */
-void handle_interrupt(int signal) {
-  restore_input_buffering();
+static void handle_interrupt(int signal) {
+  if (terminal_owner != NULL) {
+    restore_input_buffering(terminal_owner);
+  }
   printf("Control-C, quitting\n");
   exit(-2);
 }
+
+void disable_input_buffering(io_t* io) {
+  int fd = fileno(io->in_fp);
+  if (tcgetattr(fd, &io->original_tio) != 0) {
+    return;  // not a terminal
+  }
+  struct termios new_tio = io->original_tio;
+  new_tio.c_lflag &= ~ICANON & ~ECHO;
+  tcsetattr(fd, TCSANOW, &new_tio);
+  io->raw = true;
+  terminal_owner = io;
+  signal(SIGINT, handle_interrupt);
+}
+
+void restore_input_buffering(io_t* io) {
+  if (!io->raw) {
+    return;
+  }
+  tcsetattr(fileno(io->in_fp), TCSANOW, &io->original_tio);
+  io->raw = false;
+  if (terminal_owner == io) {
+    terminal_owner = NULL;
+  }
+}
@@ -1,10 +1,149 @@
 #ifndef IO_H_
 #define IO_H_
 
-void disable_input_buffering(void);
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <termios.h>
 
-void restore_input_buffering(void);
+// Returned by io_getc when no more input will ever arrive
+#define IO_EOF (-1)
 
-void handle_interrupt(int signal);
+// Returned by io_getc when the input is open but all of it has been read.
+// The guest has to wait until more is fed.
+#define IO_WAIT (-2)
+
+// A headless guest that polls the keyboard this many times in a row after
+// its input ended is taken to be waiting for input that never comes
+#define IO_EOF_POLLS 1024
+
+// The I/O context of a machine: its console, its execution trace and the
+// terminal state it has to restore. Nothing here is shared between
+// machines, so machines on different threads do not interfere.
+//
+// By default the console is the controlling terminal (stdin/stdout). In
+// headless mode the input comes from a file or a memory buffer, the output
+// goes to a file or a growable memory buffer, and the terminal is never
+// touched.
+typedef struct {
+  // True when the console is not attached to a terminal
+  bool headless;
+
+  // Input source. If in_buf is set, input is read from the buffer,
+  // otherwise from in_fp.
+  FILE* in_fp;
+  const uint8_t* in_buf;
+  size_t in_len;
+  size_t in_pos;
+
+  // Buffer owned by the context for input that is fed piece by piece.
+  // While the input is open, more of it may still arrive.
+  uint8_t* in_store;
+  size_t in_cap;
+  bool in_open;
+
+  // Set once the guest tried to read past the end of the input
+  bool eof;
+
+  // Set while IN waits for its character after printing its prompt
+  bool prompted;
+
+  // Number of keyboard polls in a row that found no key
+  uint32_t idle_polls;
+
+  // Number of those polls made after the input ended for good
+  uint32_t eof_polls;
+
+  // Output sink. If out_fp is NULL, output is collected in out_buf.
+  FILE* out_fp;
+  char* out_buf;
+  size_t out_len;
+  size_t out_cap;
+
+  // Execution trace, one line per instruction, or NULL
+  FILE* log_fp;
+
+  // Terminal settings of the input before raw mode was entered
+  bool raw;
+  struct termios original_tio;
+} io_t;
+
+// Initialize the console to use the terminal on stdin/stdout
+void io_init(io_t* io);
+
+// Free any resources held by the console. Files are not closed.
+void io_free(io_t* io);
+
+// Switch the console to headless mode. The input is read as a plain
+// stream, the keyboard status only reflects buffered input, and no
+// prompts are printed.
+void io_set_headless(io_t* io);
+
+// Read guest input from the given file
+void io_set_input_file(io_t* io, FILE* fp);
+
+// Read guest input from a memory buffer. The buffer is not copied and
+// must stay alive while the console is in use.
+void io_set_input_buffer(io_t* io, const uint8_t* buf, size_t len);
+
+// Read guest input from a buffer owned by the context that starts out
+// empty and is filled with io_feed_input. Until io_close_input is called,
+// running out of input means waiting for more rather than the end.
+void io_open_input(io_t* io);
+
+// Append input to an input opened with io_open_input
+void io_feed_input(io_t* io, const uint8_t* data, size_t len);
+
+// Mark the end of an input opened with io_open_input
+void io_close_input(io_t* io);
+
+// True if the input is open and all of it has been read, so reading now
+// would have to wait for more to be fed
+bool io_would_block(io_t* io);
+
+// Write guest output to the given file
+void io_set_output_file(io_t* io, FILE* fp);
+
+// Collect guest output in a memory buffer
+void io_set_output_buffer(io_t* io);
+
+// Get the output collected so far in buffer mode. The length is stored
+// in len. The buffer is not NUL terminated.
+const char* io_output(io_t* io, size_t* len);
+
+// Read one character. Return IO_EOF when the input is exhausted, or
+// IO_WAIT when it is open and more has to be fed first.
+int io_getc(io_t* io);
+
+// Return true if a character can be read without blocking
+bool io_key_ready(io_t* io);
+
+// True if the input is headless and all of it has been read, with no
+// more to come
+bool io_input_ended(io_t* io);
+
+// Count a keyboard poll that found no key, ended telling whether the
+// input is used up for good. Return true if the guest should stop: it
+// polled IO_EOF_POLLS times in a row after the input ended. eof is set
+// then.
+bool io_idle_poll(io_t* io, bool ended);
+
+// Write one character
+void io_putc(io_t* io, char c);
+
+// Write a NUL terminated string
+void io_puts(io_t* io, const char* s);
+
+// Flush the output to its file, if any
+void io_flush(io_t* io);
+
+// Put the terminal the input comes from in raw mode, so keystrokes are
+// seen without waiting for a newline and are not echoed. Control-C
+// restores the terminal and exits.
+void disable_input_buffering(io_t* io);
+
+// Put the terminal back the way disable_input_buffering found it
+void restore_input_buffering(io_t* io);
 
 #endif  // IO_H_
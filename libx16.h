@@ -0,0 +1,54 @@
+#ifndef LIBX16_H_
+#define LIBX16_H_
+
+// The embeddable X16 emulator. Link with libx16.a or libx16.so.
+//
+// Every machine carries all of its own state, so any number of machines
+// can live in one process. A typical host:
+//
+//   x16_t *machine = x16_create();
+//   read_image_bytes(machine, image, image_len);
+//   io_t *io = x16_io(machine);
+//   io_set_headless(io);
+//   io_set_input_buffer(io, input, input_len);
+//   io_set_output_buffer(io);
+//   x16_snapshot_t *start = x16_snapshot(machine);
+//   x16_exit_t reason = x16_run(machine, 1000000);
+//   const char *out = io_output(io, &out_len);
+//   x16_restore(machine, start);  // ready for the next input
+//
+// Hosts with many interactive guests can hand them to a scheduler
+// (scheduler.h) that runs them on a fixed pool of threads instead.
+//
+// fast_run (fast.h) is a faster drop-in for x16_run, checked against it by
+// the differential runner in diff.h.
+//
+// With x16_set_history a machine can go back in time, see history.h.
+//
+// cfg.h recovers the control flow graph of an image without running it,
+// object.h reads the labels and source lines of version 2 images and
+// link.h links relocatable modules into an image.
+//
+// See x16.h, control.h, loader.h, io.h, scheduler.h, fast.h and diff.h for
+// the details.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cfg.h"
+#include "control.h"
+#include "diff.h"
+#include "fast.h"
+#include "io.h"
+#include "link.h"
+#include "loader.h"
+#include "object.h"
+#include "scheduler.h"
+#include "x16.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LIBX16_H_
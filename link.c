@@ -0,0 +1,234 @@
+#include "link.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bits.h"
+#include "object.h"
+#include "x16.h"
+
+// A module and where it was put
+typedef struct {
+  char *name;
+  object_module_t *module;
+  uint16_t address;
+} linked_t;
+
+// An exported label
+typedef struct {
+  const char *name;
+  uint16_t address;
+  const linked_t *from;
+} export_t;
+
+struct linker {
+  uint16_t base;
+  linked_t *modules;
+  size_t count;
+  size_t cap;
+  uint16_t *words;  // the image, after linking
+  size_t size;
+};
+
+linker_t *linker_create(uint16_t base) {
+  linker_t *linker = (linker_t *)calloc(1, sizeof(linker_t));
+  linker->base = base;
+  return linker;
+}
+
+void linker_free(linker_t *linker) {
+  for (size_t i = 0; i < linker->count; i++) {
+    free(linker->modules[i].name);
+    object_module_free(linker->modules[i].module);
+  }
+  free(linker->modules);
+  free(linker->words);
+  free(linker);
+}
+
+int linker_add(linker_t *linker, const char *name, const uint8_t *data,
+               size_t len) {
+  object_module_t *module = object_module(data, len);
+  if (module == NULL) {
+    return -1;
+  }
+  if (linker->count == linker->cap) {
+    linker->cap = linker->cap ? linker->cap * 2 : 8;
+    linker->modules = (linked_t *)realloc(linker->modules,
+                                          linker->cap * sizeof(linked_t));
+  }
+  linked_t *linked = &linker->modules[linker->count++];
+  linked->name = strdup(name);
+  linked->module = module;
+  linked->address = 0;
+  return 0;
+}
+
+// Where an address of a module ends up
+static uint16_t moved(const linked_t *linked, uint16_t address) {
+  return linked->address + (uint16_t)(address - linked->module->origin);
+}
+
+static int compare_exports(const void *a, const void *b) {
+  return strcasecmp(((const export_t *)a)->name, ((const export_t *)b)->name);
+}
+
+// Collect the exports of all modules sorted by name, reporting any
+// exported twice
+static export_t *collect_exports(linker_t *linker, size_t *n, FILE *errors,
+                                 int *problems) {
+  size_t total = 0;
+  for (size_t i = 0; i < linker->count; i++) {
+    total += linker->modules[i].module->nexports;
+  }
+  export_t *exports =
+      (export_t *)malloc((total > 0 ? total : 1) * sizeof(export_t));
+  *n = 0;
+  for (size_t i = 0; i < linker->count; i++) {
+    const linked_t *linked = &linker->modules[i];
+    for (size_t j = 0; j < linked->module->nexports; j++) {
+      exports[*n].name = linked->module->exports[j].name;
+      exports[*n].address = moved(linked, linked->module->exports[j].address);
+      exports[*n].from = linked;
+      (*n)++;
+    }
+  }
+  qsort(exports, *n, sizeof(export_t), compare_exports);
+  for (size_t i = 1; i < *n; i++) {
+    if (compare_exports(&exports[i - 1], &exports[i]) == 0) {
+      fprintf(errors, "duplicate symbol %s in %s and %s\n", exports[i].name,
+              exports[i - 1].from->name, exports[i].from->name);
+      (*problems)++;
+    }
+  }
+  return exports;
+}
+
+// Patch the PC relative offset of one instruction, or an address word
+static int relocate(linker_t *linker, const linked_t *linked,
+                    const object_reloc_t *reloc, const export_t *exports,
+                    size_t nexports, FILE *errors) {
+  const object_module_t *module = linked->module;
+  uint16_t address = moved(linked, reloc->address);
+  bool local = reloc->name[0] == '\0';
+  if (reloc->address < module->origin ||
+      reloc->address - module->origin >= module->count ||
+      (reloc->bits != 9 && reloc->bits != 11 && reloc->bits != 16) ||
+      (local && reloc->bits != 16)) {
+    fprintf(errors, "%s: bad relocation at 0x%04x\n", linked->name, address);
+    return 1;
+  }
+  uint16_t *word = &linker->words[address - linker->base];
+  if (local) {
+    // An address within the module moves with it
+    *word = moved(linked, *word);
+    return 0;
+  }
+  export_t key = {reloc->name, 0, NULL};
+  const export_t *target = (const export_t *)bsearch(
+      &key, exports, nexports, sizeof(export_t), compare_exports);
+  if (target == NULL) {
+    fprintf(errors, "%s: undefined symbol %s at 0x%04x\n", linked->name,
+            reloc->name, address);
+    return 1;
+  }
+  if (reloc->bits == 16) {
+    *word += target->address;
+    return 0;
+  }
+
+  uint16_t mask = (1 << reloc->bits) - 1;
+  // Whatever offset the assembler left is added, like an addend
+  int offset = (int16_t)sign_extend(*word & mask, reloc->bits) +
+               target->address - (address + 1);
+  int limit = 1 << (reloc->bits - 1);
+  if (offset < -limit || offset >= limit) {
+    fprintf(errors,
+            "%s: %s at 0x%04x is %d words away, out of range of a %d bit "
+            "offset\n",
+            linked->name, reloc->name, address, offset, reloc->bits);
+    return 1;
+  }
+  *word = (*word & ~mask) | (offset & mask);
+  return 0;
+}
+
+int linker_link(linker_t *linker, FILE *errors) {
+  int problems = 0;
+  size_t size = 0;
+  for (size_t i = 0; i < linker->count; i++) {
+    linker->modules[i].address = linker->base + size;
+    size += linker->modules[i].module->count;
+  }
+  if (size > (size_t)MAX_MEMORY - linker->base) {
+    fprintf(errors, "modules take %zu words, more than fit from 0x%04x\n",
+            size, linker->base);
+    return 1;
+  }
+
+  free(linker->words);
+  linker->words =
+      (uint16_t *)malloc((size > 0 ? size : 1) * sizeof(uint16_t));
+  linker->size = size;
+  for (size_t i = 0; i < linker->count; i++) {
+    const linked_t *linked = &linker->modules[i];
+    memcpy(&linker->words[linked->address - linker->base],
+           linked->module->words, linked->module->count * sizeof(uint16_t));
+  }
+
+  size_t nexports;
+  export_t *exports = collect_exports(linker, &nexports, errors, &problems);
+  for (size_t i = 0; i < linker->count; i++) {
+    const linked_t *linked = &linker->modules[i];
+    for (size_t j = 0; j < linked->module->nrelocs; j++) {
+      problems += relocate(linker, linked, &linked->module->relocs[j],
+                           exports, nexports, errors);
+    }
+  }
+  free(exports);
+  return problems;
+}
+
+int linker_write(linker_t *linker, FILE *fp, bool debug) {
+  if (!debug) {
+    uint8_t pair[2] = {linker->base >> 8, linker->base & 0xff};
+    if (fwrite(pair, 1, 2, fp) != 2) {
+      return -1;
+    }
+    for (size_t i = 0; i < linker->size; i++) {
+      pair[0] = linker->words[i] >> 8;
+      pair[1] = linker->words[i] & 0xff;
+      if (fwrite(pair, 1, 2, fp) != 2) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < linker->count; i++) {
+    total += linker->modules[i].module->nsymbols;
+  }
+  object_symbol_t *symbols = (object_symbol_t *)malloc(
+      (total > 0 ? total : 1) * sizeof(object_symbol_t));
+  size_t n = 0;
+  for (size_t i = 0; i < linker->count; i++) {
+    const linked_t *linked = &linker->modules[i];
+    for (size_t j = 0; j < linked->module->nsymbols; j++) {
+      symbols[n].name = linked->module->symbols[j].name;
+      symbols[n].address = moved(linked, linked->module->symbols[j].address);
+      n++;
+    }
+  }
+  object_contents_t contents = {
+      .origin = linker->base,
+      .words = linker->words,
+      .count = linker->size,
+      .symbols = symbols,
+      .nsymbols = n,
+  };
+  int rv = object_write(fp, &contents);
+  free(symbols);
+  return rv;
+}
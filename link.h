@@ -0,0 +1,40 @@
+#ifndef LINK_H_
+#define LINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The linker puts relocatable modules (version 3 object files, see
+// object.h) one after the other from a base address, in the order they
+// were added. Each module moves as a whole, so offsets within it stay
+// right, but words holding addresses within a module get how far it moved
+// added. References to labels that other modules export are then
+// patched: the PC relative offset of the instruction becomes the distance
+// to the label, which has to fit in its 9 or 11 bits, and a whole word
+// gets the address of the label added.
+
+typedef struct linker linker_t;
+
+// Create a linker that lays out modules from base
+linker_t *linker_create(uint16_t base);
+
+// Free a linker
+void linker_free(linker_t *linker);
+
+// Add a module held in memory, name is used in messages. Return 0 on
+// success or -1 if it is not a module.
+int linker_add(linker_t *linker, const char *name, const uint8_t *data,
+               size_t len);
+
+// Lay out the modules and patch the references. Each problem is reported
+// to errors, one per line. Return the number of problems.
+int linker_link(linker_t *linker, FILE *errors);
+
+// Write the linked image as a version 1 object file, or with debug as
+// version 2 with the labels of all modules. Return 0 on success or -1 for
+// failure.
+int linker_write(linker_t *linker, FILE *fp, bool debug);
+
+#endif  // LINK_H_
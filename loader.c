@@ -0,0 +1,250 @@
+#include "loader.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "object.h"
+
+// A file whose image is cached, with what it looked like when read
+typedef struct cached_file {
+  char* path;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+  const image_t* image;
+  struct cached_file* next;
+} cached_file_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static image_t* cached_images = NULL;
+static cached_file_t* cached_files = NULL;
+
+// Read Image File. Return 0 on success or -1 for failure
+int read_image_file(x16_t* machine, FILE* fp) {
+  // Read it all, as a version 2 file has its segments after the header
+  uint8_t* data = (uint8_t*)malloc(OBJECT_MAX_SIZE);
+  size_t len = fread(data, 1, OBJECT_MAX_SIZE, fp);
+  int rv = read_image_bytes(machine, data, len);
+  free(data);
+  return rv;
+}
+
+// Read Image into memory. Return 0 on success or -1 for failure.
+int read_image(x16_t* machine, const char* image_path) {
+  const image_t* image = image_cache_file(image_path);
+  if (image == NULL) {
+    return -1;
+  }
+  image_place(machine, image);
+  return 0;
+}
+
+// 64 bit FNV-1a over the bytes of the object file
+uint64_t image_hash(const uint8_t* data, size_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ data[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Copy words in network byte order to host byte order
+static void copy_words(uint16_t* dst, const uint8_t* src, size_t count) {
+  memcpy(dst, src, count * sizeof(uint16_t));
+  while (count-- > 0) {
+    *dst = ntohs(*dst);
+    ++dst;
+  }
+}
+
+// Read Image from memory. Return 0 on success or -1 for failure.
+int read_image_bytes(x16_t* machine, const uint8_t* data, size_t len) {
+  object_segment_t segments[OBJECT_MAX_SEGMENTS];
+  int n = object_segments(data, len, segments, OBJECT_MAX_SEGMENTS);
+  if (n < 0) {
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    copy_words(x16_memory(machine, segments[i].origin), segments[i].words,
+               segments[i].count);
+  }
+  return 0;
+}
+
+// Lay out the segments of an object file as one run of words, from the
+// lowest origin to the end of the highest segment, zero in between.
+// Return the words, or NULL if it is not a valid object file.
+static uint16_t* image_words(const uint8_t* data, size_t len,
+                             uint16_t* origin, size_t* count) {
+  object_segment_t segments[OBJECT_MAX_SEGMENTS];
+  int n = object_segments(data, len, segments, OBJECT_MAX_SEGMENTS);
+  if (n < 0) {
+    return NULL;
+  }
+  size_t first = MAX_MEMORY, end = 0;
+  for (int i = 0; i < n; i++) {
+    if (segments[i].origin < first) {
+      first = segments[i].origin;
+    }
+    if (segments[i].origin + segments[i].count > end) {
+      end = segments[i].origin + segments[i].count;
+    }
+  }
+  if (end <= first) {
+    first = end = n > 0 ? segments[0].origin : 0;
+  }
+  *origin = first;
+  *count = end - first;
+  uint16_t* words =
+      (uint16_t*)calloc(*count > 0 ? *count : 1, sizeof(uint16_t));
+  for (int i = 0; i < n; i++) {
+    copy_words(words + (segments[i].origin - first), segments[i].words,
+               segments[i].count);
+  }
+  return words;
+}
+
+// Find the image of an object file. Called with cache_lock held.
+static image_t* find_locked(uint64_t hash, const uint8_t* data, size_t len) {
+  // Check the bytes too, in case two files share a hash
+  for (image_t* image = cached_images; image != NULL; image = image->next) {
+    if (image->hash == hash && image->len == len &&
+        memcmp(image->bytes, data, len) == 0) {
+      return image;
+    }
+  }
+  return NULL;
+}
+
+// Find or add the image of an object file held in memory. Only a file
+// that is not cached yet is decoded, and without holding the lock.
+const image_t* image_cache_bytes(const uint8_t* data, size_t len) {
+  uint64_t hash = image_hash(data, len);
+  pthread_mutex_lock(&cache_lock);
+  image_t* image = find_locked(hash, data, len);
+  pthread_mutex_unlock(&cache_lock);
+  if (image != NULL) {
+    return image;
+  }
+
+  uint16_t origin;
+  size_t count;
+  uint16_t* words = image_words(data, len, &origin, &count);
+  if (words == NULL) {
+    return NULL;
+  }
+  image = (image_t*)malloc(sizeof(image_t));
+  image->hash = hash;
+  image->origin = origin;
+  image->count = count;
+  image->words = words;
+  image->bytes = (uint8_t*)malloc(len > 0 ? len : 1);
+  memcpy(image->bytes, data, len);
+  image->len = len;
+
+  // Another thread may have added it meanwhile
+  pthread_mutex_lock(&cache_lock);
+  image_t* found = find_locked(hash, data, len);
+  if (found == NULL) {
+    image->next = cached_images;
+    cached_images = image;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  if (found != NULL) {
+    free(image->words);
+    free(image->bytes);
+    free(image);
+    return found;
+  }
+  return image;
+}
+
+// Has the file changed since it was cached
+static bool file_changed(const cached_file_t* file, const struct stat* st) {
+  return file->dev != st->st_dev || file->ino != st->st_ino ||
+         file->size != st->st_size ||
+         file->mtime.tv_sec != st->st_mtim.tv_sec ||
+         file->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+// Read a whole object file. Return its length, or 0 on failure.
+static size_t read_file(const char* image_path, uint8_t* data) {
+  FILE* fp = fopen(image_path, "rb");
+  if (fp == NULL) {
+    return 0;
+  }
+  size_t len = fread(data, 1, OBJECT_MAX_SIZE, fp);
+  fclose(fp);
+  return len;
+}
+
+// Find or add the image of an object file, reading it only if it changed
+const image_t* image_cache_file(const char* image_path) {
+  struct stat st;
+  if (stat(image_path, &st) != 0) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  cached_file_t* file = cached_files;
+  while (file != NULL && strcmp(file->path, image_path) != 0) {
+    file = file->next;
+  }
+  if (file != NULL && !file_changed(file, &st)) {
+    pthread_mutex_unlock(&cache_lock);
+    return file->image;
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  // Read without holding the lock; another thread may cache it meanwhile,
+  // in which case the content hash finds its copy
+  uint8_t* data = (uint8_t*)malloc(OBJECT_MAX_SIZE);
+  size_t len = read_file(image_path, data);
+  const image_t* image = image_cache_bytes(data, len);
+
+  pthread_mutex_lock(&cache_lock);
+  if (image != NULL) {
+    for (file = cached_files; file != NULL; file = file->next) {
+      if (strcmp(file->path, image_path) == 0) {
+        break;
+      }
+    }
+    if (file == NULL) {
+      file = (cached_file_t*)calloc(1, sizeof(cached_file_t));
+      file->path = strdup(image_path);
+      file->next = cached_files;
+      cached_files = file;
+    }
+    file->dev = st.st_dev;
+    file->ino = st.st_ino;
+    file->size = st.st_size;
+    file->mtime = st.st_mtim;
+    file->image = image;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  free(data);
+  return image;
+}
+
+// Find a cached image by hash
+const image_t* image_cache_find(uint64_t hash) {
+  pthread_mutex_lock(&cache_lock);
+  image_t* image = cached_images;
+  while (image != NULL && image->hash != hash) {
+    image = image->next;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return image;
+}
+
+// Copy a cached image into memory
+void image_place(x16_t* machine, const image_t* image) {
+  memcpy(x16_memory(machine, image->origin), image->words,
+         image->count * sizeof(uint16_t));
+}
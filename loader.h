@@ -0,0 +1,58 @@
+#ifndef LOADER_H_
+#define LOADER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "x16.h"
+
+// Object files of both versions are read, see object.h. Loading places
+// the segments and never decodes the debug information.
+
+// Read an image from an open file into memory. Return 0 on success or -1
+// for failure
+int read_image_file(x16_t *machine, FILE *fp);
+
+// Read an image file into memory, through the image cache. Return 0 on
+// success or -1 for failure
+int read_image(x16_t *machine, const char *image_path);
+
+// Read an image from the contents of an object file held in memory.
+// Return 0 on success or -1 for failure
+int read_image_bytes(x16_t *machine, const uint8_t *data, size_t len);
+
+// Content hash of an object file, used to tell images apart
+uint64_t image_hash(const uint8_t *data, size_t len);
+
+// The image cache keeps every object file loaded through it decoded, in
+// host byte order, keyed by content hash. A file with several segments is
+// kept as one run of words from the lowest origin, zero between them.
+// Finding a file already cached only hashes and compares its bytes, and
+// placing a cached image is a single copy into memory. Cached images are
+// shared between threads and live until the process exits.
+typedef struct image {
+  uint64_t hash;     // image_hash of the object file
+  uint16_t origin;   // address of the first word
+  size_t count;      // number of words
+  uint16_t *words;   // host byte order
+  uint8_t *bytes;    // the object file, to tell files with one hash apart
+  size_t len;
+  struct image *next;
+} image_t;
+
+// Find or add the image of an object file held in memory. Return NULL if
+// it is not a valid object file
+const image_t *image_cache_bytes(const uint8_t *data, size_t len);
+
+// Find or add the image of an object file. A file that has not changed
+// since it was cached is not read again. Return NULL on failure
+const image_t *image_cache_file(const char *image_path);
+
+// Find a cached image by hash, or return NULL
+const image_t *image_cache_find(uint64_t hash);
+
+// Copy a cached image into memory
+void image_place(x16_t *machine, const image_t *image);
+
+#endif  // LOADER_H_
@@ -1,72 +1,105 @@
-#include <arpa/inet.h>
-#include <signal.h>
+#include <errno.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <termios.h>
 #include <unistd.h>
 
 #include "control.h"
+#include "gdbstub.h"
 #include "instruction.h"
 #include "io.h"
+#include "loader.h"
 #include "x16.h"
 
-// Read Image File. Return 0 on success or -1 for failure
-static int read_image_file(x16_t* machine, FILE* fp) {
-  // The origin tells us where in memory to place the image
-  uint16_t origin;
-  if (fread(&origin, sizeof(origin), 1, fp) <= 0) {
-    return -1;
-  }
-  // Swap to host format
-  origin = ntohs(origin);
-
-  // we know the maximum file size so we only need one fread
-  uint16_t max_read = UINT16_MAX - origin;
-  uint16_t* p = x16_memory(machine, origin);
-  size_t read = fread(p, sizeof(uint16_t), max_read, fp);
-  if (read <= 0) {
-    return -1;  // nothing read, or some error in fread
-  }
-
-  // swap each 16 bit value to host format
-  while (read-- > 0) {
-    *p = ntohs(*p);
-    ++p;
-  }
-
-  return 0;
+static void usage() {
+  printf(
+      "Usage: x16 [-l] [--headless [-i input-file] [-o output-file]] "
+      "[--record=log | --replay=log] [--ips=N] [--gdb=port|socket-path] "
+      "image-file1\n");
+  exit(1);
 }
 
-// Read Image into memory. Return 0 on success or -1 for failure.
-static int read_image(x16_t* machine, const char* image_path) {
-  FILE* fp = fopen(image_path, "rb");
+// Open a file for the headless console or exit with an error
+static FILE* open_or_die(const char* path, const char* mode) {
+  FILE* fp = fopen(path, mode);
   if (fp == NULL) {
-    return -1;
+    fprintf(stderr, "Cannot open %s\n", path);
+    exit(1);
   }
-  int rv = read_image_file(machine, fp);
-  fclose(fp);
-  return rv;
+  return fp;
 }
 
-static void usage() {
-  printf("Usage: x16 [-l] image-file1\n");
-  exit(1);
-}
+static struct option long_options[] = {
+    {"headless", no_argument, NULL, 'H'},
+    {"record", required_argument, NULL, 'R'},
+    {"replay", required_argument, NULL, 'P'},
+    {"ips", required_argument, NULL, 'S'},
+    {"gdb", required_argument, NULL, 'G'},
+    {NULL, 0, NULL, 0}};
 
 int main(int argc, char** argv) {
   int ch;
-  while ((ch = getopt(argc, argv, "l")) != -1) {
+  bool headless = false;
+  bool log = false;
+  char* input_path = NULL;
+  char* output_path = NULL;
+  char* record_path = NULL;
+  char* replay_path = NULL;
+  char* gdb_where = NULL;
+  long ips = 0;
+  while ((ch = getopt_long(argc, argv, "li:o:", long_options, NULL)) != -1) {
     switch (ch) {
       case 'l':
-        LOG = 1;
-        LOGFP = fopen("log.txt", "w");
+        log = true;
+        break;
+
+      case 'H':
+        headless = true;
+        break;
+
+      case 'i':
+        input_path = optarg;
+        break;
+
+      case 'o':
+        output_path = optarg;
+        break;
+
+      case 'R':
+        record_path = optarg;
+        break;
+
+      case 'P':
+        replay_path = optarg;
+        break;
+
+      case 'S': {
+        // A whole positive number, e.g. not 10k or -5
+        char* end;
+        errno = 0;
+        ips = strtol(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || errno != 0 || ips <= 0 ||
+            ips > UINT32_MAX) {
+          usage();
+        }
+        break;
+      }
+
+      case 'G':
+        gdb_where = optarg;
         break;
 
       default:
         usage();
     }
   }
+  if (!headless && (input_path != NULL || output_path != NULL)) {
+    usage();
+  }
+  if (record_path != NULL && replay_path != NULL) {
+    usage();
+  }
   argc -= optind;
   argv += optind;
 
@@ -79,6 +112,11 @@ int main(int argc, char** argv) {
 
   // Initialize machine
   x16_t* machine = x16_create();
+  FILE* logfp = NULL;
+  if (log) {
+    logfp = fopen("log.txt", "w");
+    x16_set_log(machine, logfp);
+  }
 
   // Read the image file into memory
   if (read_image(machine, filename) != 0) {
@@ -86,25 +124,88 @@ int main(int argc, char** argv) {
     exit(1);
   }
 
-  // Set up signal handler to clean up TTY state on SIGINT
-  signal(SIGINT, handle_interrupt);
+  // A replayed session takes its input from the log and never waits for
+  // the terminal
+  if (record_path != NULL && x16_record(machine, record_path) != 0) {
+    fprintf(stderr, "Cannot open %s\n", record_path);
+    exit(1);
+  }
+  if (replay_path != NULL) {
+    if (x16_replay(machine, replay_path) != 0) {
+      fprintf(stderr, "Cannot open %s\n", replay_path);
+      exit(1);
+    }
+    headless = true;
+  }
 
-  // Disable so we can read keystrokes without newline
-  disable_input_buffering();
+  // In headless mode the guest talks to plain files and the terminal is
+  // left alone
+  io_t* io = x16_io(machine);
+  FILE* input = NULL;
+  FILE* output = NULL;
+  if (headless) {
+    io_set_headless(io);
+    if (input_path != NULL) {
+      input = open_or_die(input_path, "rb");
+      io_set_input_file(io, input);
+    }
+    if (output_path != NULL) {
+      output = open_or_die(output_path, "wb");
+      io_set_output_file(io, output);
+    }
+  } else {
+    // Disable so we can read keystrokes without newline
+    disable_input_buffering(io);
+  }
 
-  // Execute the emulation till we see a halt or some error occurs
-  for (;;) {
-    if (execute_instruction(machine) != 0) {
-      break;
+  // Pace the guest if asked, otherwise it runs at full speed
+  x16_set_pace(machine, (uint32_t)ips);
+
+  // Under a debugger the guest runs as it says, and on by itself if it
+  // detaches
+  int debugged = 0;
+  if (gdb_where != NULL) {
+    debugged = gdb_serve(machine, gdb_where);
+    if (debugged < 0) {
+      restore_input_buffering(io);
+      fprintf(stderr, "Cannot serve GDB on %s\n", gdb_where);
+      exit(1);
     }
   }
 
+  // Execute the emulation till we see a halt or some error occurs
+  x16_exit_t reason = X16_HALT;
+  if (gdb_where == NULL || debugged == GDB_DETACHED) {
+    reason = x16_run(machine, 0);
+  }
+
   // Restore TTY state
-  restore_input_buffering();
+  restore_input_buffering(io);
+
+  // Running out of input is reported through the exit status
+  int status = reason == X16_EOF ? 3 : 0;
+  if (reason == X16_FAULT) {
+    uint16_t pc = x16_pc(machine);
+    fprintf(stderr, "Invalid instruction 0x%04x at 0x%04x\n",
+            *x16_memory(machine, pc), pc);
+    status = 5;
+  }
+  if (x16_replay_diverged(machine)) {
+    fprintf(stderr, "Replay diverged at instruction %llu\n",
+            (unsigned long long)x16_icount(machine));
+    status = 4;
+  }
 
   x16_free(machine);
+  if (input != NULL) {
+    fclose(input);
+  }
+  if (output != NULL) {
+    fclose(output);
+  }
 
-  if (LOGFP != NULL) {
-    fclose(LOGFP);
+  if (logfp != NULL) {
+    fclose(logfp);
   }
+  return status;
 }
@@ -0,0 +1,560 @@
+#include "object.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "x16.h"
+
+#define MAGIC "\177X16"
+#define VERSION_IMAGE 2
+#define VERSION_MODULE 3
+#define HEADER_SIZE 24
+#define MODULE_HEADER_SIZE 32
+
+// Bytes per entry of the symbol table and of the relocations
+#define SYMBOL_SIZE 6
+#define RELOC_SIZE 8
+
+// Most words a segment can hold, as its count is a u16
+#define SEGMENT_WORDS 0xffff
+
+// Debug information, decoded when first asked for
+struct object_debug {
+  const uint8_t *data;
+  size_t len;
+  bool decoded;
+  object_symbol_t *symbols;  // by address
+  size_t nsymbols;
+  uint16_t *line_addresses;  // where each entry of the line map starts
+  uint32_t *lines;
+  size_t nlines;
+  const char *source;
+};
+
+// Where things are in a version 2 or 3 file
+typedef struct {
+  int version;
+  int nsegments;
+  uint32_t symbols;
+  uint32_t lines;
+  uint32_t strings;
+  uint32_t strings_size;
+  uint32_t exports;  // modules only
+  uint32_t relocs;
+} header_t;
+
+static uint16_t get16(const uint8_t *p) { return p[0] << 8 | p[1]; }
+
+static uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Is there room for size bytes at offset
+static bool fits(size_t len, size_t offset, size_t size) {
+  return offset <= len && size <= len - offset;
+}
+
+// Is there a table of count entries of size bytes at offset, after its
+// u32 count
+static bool table_fits(const uint8_t *data, size_t len, uint32_t offset,
+                       size_t size) {
+  return offset == 0 || (fits(len, offset, 4) &&
+                         (len - offset - 4) / size >= get32(data + offset));
+}
+
+// Check a version 2 or 3 header and its segments, and find the segments
+// if out is not NULL. Return the number of segments, or -1 if it is not
+// valid.
+static int parse_header(const uint8_t *data, size_t len, header_t *header,
+                        object_segment_t *out, int max) {
+  if (len < HEADER_SIZE || memcmp(data, MAGIC, 4) != 0) {
+    return -1;
+  }
+  memset(header, 0, sizeof(*header));
+  header->version = get16(data + 4);
+  size_t offset = HEADER_SIZE;
+  if (header->version == VERSION_MODULE && len >= MODULE_HEADER_SIZE) {
+    header->exports = get32(data + 24);
+    header->relocs = get32(data + 28);
+    offset = MODULE_HEADER_SIZE;
+  } else if (header->version != VERSION_IMAGE) {
+    return -1;
+  }
+  header->nsegments = get16(data + 6);
+  header->symbols = get32(data + 8);
+  header->lines = get32(data + 12);
+  header->strings = get32(data + 16);
+  header->strings_size = get32(data + 20);
+  if (header->nsegments < 1 || header->nsegments > OBJECT_MAX_SEGMENTS ||
+      !fits(len, header->strings, header->strings_size) ||
+      !table_fits(data, len, header->symbols, SYMBOL_SIZE) ||
+      !table_fits(data, len, header->exports, SYMBOL_SIZE) ||
+      !table_fits(data, len, header->relocs, RELOC_SIZE) ||
+      (header->lines != 0 && !fits(len, header->lines, 8))) {
+    return -1;
+  }
+
+  for (int i = 0; i < header->nsegments; i++) {
+    if (!fits(len, offset, 4)) {
+      return -1;
+    }
+    uint16_t origin = get16(data + offset);
+    size_t count = get16(data + offset + 2);
+    offset += 4;
+    if (count > MAX_MEMORY - origin ||
+        !fits(len, offset, count * sizeof(uint16_t))) {
+      return -1;
+    }
+    if (out != NULL && i < max) {
+      out[i].origin = origin;
+      out[i].count = count;
+      out[i].words = data + offset;
+    }
+    offset += count * sizeof(uint16_t);
+  }
+  return header->nsegments;
+}
+
+// Find the segments of an object file
+int object_segments(const uint8_t *data, size_t len, object_segment_t *out,
+                    int max) {
+  header_t header;
+  int n = parse_header(data, len, &header, out, max);
+  if (n >= 0) {
+    if (header.version == VERSION_MODULE) {
+      return -1;  // to be linked first
+    }
+    return n < max ? n : max;
+  }
+
+  // Version 1: the origin, then at least one word
+  if (len < 2 * sizeof(uint16_t) || max < 1) {
+    return -1;
+  }
+  out[0].origin = get16(data);
+  out[0].count = (len - sizeof(uint16_t)) / sizeof(uint16_t);
+  out[0].words = data + sizeof(uint16_t);
+  uint16_t max_read = UINT16_MAX - out[0].origin;
+  if (out[0].count > max_read) {
+    out[0].count = max_read;
+  }
+  return 1;
+}
+
+// Get the version of an object file
+int object_version(const uint8_t *data, size_t len) {
+  header_t header;
+  if (parse_header(data, len, &header, NULL, 0) >= 0) {
+    return header.version;
+  }
+  return len >= 2 * sizeof(uint16_t) ? 1 : 0;
+}
+
+// A growing byte buffer for the writer
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} buf_t;
+
+static void put_bytes(buf_t *buf, const void *bytes, size_t n) {
+  if (buf->len + n > buf->cap) {
+    buf->cap = (buf->len + n) * 2;
+    buf->data = (uint8_t *)realloc(buf->data, buf->cap);
+  }
+  memcpy(buf->data + buf->len, bytes, n);
+  buf->len += n;
+}
+
+static void put16(buf_t *buf, uint16_t value) {
+  uint8_t bytes[2] = {value >> 8, value & 0xff};
+  put_bytes(buf, bytes, 2);
+}
+
+static void put32(buf_t *buf, uint32_t value) {
+  uint8_t bytes[4] = {value >> 24, (value >> 16) & 0xff, (value >> 8) & 0xff,
+                      value & 0xff};
+  put_bytes(buf, bytes, 4);
+}
+
+static void put_uleb(buf_t *buf, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    put_bytes(buf, &byte, 1);
+  } while (value != 0);
+}
+
+// Add a string to the pool, once, and return its offset
+static uint32_t pool_add(buf_t *pool, const char *str) {
+  size_t offset = 0;
+  while (offset < pool->len) {
+    const char *s = (const char *)pool->data + offset;
+    if (strcmp(s, str) == 0) {
+      return offset;
+    }
+    offset += strlen(s) + 1;
+  }
+  put_bytes(pool, str, strlen(str) + 1);
+  return offset;
+}
+
+// A table of symbols; return its offset in the file
+static uint32_t write_symbols(buf_t *out, size_t base, buf_t *pool,
+                              const object_symbol_t *symbols, size_t n) {
+  uint32_t at = base + out->len;
+  put32(out, n);
+  for (size_t i = 0; i < n; i++) {
+    put32(out, pool_add(pool, symbols[i].name));
+    put16(out, symbols[i].address);
+  }
+  return at;
+}
+
+// The line map: an entry wherever the line changes
+static void write_lines(buf_t *out, buf_t *pool, uint16_t origin,
+                        size_t count, const char *source,
+                        const uint32_t *lines) {
+  buf_t entries = {NULL, 0, 0};
+  uint32_t nentries = 0;
+  uint32_t address = 0;
+  int64_t line = 0;
+  for (size_t i = 0; i <= count; i++) {
+    // Past the last word the line is none, unless that is past memory
+    uint32_t here = origin + i;
+    uint32_t next_line = i < count ? lines[i] : 0;
+    if (here >= MAX_MEMORY || (i > 0 && next_line == line)) {
+      continue;
+    }
+    int64_t delta = (int64_t)next_line - line;
+    put_uleb(&entries, here - address);
+    put_uleb(&entries, (uint64_t)((delta << 1) ^ (delta >> 63)));
+    address = here;
+    line = next_line;
+    nentries++;
+  }
+  put32(out, pool_add(pool, source != NULL ? source : ""));
+  put32(out, nentries);
+  put_bytes(out, entries.data, entries.len);
+  free(entries.data);
+}
+
+// Write a version 2 object file or a version 3 module
+int object_write(FILE *fp, const object_contents_t *c) {
+  // A module has exactly one segment
+  if (c->count > (size_t)MAX_MEMORY - c->origin ||
+      (c->module && c->count > SEGMENT_WORDS)) {
+    return -1;
+  }
+  size_t header_size = c->module ? MODULE_HEADER_SIZE : HEADER_SIZE;
+  buf_t body = {NULL, 0, 0};
+  buf_t pool = {NULL, 0, 0};
+  // An image of all of memory does not fit one segment, so it is split
+  uint16_t nsegments = 0;
+  size_t done = 0;
+  do {
+    size_t n = c->count - done < SEGMENT_WORDS ? c->count - done
+                                               : SEGMENT_WORDS;
+    put16(&body, c->origin + done);
+    put16(&body, n);
+    for (size_t i = 0; i < n; i++) {
+      put16(&body, c->words[done + i]);
+    }
+    done += n;
+    nsegments++;
+  } while (done < c->count);
+
+  uint32_t symbols_at =
+      write_symbols(&body, header_size, &pool, c->symbols, c->nsymbols);
+  uint32_t lines_at = 0;
+  if (c->lines != NULL) {
+    lines_at = header_size + body.len;
+    write_lines(&body, &pool, c->origin, c->count, c->source, c->lines);
+  }
+  uint32_t exports_at = 0, relocs_at = 0;
+  if (c->module) {
+    exports_at =
+        write_symbols(&body, header_size, &pool, c->exports, c->nexports);
+    relocs_at = header_size + body.len;
+    put32(&body, c->nrelocs);
+    for (size_t i = 0; i < c->nrelocs; i++) {
+      put32(&body, pool_add(&pool, c->relocs[i].name));
+      put16(&body, c->relocs[i].address);
+      put16(&body, c->relocs[i].bits);
+    }
+  }
+
+  buf_t header = {NULL, 0, 0};
+  put_bytes(&header, MAGIC, 4);
+  put16(&header, c->module ? VERSION_MODULE : VERSION_IMAGE);
+  put16(&header, nsegments);
+  put32(&header, symbols_at);
+  put32(&header, lines_at);
+  put32(&header, header_size + body.len);
+  put32(&header, pool.len);
+  if (c->module) {
+    put32(&header, exports_at);
+    put32(&header, relocs_at);
+  }
+
+  int rv = 0;
+  if (fwrite(header.data, 1, header.len, fp) != header.len ||
+      fwrite(body.data, 1, body.len, fp) != body.len ||
+      (pool.len > 0 && fwrite(pool.data, 1, pool.len, fp) != pool.len)) {
+    rv = -1;
+  }
+  free(header.data);
+  free(body.data);
+  free(pool.data);
+  return rv;
+}
+
+// Get a string of a pool, or NULL if the offset is bad
+static const char *pool_string(const char *pool, size_t size,
+                               uint32_t offset) {
+  if (offset >= size) {
+    return NULL;
+  }
+  const char *str = pool + offset;
+  return memchr(str, '\0', size - offset) != NULL ? str : NULL;
+}
+
+// Read a table of symbols whose names are in pool, leaving out any with a
+// bad name. The table is known to fit.
+static object_symbol_t *read_symbols(const uint8_t *data, uint32_t offset,
+                                     const char *pool, size_t pool_size,
+                                     size_t *n) {
+  uint32_t count = get32(data + offset);
+  object_symbol_t *symbols = (object_symbol_t *)malloc(
+      (count > 0 ? count : 1) * sizeof(object_symbol_t));
+  *n = 0;
+  const uint8_t *entry = data + offset + 4;
+  for (uint32_t i = 0; i < count; i++, entry += SYMBOL_SIZE) {
+    const char *name = pool_string(pool, pool_size, get32(entry));
+    if (name != NULL) {
+      symbols[*n].name = name;
+      symbols[*n].address = get16(entry + 4);
+      (*n)++;
+    }
+  }
+  return symbols;
+}
+
+// Read a version 3 module
+object_module_t *object_module(const uint8_t *data, size_t len) {
+  header_t header;
+  object_segment_t segment;
+  if (parse_header(data, len, &header, &segment, 1) < 0 ||
+      header.version != VERSION_MODULE) {
+    return NULL;
+  }
+  object_module_t *module =
+      (object_module_t *)calloc(1, sizeof(object_module_t));
+  module->strings = (char *)malloc(header.strings_size + 1);
+  memcpy(module->strings, data + header.strings, header.strings_size);
+  const char *pool = module->strings;
+  size_t pool_size = header.strings_size;
+
+  module->origin = segment.origin;
+  module->count = segment.count;
+  module->words = (uint16_t *)malloc(
+      (segment.count > 0 ? segment.count : 1) * sizeof(uint16_t));
+  for (size_t i = 0; i < segment.count; i++) {
+    module->words[i] = get16(segment.words + 2 * i);
+  }
+  if (header.symbols != 0) {
+    module->symbols = read_symbols(data, header.symbols, pool, pool_size,
+                                   &module->nsymbols);
+  }
+  if (header.exports != 0) {
+    module->exports = read_symbols(data, header.exports, pool, pool_size,
+                                   &module->nexports);
+  }
+  if (header.relocs != 0) {
+    uint32_t count = get32(data + header.relocs);
+    module->relocs = (object_reloc_t *)malloc(
+        (count > 0 ? count : 1) * sizeof(object_reloc_t));
+    const uint8_t *entry = data + header.relocs + 4;
+    for (uint32_t i = 0; i < count; i++, entry += RELOC_SIZE) {
+      const char *name = pool_string(pool, pool_size, get32(entry));
+      if (name == NULL) {
+        object_module_free(module);
+        return NULL;
+      }
+      module->relocs[i].name = name;
+      module->relocs[i].address = get16(entry + 4);
+      module->relocs[i].bits = get16(entry + 6);
+    }
+    module->nrelocs = count;
+  }
+  return module;
+}
+
+void object_module_free(object_module_t *module) {
+  if (module == NULL) {
+    return;
+  }
+  free(module->words);
+  free(module->symbols);
+  free(module->exports);
+  free(module->relocs);
+  free(module->strings);
+  free(module);
+}
+
+// Get the debug information of an object file, without decoding it
+object_debug_t *object_debug(const uint8_t *data, size_t len) {
+  header_t header;
+  if (parse_header(data, len, &header, NULL, 0) < 0 ||
+      (header.symbols == 0 && header.lines == 0)) {
+    return NULL;
+  }
+  object_debug_t *debug = (object_debug_t *)calloc(1, sizeof(object_debug_t));
+  debug->data = data;
+  debug->len = len;
+  return debug;
+}
+
+void object_debug_free(object_debug_t *debug) {
+  if (debug == NULL) {
+    return;
+  }
+  free(debug->symbols);
+  free(debug->line_addresses);
+  free(debug->lines);
+  free(debug);
+}
+
+// Order symbols by address, then by where their names are in the pool
+static int compare_symbols(const void *a, const void *b) {
+  const object_symbol_t *x = (const object_symbol_t *)a;
+  const object_symbol_t *y = (const object_symbol_t *)b;
+  if (x->address != y->address) {
+    return x->address < y->address ? -1 : 1;
+  }
+  return x->name < y->name ? -1 : x->name > y->name;
+}
+
+// Read a LEB128 value. Return false if it runs off the end.
+static bool get_uleb(const object_debug_t *debug, size_t *offset,
+                     uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*offset >= debug->len) {
+      return false;
+    }
+    uint8_t byte = debug->data[(*offset)++];
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void decode_lines(object_debug_t *debug, const header_t *header) {
+  const char *pool = (const char *)debug->data + header->strings;
+  size_t offset = header->lines;
+  debug->source =
+      pool_string(pool, header->strings_size, get32(debug->data + offset));
+  uint32_t count = get32(debug->data + offset + 4);
+  offset += 8;
+  // Each entry takes at least two bytes
+  if ((debug->len - offset) / 2 < count) {
+    return;
+  }
+  debug->line_addresses =
+      (uint16_t *)malloc((count > 0 ? count : 1) * sizeof(uint16_t));
+  debug->lines = (uint32_t *)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+  uint64_t address = 0;
+  int64_t line = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint64_t address_delta, line_delta;
+    if (!get_uleb(debug, &offset, &address_delta) ||
+        !get_uleb(debug, &offset, &line_delta)) {
+      break;
+    }
+    address += address_delta;
+    line += (int64_t)(line_delta >> 1) ^ -(int64_t)(line_delta & 1);
+    if (address >= MAX_MEMORY) {
+      break;
+    }
+    debug->line_addresses[debug->nlines] = address;
+    debug->lines[debug->nlines] = line;
+    debug->nlines++;
+  }
+}
+
+// Decode the symbols and line map on first use
+static void decode(object_debug_t *debug) {
+  if (debug->decoded) {
+    return;
+  }
+  debug->decoded = true;
+  header_t header;
+  parse_header(debug->data, debug->len, &header, NULL, 0);
+  if (header.symbols != 0) {
+    debug->symbols =
+        read_symbols(debug->data, header.symbols,
+                     (const char *)debug->data + header.strings,
+                     header.strings_size, &debug->nsymbols);
+    qsort(debug->symbols, debug->nsymbols, sizeof(object_symbol_t),
+          compare_symbols);
+  }
+  if (header.lines != 0) {
+    decode_lines(debug, &header);
+  }
+}
+
+// Get the first symbol at address
+const char *object_symbol_at(object_debug_t *debug, uint16_t address) {
+  decode(debug);
+  size_t lo = 0, hi = debug->nsymbols;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (debug->symbols[mid].address < address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < debug->nsymbols && debug->symbols[lo].address == address
+             ? debug->symbols[lo].name
+             : NULL;
+}
+
+// Get the address of a symbol
+int object_symbol_address(object_debug_t *debug, const char *name) {
+  decode(debug);
+  for (size_t i = 0; i < debug->nsymbols; i++) {
+    if (strcmp(debug->symbols[i].name, name) == 0) {
+      return debug->symbols[i].address;
+    }
+  }
+  return -1;
+}
+
+// Get the source line of the word at address
+uint32_t object_line(object_debug_t *debug, uint16_t address) {
+  decode(debug);
+  // The last entry starting at or before address
+  size_t lo = 0, hi = debug->nlines;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (debug->line_addresses[mid] <= address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo > 0 ? debug->lines[lo - 1] : 0;
+}
+
+// Get the name of the source file
+const char *object_source(object_debug_t *debug) {
+  decode(debug);
+  return debug->source;
+}
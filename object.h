@@ -0,0 +1,145 @@
+#ifndef OBJECT_H_
+#define OBJECT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Object files come in two formats. All values are in network byte order.
+//
+// Version 1 is the origin, the address the image is placed at, followed
+// by the words of the image.
+//
+// Version 2 adds debug information. It starts with a header:
+//
+//   "\177X16"        magic
+//   u16 version      2
+//   u16 segments     number of code segments
+//   u32 symbols      offset of the symbol table, 0 if there is none
+//   u32 lines        offset of the line map, 0 if there is none
+//   u32 strings      offset of the string pool
+//   u32 strings_size
+//
+// followed by the segments, each its origin, its number of words and the
+// words. The symbol table is a u32 count and per symbol the offset of its
+// name in the string pool and its u16 address. The line map is the offset
+// of the source file name, a u32 count and per entry the address and
+// line deltas from the previous entry, starting at 0 and 0, as LEB128
+// with the line delta zigzag encoded. Each entry gives the line of the
+// words from its address up to the next entry; line 0 means none. The
+// string pool holds NUL terminated strings, each once.
+//
+// Version 3 is a relocatable module, written by xas -c for xld to link.
+// Its header has two more u32 fields, the offsets of the exports and of
+// the relocations. Exports are laid out like the symbol table. Each
+// relocation is the offset of the name of the symbol it refers to, the
+// u16 address of the word it patches, and a u16 count of the bits
+// patched: 9 or 11 for the PC relative offset of an instruction, or 16
+// for a whole word holding an address, to which the address of the symbol
+// is added. A 16 bit relocation with an empty name is an address within
+// the module, which moves with it. Modules are never loaded as images.
+//
+// A file is read as version 2 or 3 only if it has the magic and its header
+// makes sense, so any version 1 file still loads. Loading an image only
+// finds the segments; the debug information is decoded on first use.
+
+// Largest object file read
+#define OBJECT_MAX_SIZE (1 << 22)
+
+// Most segments in a version 2 file
+#define OBJECT_MAX_SEGMENTS 64
+
+// Words of an object file that are placed in memory
+typedef struct {
+  uint16_t origin;
+  size_t count;
+  const uint8_t *words;  // network byte order, in the file
+} object_segment_t;
+
+// A label and the address it stands for
+typedef struct {
+  const char *name;
+  uint16_t address;
+} object_symbol_t;
+
+// A reference to a symbol of another module, or with bits 16 and an empty
+// name to an address within the module, patched by the linker
+typedef struct {
+  const char *name;
+  uint16_t address;  // of the word patched
+  int bits;          // of its PC relative offset, 9 or 11, or 16 for all
+} object_reloc_t;
+
+// What goes in an object file
+typedef struct {
+  uint16_t origin;
+  const uint16_t *words;
+  size_t count;
+  const object_symbol_t *symbols;
+  size_t nsymbols;
+  const char *source;
+  const uint32_t *lines;  // per word, 0 for none; NULL for no line map
+  bool module;            // write a version 3 module with the following
+  const object_symbol_t *exports;
+  size_t nexports;
+  const object_reloc_t *relocs;
+  size_t nrelocs;
+} object_contents_t;
+
+// A module read back in full. Names point into strings.
+typedef struct {
+  uint16_t origin;
+  size_t count;
+  uint16_t *words;  // host byte order
+  object_symbol_t *symbols;
+  size_t nsymbols;
+  object_symbol_t *exports;
+  size_t nexports;
+  object_reloc_t *relocs;
+  size_t nrelocs;
+  char *strings;
+} object_module_t;
+
+// Debug information of a version 2 or 3 file
+typedef struct object_debug object_debug_t;
+
+// Find the segments of a version 1 or 2 object file. Return how many
+// there are, at most max, or -1 if it is not a valid object file.
+int object_segments(const uint8_t *data, size_t len, object_segment_t *out,
+                    int max);
+
+// Get the version of an object file: 1, 2, 3, or 0 if it is not valid
+int object_version(const uint8_t *data, size_t len);
+
+// Write a version 2 object file, or a version 3 module. An image too big
+// for one segment is split in two; a module that big fails. Return 0 on
+// success or -1 for failure.
+int object_write(FILE *fp, const object_contents_t *contents);
+
+// Read a version 3 module, or return NULL if it is not one
+object_module_t *object_module(const uint8_t *data, size_t len);
+
+// Free a module
+void object_module_free(object_module_t *module);
+
+// Get the debug information of an object file held in memory, or NULL if
+// it has none. Nothing is decoded yet and data must outlive the result.
+object_debug_t *object_debug(const uint8_t *data, size_t len);
+
+// Free debug information
+void object_debug_free(object_debug_t *debug);
+
+// Get the first symbol at address, or NULL
+const char *object_symbol_at(object_debug_t *debug, uint16_t address);
+
+// Get the address of a symbol, or -1 if there is no such symbol
+int object_symbol_address(object_debug_t *debug, const char *name);
+
+// Get the source line of the word at address, or 0 if it is not known
+uint32_t object_line(object_debug_t *debug, uint16_t address);
+
+// Get the name of the source file, or NULL
+const char *object_source(object_debug_t *debug);
+
+#endif  // OBJECT_H_
@@ -0,0 +1,202 @@
+#include "peephole.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bits.h"
+#include "instruction.h"
+
+// Loops nested deeper than this count as this deep
+#define MAX_DEPTH 6
+
+// Bits of the PC relative offset of an instruction, 0 if it has none
+static int offset_bits(uint16_t word) {
+  switch (word >> 12) {
+    case OP_BR:
+    case OP_LD:
+    case OP_LDI:
+    case OP_LEA:
+    case OP_ST:
+    case OP_STI:
+      return 9;
+    case OP_JSR:
+      return (word >> 11) & 1 ? 11 : 0;
+    default:
+      return 0;
+  }
+}
+
+// Does the instruction set R_COND, and not look at it first
+static bool sets_cond(uint16_t word) {
+  switch (word >> 12) {
+    case OP_ADD:
+    case OP_AND:
+    case OP_NOT:
+    case OP_LD:
+    case OP_LDI:
+    case OP_LDR:
+    case OP_LEA:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// add %rX, %rX, $0
+static bool is_add_zero(uint16_t word) {
+  return word >> 12 == OP_ADD && (word & 0x3f) == 0x20 &&
+         ((word >> 9) & 7) == ((word >> 6) & 7);
+}
+
+// BR with all flags or none, see control.c
+static bool is_jump(uint16_t word) {
+  int nzp = (word >> 9) & 7;
+  return word >> 12 == OP_BR && (nzp == 0 || nzp == 7);
+}
+
+// Can the word be rewritten
+static bool is_code(const peephole_word_t *word) {
+  return !word->data && !word->fixed;
+}
+
+size_t peephole_optimize(peephole_word_t *code, size_t count, size_t *map,
+                         peephole_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (size_t i = 0; i <= count; i++) {
+    map[i] = i;
+  }
+  // Targets as indexes, -1 for none
+  long *target = (long *)malloc((count + 1) * sizeof(long));
+  for (size_t i = 0; i < count; i++) {
+    int bits = offset_bits(code[i].word);
+    target[i] = -1;
+    if (is_code(&code[i]) && bits > 0) {
+      long t = (long)i + 1 +
+               (int16_t)sign_extend(code[i].word & ((1 << bits) - 1), bits);
+      if (t < 0 || t > (long)count) {
+        free(target);
+        return count;
+      }
+      target[i] = t;
+    }
+  }
+
+  // How many loops, backward branches, each word is in
+  uint64_t *weight = (uint64_t *)malloc((count + 1) * sizeof(uint64_t));
+  int *depth = (int *)calloc(count + 1, sizeof(int));
+  for (size_t j = 0; j < count; j++) {
+    if (code[j].word >> 12 == OP_BR && target[j] >= 0 &&
+        target[j] <= (long)j) {
+      for (size_t k = target[j]; k <= j; k++) {
+        depth[k]++;
+      }
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    weight[i] = 1;
+    for (int d = 0; d < depth[i] && d < MAX_DEPTH; d++) {
+      weight[i] *= 10;
+    }
+  }
+  free(depth);
+
+  size_t *original = (size_t *)malloc((count + 1) * sizeof(size_t));
+  size_t *moved = (size_t *)malloc((count + 1) * sizeof(size_t));
+  bool *reached = (bool *)malloc((count + 1) * sizeof(bool));
+  bool *removed = (bool *)malloc((count + 1) * sizeof(bool));
+  for (size_t i = 0; i < count; i++) {
+    original[i] = i;
+  }
+  size_t n = count;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    memset(removed, 0, n * sizeof(bool));
+    for (size_t i = 0; i < n; i++) {
+      reached[i] = code[i].label;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (target[i] >= 0 && target[i] < (long)n) {
+        reached[target[i]] = true;
+      }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      if (!is_code(&code[i])) {
+        continue;
+      }
+      uint16_t word = code[i].word;
+      bool next = i + 1 < n && !code[i + 1].data;
+      if (is_add_zero(word) && next && sets_cond(code[i + 1].word)) {
+        removed[i] = true;
+        stats->executed += weight[original[i]];
+      } else if (word >> 12 == OP_BR && target[i] == (long)i + 1) {
+        removed[i] = true;
+        stats->executed += weight[original[i]];
+      } else if (is_jump(word) && target[i] == (long)i + 2 && next &&
+                 is_code(&code[i + 1]) && !reached[i + 1]) {
+        // The instruction skipped is never run, only the branch counts
+        removed[i] = removed[i + 1] = true;
+        stats->executed += weight[original[i]];
+        i++;
+      } else if (word >> 12 == OP_LD && next && is_code(&code[i + 1]) &&
+                 code[i + 1].word >> 12 == OP_LD &&
+                 ((word >> 9) & 7) == ((code[i + 1].word >> 9) & 7) &&
+                 target[i] == target[i + 1] && target[i] < (long)n &&
+                 !reached[i + 1]) {
+        removed[i + 1] = true;
+        stats->executed += weight[original[i + 1]];
+        i++;
+      }
+    }
+
+    // A removed word moves to the next one that is kept
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+      moved[i] = kept;
+      if (!removed[i]) {
+        kept++;
+      } else {
+        changed = true;
+      }
+    }
+    moved[n] = kept;
+    if (!changed) {
+      break;
+    }
+    // The label of a removed word now points at the word that took its
+    // place, which can still be reached through it
+    bool label = false;
+    for (size_t i = 0; i < n; i++) {
+      if (removed[i]) {
+        label = label || code[i].label;
+      } else {
+        code[moved[i]] = code[i];
+        code[moved[i]].label = code[moved[i]].label || label;
+        label = false;
+        original[moved[i]] = original[i];
+        target[moved[i]] = target[i] >= 0 ? (long)moved[target[i]] : -1;
+      }
+    }
+    for (size_t i = 0; i <= count; i++) {
+      map[i] = moved[map[i]];
+    }
+    stats->words += n - kept;
+    n = kept;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (target[i] >= 0) {
+      uint16_t mask = (1 << offset_bits(code[i].word)) - 1;
+      code[i].word =
+          (code[i].word & ~mask) | ((target[i] - (long)i - 1) & mask);
+    }
+  }
+  free(target);
+  free(weight);
+  free(original);
+  free(moved);
+  free(reached);
+  free(removed);
+  return n;
+}
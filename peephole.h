@@ -0,0 +1,43 @@
+#ifndef PEEPHOLE_H_
+#define PEEPHOLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Peephole rewrites of assembled code, for xas -O. Each keeps the
+// registers, memory and R_COND as the program can see them:
+//
+//   - add %rX, %rX, $0 right before an instruction that sets R_COND again
+//   - a BR to the next instruction
+//   - an unconditional BR over one instruction nothing else reaches; both go
+//   - the second of two LDs of the same label into the same register
+//
+// Words are removed, never added, so every PC relative offset still fits
+// once it is recomputed. Words only reached by computed addresses, e.g.
+// a table read with LDR, must be data (val) or have a label.
+
+// A word of the code as the assembler knows it
+typedef struct {
+  uint16_t word;
+  bool data;   // from val, never rewritten or removed
+  bool label;  // a label points here
+  bool fixed;  // the offset is patched by the linker, keep it as is
+} peephole_word_t;
+
+// What a run saved
+typedef struct {
+  size_t words;
+  // Instructions no longer executed, counting each loop around a removed
+  // instruction as running 10 times
+  uint64_t executed;
+} peephole_stats_t;
+
+// Rewrite count words of code in place and return the new count. map gets
+// count + 1 entries: the new index of each word, or of the word that took
+// its place if it was removed, and the new count last. Code with a PC
+// relative offset that leaves it is not changed.
+size_t peephole_optimize(peephole_word_t *code, size_t count, size_t *map,
+                         peephole_stats_t *stats);
+
+#endif  // PEEPHOLE_H_
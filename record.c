@@ -0,0 +1,120 @@
+#include "record.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+// Read the next event of the log into rec
+static void read_event(record_t* rec) {
+  char kind;
+  uint64_t when;
+  int value;
+  rec->pending = fscanf(rec->fp, " %c %" SCNu64 " %d", &kind, &when,
+                        &value) == 3;
+  if (rec->pending) {
+    rec->kind = kind;
+    rec->when = when;
+    rec->value = value;
+  }
+}
+
+// Start recording
+int record_start(record_t* rec, const char* path) {
+  memset(rec, 0, sizeof(record_t));
+  rec->fp = fopen(path, "w");
+  if (rec->fp == NULL) {
+    return -1;
+  }
+  rec->mode = REC_RECORD;
+  return 0;
+}
+
+// Start replaying
+int replay_start(record_t* rec, const char* path) {
+  memset(rec, 0, sizeof(record_t));
+  rec->fp = fopen(path, "r");
+  if (rec->fp == NULL) {
+    return -1;
+  }
+  rec->mode = REC_REPLAY;
+  read_event(rec);
+  return 0;
+}
+
+// Stop and close the log
+void record_stop(record_t* rec) {
+  if (rec->fp != NULL) {
+    fclose(rec->fp);
+  }
+  rec->fp = NULL;
+  rec->mode = REC_OFF;
+}
+
+// Take the pending event if it is of the given kind and happens now.
+// An event that should already have happened means the guest went
+// another way than in the recorded session.
+static bool take_event(record_t* rec, char kind, uint64_t count,
+                       int* value) {
+  if (!rec->pending) {
+    return false;
+  }
+  if (rec->when < count) {
+    rec->diverged = true;
+    rec->pending = false;
+    return false;
+  }
+  if (rec->when > count || rec->kind != kind) {
+    return false;
+  }
+  *value = rec->value;
+  read_event(rec);
+  return true;
+}
+
+// Poll the keyboard. Events are flushed as they are logged so that the
+// log survives a session that is interrupted.
+bool record_key_ready(record_t* rec, io_t* io, uint64_t count, int* key) {
+  if (rec->mode == REC_REPLAY) {
+    return take_event(rec, 'K', count, key);
+  }
+  if (!io_key_ready(io)) {
+    return false;
+  }
+  *key = io_getc(io);
+  if (rec->mode == REC_RECORD) {
+    fprintf(rec->fp, "K %" PRIu64 " %d\n", count, *key);
+    fflush(rec->fp);
+  }
+  return true;
+}
+
+// Will a key ever arrive
+bool record_input_ended(record_t* rec, io_t* io) {
+  if (rec->mode == REC_REPLAY) {
+    return !rec->pending;
+  }
+  return io_input_ended(io);
+}
+
+// Read a character for GETC/IN
+int record_getc(record_t* rec, io_t* io, uint64_t count) {
+  int c;
+  if (rec->mode == REC_REPLAY) {
+    if (!take_event(rec, 'G', count, &c)) {
+      // Either the log ended or the guest is not where it was
+      // when the session was recorded
+      rec->diverged = rec->diverged || rec->pending;
+      c = IO_EOF;
+    }
+    if (c == IO_EOF) {
+      io->eof = true;
+    }
+    return c;
+  }
+  c = io_getc(io);
+  if (rec->mode == REC_RECORD && c != IO_WAIT) {
+    fprintf(rec->fp, "G %" PRIu64 " %d\n", count, c);
+    fflush(rec->fp);
+  }
+  return c;
+}
@@ -0,0 +1,62 @@
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "io.h"
+
+// Session logs capture every nondeterministic input a guest sees, tagged
+// with the instruction count at which it happened. The log is text, one
+// event per line:
+//
+//   K <count> <key>   keyboard status poll that found a key (KBSR/KBDR)
+//   G <count> <key>   character read by GETC or IN (-1 for end of input)
+//
+// Polls that found no key are not logged: during replay any poll that
+// does not match a K event reports an empty keyboard.
+
+typedef enum {
+  REC_OFF = 0,  // pass input straight through
+  REC_RECORD,   // pass input through and log it
+  REC_REPLAY    // take input from a log
+} record_mode_t;
+
+typedef struct {
+  record_mode_t mode;
+  FILE* fp;
+
+  // Next event of the log in replay mode
+  bool pending;
+  char kind;
+  uint64_t when;
+  int value;
+
+  // Set when the guest asked for input the log does not have
+  bool diverged;
+} record_t;
+
+// Start logging input to the given file. Return 0 on success or -1
+int record_start(record_t* rec, const char* path);
+
+// Start replaying input from the given file. Return 0 on success or -1
+int replay_start(record_t* rec, const char* path);
+
+// Stop recording or replaying and close the log
+void record_stop(record_t* rec);
+
+// Poll the keyboard at the given instruction count. If a key is available
+// it is consumed and stored in key.
+bool record_key_ready(record_t* rec, io_t* io, uint64_t count, int* key);
+
+// True if no key will ever arrive: the replayed log has no events left,
+// or else the console input ended (see io_input_ended)
+bool record_input_ended(record_t* rec, io_t* io);
+
+// Read a character for GETC/IN at the given instruction count. Return
+// IO_EOF when there is no more input, or IO_WAIT when it has not arrived
+// yet. Waiting is not logged.
+int record_getc(record_t* rec, io_t* io, uint64_t count);
+
+#endif  // RECORD_H_
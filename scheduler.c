@@ -0,0 +1,435 @@
+#include "scheduler.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "io.h"
+
+// A guest spinning on an empty keyboard this many times in a row within
+// one slice is waiting for input
+#define PARK_POLLS 64
+
+// Initial capacity of a worker deque
+#define DEQUE_SIZE 64
+
+typedef enum {
+  GUEST_READY,    // in a deque, or about to be pushed to one
+  GUEST_RUNNING,  // being run by a worker
+  GUEST_PARKED,   // waiting for input, in no deque
+  GUEST_DONE      // stopped for good
+} guest_state_t;
+
+struct sched_guest {
+  x16_t* machine;
+  sched_done_fn done;
+  void* arg;
+
+  // Protects everything below
+  pthread_mutex_t lock;
+  guest_state_t state;
+  int refs;
+
+  // Input fed while the guest may be running, moved into the machine at
+  // the start of its next slice
+  uint8_t* pending;
+  size_t pending_len;
+  size_t pending_cap;
+  bool closing;
+
+  // All guests that have not stopped, for sched_free. Protected by the
+  // scheduler lock.
+  sched_guest_t* prev;
+  sched_guest_t* next;
+};
+
+// A deque of runnable guests, kept as a ring. The owner pushes and pops
+// at the bottom, thieves take from the top.
+typedef struct {
+  pthread_mutex_t lock;
+  sched_guest_t** items;
+  size_t cap;
+  size_t top;
+  size_t count;
+} deque_t;
+
+typedef struct {
+  sched_t* sched;
+  pthread_t thread;
+  deque_t deque;
+  unsigned int seed;
+} worker_t;
+
+struct sched {
+  worker_t* workers;
+  int nworkers;
+  uint32_t slice;
+
+  // Protects everything below
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // signalled when a guest becomes runnable
+  pthread_cond_t idle;  // signalled when the last guest stops
+  int ready;            // guests sitting in deques
+  int live;             // guests that have not stopped
+  int next_worker;      // round robin for guests pushed from outside
+  bool stop;
+  sched_guest_t* guests;
+};
+
+// Outcome of a slice
+typedef enum { SLICE_YIELD, SLICE_WAIT, SLICE_DONE } slice_t;
+
+// ----------- Deques
+
+static void deque_init(deque_t* dq) {
+  pthread_mutex_init(&dq->lock, NULL);
+  dq->cap = DEQUE_SIZE;
+  dq->items = (sched_guest_t**)malloc(dq->cap * sizeof(sched_guest_t*));
+  dq->top = 0;
+  dq->count = 0;
+}
+
+static void deque_free(deque_t* dq) {
+  free(dq->items);
+  pthread_mutex_destroy(&dq->lock);
+}
+
+static void deque_push_bottom(deque_t* dq, sched_guest_t* guest) {
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count == dq->cap) {
+    // Unroll the ring into a buffer twice the size
+    sched_guest_t** items =
+        (sched_guest_t**)malloc(2 * dq->cap * sizeof(sched_guest_t*));
+    for (size_t i = 0; i < dq->count; i++) {
+      items[i] = dq->items[(dq->top + i) % dq->cap];
+    }
+    free(dq->items);
+    dq->items = items;
+    dq->cap *= 2;
+    dq->top = 0;
+  }
+  dq->items[(dq->top + dq->count) % dq->cap] = guest;
+  dq->count++;
+  pthread_mutex_unlock(&dq->lock);
+}
+
+static sched_guest_t* deque_pop_bottom(deque_t* dq) {
+  sched_guest_t* guest = NULL;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count > 0) {
+    dq->count--;
+    guest = dq->items[(dq->top + dq->count) % dq->cap];
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return guest;
+}
+
+static sched_guest_t* deque_steal_top(deque_t* dq) {
+  sched_guest_t* guest = NULL;
+  pthread_mutex_lock(&dq->lock);
+  if (dq->count > 0) {
+    guest = dq->items[dq->top];
+    dq->top = (dq->top + 1) % dq->cap;
+    dq->count--;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return guest;
+}
+
+// ----------- Guests
+
+// Make a guest runnable on the given worker
+static void push_ready(sched_t* sched, worker_t* worker, sched_guest_t* guest) {
+  deque_push_bottom(&worker->deque, guest);
+  pthread_mutex_lock(&sched->lock);
+  sched->ready++;
+  pthread_cond_signal(&sched->work);
+  pthread_mutex_unlock(&sched->lock);
+}
+
+// Make a guest runnable from outside the workers
+static void push_ready_outside(sched_t* sched, sched_guest_t* guest) {
+  pthread_mutex_lock(&sched->lock);
+  int id = sched->next_worker;
+  sched->next_worker = (id + 1) % sched->nworkers;
+  pthread_mutex_unlock(&sched->lock);
+  push_ready(sched, &sched->workers[id], guest);
+}
+
+// Drop a reference to a guest, freeing it with the last one
+static void guest_unref(sched_guest_t* guest) {
+  pthread_mutex_lock(&guest->lock);
+  int refs = --guest->refs;
+  pthread_mutex_unlock(&guest->lock);
+  if (refs == 0) {
+    pthread_mutex_destroy(&guest->lock);
+    free(guest->pending);
+    free(guest);
+  }
+}
+
+// Move fed input into the machine. Called with the guest locked.
+static void take_pending(sched_guest_t* guest) {
+  io_t* io = x16_io(guest->machine);
+  if (guest->pending_len > 0) {
+    io_feed_input(io, guest->pending, guest->pending_len);
+    guest->pending_len = 0;
+  }
+  if (guest->closing) {
+    io_close_input(io);
+  }
+}
+
+// Run a guest for at most one slice
+static slice_t run_slice(sched_t* sched, sched_guest_t* guest,
+                         x16_exit_t* reason) {
+  x16_t* machine = guest->machine;
+  io_t* io = x16_io(machine);
+  io->idle_polls = 0;
+  for (uint32_t i = 0; i < sched->slice; i++) {
+    int rv = execute_instruction(machine);
+    if (rv == 1) {
+      return SLICE_WAIT;
+    }
+    if (rv != 0) {
+      *reason = rv == -2 ? X16_FAULT : io->eof ? X16_EOF : X16_HALT;
+      return SLICE_DONE;
+    }
+    if (io->idle_polls >= PARK_POLLS && io->in_open) {
+      return SLICE_WAIT;
+    }
+  }
+  return SLICE_YIELD;
+}
+
+// The guest stopped for good
+static void finish(sched_t* sched, sched_guest_t* guest, x16_exit_t reason) {
+  pthread_mutex_lock(&guest->lock);
+  guest->state = GUEST_DONE;
+  pthread_mutex_unlock(&guest->lock);
+
+  if (guest->done != NULL) {
+    guest->done(guest, guest->machine, reason, guest->arg);
+  }
+
+  pthread_mutex_lock(&sched->lock);
+  if (guest->prev != NULL) {
+    guest->prev->next = guest->next;
+  } else {
+    sched->guests = guest->next;
+  }
+  if (guest->next != NULL) {
+    guest->next->prev = guest->prev;
+  }
+  if (--sched->live == 0) {
+    pthread_cond_broadcast(&sched->idle);
+  }
+  pthread_mutex_unlock(&sched->lock);
+  guest_unref(guest);
+}
+
+// Give the guest one turn on the worker
+static void run_guest(worker_t* worker, sched_guest_t* guest) {
+  sched_t* sched = worker->sched;
+
+  pthread_mutex_lock(&guest->lock);
+  take_pending(guest);
+  guest->state = GUEST_RUNNING;
+  pthread_mutex_unlock(&guest->lock);
+
+  x16_exit_t reason;
+  slice_t result = run_slice(sched, guest, &reason);
+  if (result == SLICE_DONE) {
+    finish(sched, guest, reason);
+    return;
+  }
+
+  // Park the guest, unless input arrived while it was running
+  pthread_mutex_lock(&guest->lock);
+  bool park = result == SLICE_WAIT && guest->pending_len == 0 &&
+              !guest->closing;
+  guest->state = park ? GUEST_PARKED : GUEST_READY;
+  pthread_mutex_unlock(&guest->lock);
+  if (!park) {
+    push_ready(sched, worker, guest);
+  }
+}
+
+// Find a runnable guest: the newest on our own deque, or the oldest on
+// another worker's
+static sched_guest_t* find_guest(worker_t* worker) {
+  sched_t* sched = worker->sched;
+  sched_guest_t* guest = deque_pop_bottom(&worker->deque);
+  if (guest == NULL) {
+    int start = rand_r(&worker->seed) % sched->nworkers;
+    for (int i = 0; i < sched->nworkers && guest == NULL; i++) {
+      worker_t* victim = &sched->workers[(start + i) % sched->nworkers];
+      if (victim != worker) {
+        guest = deque_steal_top(&victim->deque);
+      }
+    }
+  }
+  if (guest != NULL) {
+    pthread_mutex_lock(&sched->lock);
+    sched->ready--;
+    pthread_mutex_unlock(&sched->lock);
+  }
+  return guest;
+}
+
+static void* worker_main(void* arg) {
+  worker_t* worker = (worker_t*)arg;
+  sched_t* sched = worker->sched;
+  for (;;) {
+    sched_guest_t* guest = find_guest(worker);
+    if (guest != NULL) {
+      run_guest(worker, guest);
+      continue;
+    }
+    pthread_mutex_lock(&sched->lock);
+    while (sched->ready <= 0 && !sched->stop) {
+      pthread_cond_wait(&sched->work, &sched->lock);
+    }
+    bool stop = sched->stop;
+    pthread_mutex_unlock(&sched->lock);
+    if (stop) {
+      return NULL;
+    }
+  }
+}
+
+// ----------- Scheduler
+
+// Create a scheduler
+sched_t* sched_create(int workers, uint32_t slice) {
+  sched_t* sched = (sched_t*)malloc(sizeof(sched_t));
+  memset(sched, 0, sizeof(sched_t));
+  sched->nworkers = workers > 0 ? workers : 1;
+  sched->slice = slice > 0 ? slice : 1;
+  pthread_mutex_init(&sched->lock, NULL);
+  pthread_cond_init(&sched->work, NULL);
+  pthread_cond_init(&sched->idle, NULL);
+
+  sched->workers = (worker_t*)malloc(sched->nworkers * sizeof(worker_t));
+  for (int i = 0; i < sched->nworkers; i++) {
+    worker_t* worker = &sched->workers[i];
+    worker->sched = sched;
+    worker->seed = i + 1;
+    deque_init(&worker->deque);
+  }
+  for (int i = 0; i < sched->nworkers; i++) {
+    worker_t* worker = &sched->workers[i];
+    pthread_create(&worker->thread, NULL, worker_main, worker);
+  }
+  return sched;
+}
+
+// Add a guest
+sched_guest_t* sched_add(sched_t* sched, x16_t* machine, sched_done_fn done,
+                         void* arg) {
+  sched_guest_t* guest = (sched_guest_t*)malloc(sizeof(sched_guest_t));
+  memset(guest, 0, sizeof(sched_guest_t));
+  guest->machine = machine;
+  guest->done = done;
+  guest->arg = arg;
+  guest->state = GUEST_READY;
+  guest->refs = 2;  // the caller and the scheduler
+  pthread_mutex_init(&guest->lock, NULL);
+  io_set_headless(x16_io(machine));
+  io_open_input(x16_io(machine));
+
+  pthread_mutex_lock(&sched->lock);
+  guest->next = sched->guests;
+  if (sched->guests != NULL) {
+    sched->guests->prev = guest;
+  }
+  sched->guests = guest;
+  sched->live++;
+  pthread_mutex_unlock(&sched->lock);
+
+  push_ready_outside(sched, guest);
+  return guest;
+}
+
+// Wake a parked guest. Called with the guest locked; return true if the
+// caller has to push it.
+static bool wake(sched_guest_t* guest) {
+  if (guest->state != GUEST_PARKED) {
+    return false;
+  }
+  guest->state = GUEST_READY;
+  return true;
+}
+
+// Feed input
+void sched_feed(sched_t* sched, sched_guest_t* guest, const uint8_t* data,
+                size_t len) {
+  pthread_mutex_lock(&guest->lock);
+  if (guest->state == GUEST_DONE) {
+    pthread_mutex_unlock(&guest->lock);
+    return;
+  }
+  if (guest->pending_len + len > guest->pending_cap) {
+    guest->pending_cap = guest->pending_len + len;
+    guest->pending = (uint8_t*)realloc(guest->pending, guest->pending_cap);
+  }
+  memcpy(guest->pending + guest->pending_len, data, len);
+  guest->pending_len += len;
+  bool push = wake(guest);
+  pthread_mutex_unlock(&guest->lock);
+  if (push) {
+    push_ready_outside(sched, guest);
+  }
+}
+
+// Close the input
+void sched_close_input(sched_t* sched, sched_guest_t* guest) {
+  pthread_mutex_lock(&guest->lock);
+  guest->closing = true;
+  bool push = wake(guest);
+  pthread_mutex_unlock(&guest->lock);
+  if (push) {
+    push_ready_outside(sched, guest);
+  }
+}
+
+// Drop the caller's reference
+void sched_release(sched_t* sched, sched_guest_t* guest) {
+  guest_unref(guest);
+}
+
+// Wait for all guests
+void sched_wait(sched_t* sched) {
+  pthread_mutex_lock(&sched->lock);
+  while (sched->live > 0) {
+    pthread_cond_wait(&sched->idle, &sched->lock);
+  }
+  pthread_mutex_unlock(&sched->lock);
+}
+
+// Stop and free
+void sched_free(sched_t* sched) {
+  pthread_mutex_lock(&sched->lock);
+  sched->stop = true;
+  pthread_cond_broadcast(&sched->work);
+  pthread_mutex_unlock(&sched->lock);
+  for (int i = 0; i < sched->nworkers; i++) {
+    pthread_join(sched->workers[i].thread, NULL);
+    deque_free(&sched->workers[i].deque);
+  }
+
+  // Drop the scheduler's reference to guests that never stopped
+  sched_guest_t* guest = sched->guests;
+  while (guest != NULL) {
+    sched_guest_t* next = guest->next;
+    guest_unref(guest);
+    guest = next;
+  }
+
+  free(sched->workers);
+  pthread_cond_destroy(&sched->work);
+  pthread_cond_destroy(&sched->idle);
+  pthread_mutex_destroy(&sched->lock);
+  free(sched);
+}
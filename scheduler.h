@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "control.h"
+#include "x16.h"
+
+// A scheduler time-slices many machines across a fixed pool of worker
+// threads. Each worker owns a deque of runnable guests: it runs guests
+// from the bottom of its own deque and, when that is empty, steals from
+// the top of another worker's. A guest that waits for input, in GETC/IN
+// or by spinning on an empty keyboard, is parked and takes no worker time
+// until input is fed to it.
+typedef struct sched sched_t;
+
+// A machine run by a scheduler
+typedef struct sched_guest sched_guest_t;
+
+// Called on a worker thread once a guest has stopped for good
+typedef void (*sched_done_fn)(sched_guest_t *guest, x16_t *machine,
+                              x16_exit_t reason, void *arg);
+
+// Create a scheduler with the given number of worker threads. Each turn
+// of a guest runs at most slice instructions.
+sched_t *sched_create(int workers, uint32_t slice);
+
+// Start running a machine. The machine's input is replaced by an open
+// input fed with sched_feed. done, if not NULL, is called when the guest
+// stops. The returned handle stays valid until sched_release.
+sched_guest_t *sched_add(sched_t *sched, x16_t *machine, sched_done_fn done,
+                         void *arg);
+
+// Give a guest more input, waking it up if it is parked. Does nothing
+// once the guest has stopped.
+void sched_feed(sched_t *sched, sched_guest_t *guest, const uint8_t *data,
+                size_t len);
+
+// Tell a guest no more input will arrive
+void sched_close_input(sched_t *sched, sched_guest_t *guest);
+
+// Drop the handle returned by sched_add
+void sched_release(sched_t *sched, sched_guest_t *guest);
+
+// Wait until every guest has stopped
+void sched_wait(sched_t *sched);
+
+// Stop the workers and free the scheduler. Guests that have not stopped
+// are dropped without calling done.
+void sched_free(sched_t *sched);
+
+#endif  // SCHEDULER_H_
@@ -0,0 +1,100 @@
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+#include "cfg.h"
+#include "instruction.h"
+}
+
+// A loop calling a subroutine, a table of data and a word nothing reaches
+static const uint16_t PROGRAM[] = {
+    emit_and_imm(R_R1, R_R1, 0),         // 0x3000
+    emit_ld(R_R2, 7),                    // 0x3001: count
+    emit_jsr(3),                         // 0x3002: sub
+    emit_add_imm(R_R2, R_R2, -1),        // 0x3003
+    emit_br(false, false, true, -2),     // 0x3004
+    emit_trap(TRAP_HALT),                // 0x3005
+    emit_add_imm(R_R1, R_R1, 1),         // 0x3006
+    emit_jmp(R_R7),                      // 0x3007: sub, ret
+    emit_value(0x5000),                  // 0x3008: never reached
+    emit_value(3),                       // 0x3009: count
+};
+
+TEST_CASE("Cfg.blocks", "[cfg]") {
+    size_t count = sizeof(PROGRAM) / sizeof(PROGRAM[0]);
+    cfg_t* cfg = cfg_build(PROGRAM, count, 0x3000);
+
+    REQUIRE(cfg->nblocks == 4);
+    const cfg_block_t* entry = cfg_block_at(cfg, 0x3001);
+    REQUIRE(entry->start == 0x3000);
+    REQUIRE(entry->end == 0x3002);
+    REQUIRE(entry->nsucc == 2);
+    REQUIRE(entry->succ_kind[0] == CFG_CALL);
+    REQUIRE(cfg->blocks[entry->succ[0]].start == 0x3006);
+    REQUIRE(entry->succ_kind[1] == CFG_FALL);
+    REQUIRE(cfg->blocks[entry->succ[1]].start == 0x3003);
+
+    // The loop branches back to itself
+    const cfg_block_t* loop = cfg_block_at(cfg, 0x3004);
+    REQUIRE(loop->start == 0x3003);
+    REQUIRE(loop->succ_kind[0] == CFG_BRANCH);
+    REQUIRE(&cfg->blocks[loop->succ[0]] == loop);
+
+    // Neither HALT nor RET goes on
+    REQUIRE(cfg_block_at(cfg, 0x3005)->nsucc == 0);
+    REQUIRE(cfg_block_at(cfg, 0x3007)->nsucc == 0);
+
+    REQUIRE(cfg_block_at(cfg, 0x3008) == NULL);
+    REQUIRE(cfg_flags(cfg, 0x3008) == 0);
+    REQUIRE(cfg_flags(cfg, 0x3009) == CFG_DATA_TARGET);
+    REQUIRE(cfg_flags(cfg, 0x3006) == (CFG_CODE | CFG_JUMP_TARGET));
+    REQUIRE(cfg_flags(cfg, 0x300a) == 0);
+    cfg_free(cfg);
+}
+
+TEST_CASE("Cfg.format", "[cfg]") {
+    size_t count = sizeof(PROGRAM) / sizeof(PROGRAM[0]);
+    cfg_t* cfg = cfg_build(PROGRAM, count, 0x3000);
+    char line[64];
+
+    cfg_format(cfg, 0x3001, line);
+    REQUIRE(std::string(line) == "ld     %r2, D12297");
+    cfg_format(cfg, 0x3004, line);
+    REQUIRE(std::string(line) == "brp    L12291");
+    cfg_format(cfg, 0x3007, line);
+    REQUIRE(std::string(line) == "jmp    %r7");
+    cfg_format(cfg, 0x3009, line);
+    REQUIRE(std::string(line) == "val $3  # 0x0003");
+
+    // Words xas would not make the same are kept as values
+    uint16_t odd[] = {(uint16_t) (emit_add_reg(R_R1, R_R1, R_R2) | 0x8),
+                      emit_trap(TRAP_HALT)};
+    cfg_t* other = cfg_build(odd, 2, 0x3000);
+    cfg_format(other, 0x3000, line);
+    REQUIRE(std::string(line) == "val $4682 # 0x124a");
+    cfg_free(other);
+    cfg_free(cfg);
+}
+
+// Disassembled source assembles back to the same image
+TEST_CASE("Cfg.reassemble", "[cfg]") {
+    for (const char* source : {"test/samples/all.x16s",
+                               "test/samples/loop.x16s", "giza.x16s"}) {
+        std::string cmd = std::string("./xas ") + source +
+                          " > /dev/null && mv a.obj cfg-orig.obj"
+                          " && ./xod -a cfg-orig.obj > cfg-orig.x16s"
+                          " && ./xas cfg-orig.x16s > /dev/null"
+                          " && cmp a.obj cfg-orig.obj";
+        int rv = system(cmd.c_str());
+        REQUIRE(WEXITSTATUS(rv) == 0);
+    }
+    system("rm -f cfg-orig.obj cfg-orig.x16s");
+}
+
+TEST_CASE("Cfg.dot", "[cfg]") {
+    int rv = system("./xas test/samples/loop.x16s > /dev/null"
+                    " && ./xod -g a.obj | grep -q 'label=\"taken\"'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+}
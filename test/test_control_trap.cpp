@@ -7,6 +7,7 @@
 
 extern "C" {
 #include "control.h"
+#include "fast.h"
 #include "x16.h"
 #include "instruction.h"
 #include "trap.h"
@@ -367,3 +368,29 @@ TEST_CASE("Control.trap.putsp", "[control.trap]") {
         REQUIRE(WEXITSTATUS(status) == 0);
     }
 }
+
+// --------------------- Test invalid instructions
+
+TEST_CASE("Control.fault", "[control.trap]") {
+    // RTI, the reserved opcode and a trap vector that is not a trap
+    const uint16_t invalid[] = {0x8000, 0xd000, emit_trap((trap_t) 0x99)};
+    for (uint16_t instruction : invalid) {
+        for (int fast = 0; fast < 2; fast++) {
+            x16_t* machine = x16_create();
+            x16_memwrite(machine, CODESTART, emit_add_imm(R_R1, R_R1, 5));
+            x16_memwrite(machine, CODESTART + 1, instruction);
+            x16_set(machine, R_PC, CODESTART);
+
+            // The guest stops at the instruction instead of the emulator
+            // aborting
+            x16_exit_t reason =
+                fast ? fast_run(machine, 10) : x16_run(machine, 10);
+            REQUIRE(reason == X16_FAULT);
+            REQUIRE(x16_pc(machine) == CODESTART + 1);
+            REQUIRE(x16_icount(machine) == 1);
+            REQUIRE(x16_reg(machine, R_R1) == 5);
+
+            x16_free(machine);
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "control.h"
+#include "diff.h"
+#include "fast.h"
+#include "instruction.h"
+#include "loader.h"
+#include "x16.h"
+}
+
+// Turn words placed at 0x3000 into a cached image
+static const image_t* make_image(const std::vector<uint16_t>& words) {
+    std::vector<uint8_t> bytes = {0x30, 0x00};
+    for (uint16_t w : words) {
+        bytes.push_back(w >> 8);
+        bytes.push_back(w & 0xff);
+    }
+    return image_cache_bytes(bytes.data(), bytes.size());
+}
+
+// A program that goes through every opcode, the memory mapped registers
+// and the quirks of BR and JSRR
+static const image_t* every_opcode_image() {
+    return make_image({
+        emit_lea(R_R0, 25),           // 0: msg
+        emit_trap(TRAP_PUTS),         // 1
+        emit_and_imm(R_R1, R_R1, 0),  // 2
+        emit_add_imm(R_R1, R_R1, 5),  // 3
+        emit_add_reg(R_R2, R_R2, R_R1),  // 4: loop
+        emit_add_imm(R_R1, R_R1, -1),    // 5
+        emit_br(false, false, true, -3),  // 6: brp loop
+        emit_not(R_R3, R_R2),         // 7
+        emit_st(R_R3, 20),            // 8: data
+        emit_ld(R_R4, 19),            // 9: data
+        emit_ldi(R_R5, 19),           // 10: ptr
+        emit_lea(R_R6, 17),           // 11: data
+        emit_str(R_R2, R_R6, 2),      // 12: spare
+        emit_ldr(R_R0, R_R6, 2),      // 13: spare
+        emit_sti(R_R1, 15),           // 14: ptr
+        emit_jsr(8),                  // 15: sub
+        emit_ldi(R_R0, 15),           // 16: clock
+        emit_trap(TRAP_GETC),         // 17
+        emit_trap(TRAP_OUT),          // 18
+        emit_ldi(R_R0, 13),           // 19: keyboard status
+        emit_br(false, false, false, 1),  // 20: always
+        emit_add_imm(R_R0, R_R0, -1),     // 21: skipped
+        emit_jsrr(R_R7),              // 22: falls through
+        emit_trap(TRAP_HALT),         // 23
+        emit_add_imm(R_R0, R_R0, 1),  // 24: sub
+        emit_jmp(R_R7),               // 25
+        'o', 'k', 0,                  // 26: msg
+        0,                            // 29: data
+        0x3000 + 29,                  // 30: ptr
+        0,                            // 31: spare
+        0xfe08,                       // 32: clock
+        0xfe00,                       // 33: keyboard status
+    });
+}
+
+TEST_CASE("Diff.agree", "[diff]") {
+    const image_t* image = every_opcode_image();
+    FILE* report = tmpfile();
+    const uint8_t input[] = "xy";
+
+    REQUIRE(diff_run(image, input, 2, 0, execute_instruction, fast_execute,
+                     report) == 0);
+    // Running out of input and the instruction limit end runs too
+    REQUIRE(diff_run(image, input, 0, 0, execute_instruction, fast_execute,
+                     report) == 0);
+    REQUIRE(diff_run(image, input, 2, 10, execute_instruction, fast_execute,
+                     report) == 0);
+    REQUIRE(ftell(report) == 0);
+
+    fclose(report);
+}
+
+TEST_CASE("Diff.fast", "[diff]") {
+    const image_t* image = every_opcode_image();
+    x16_t* machine = x16_create();
+    image_place(machine, image);
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_input_buffer(io, (const uint8_t*) "z", 1);
+    io_set_output_buffer(io);
+
+    REQUIRE(fast_run(machine, 0) == X16_HALT);
+    size_t len;
+    const char* out = io_output(io, &len);
+    REQUIRE(std::string(out, len) == "okzHALT\n\n");
+    REQUIRE(x16_reg(machine, R_R2) == 15);
+    REQUIRE(x16_reg(machine, R_R4) == (uint16_t) ~15);
+    REQUIRE(x16_reg(machine, R_R7) == 0x3000 + 23);
+
+    x16_free(machine);
+}
+
+// Executes like the fast backend, but gets ADD immediate wrong
+static int broken_execute(x16_t* machine) {
+    uint16_t instruction = *x16_memory(machine, x16_pc(machine));
+    int rv = fast_execute(machine);
+    if (instruction == emit_add_imm(R_R1, R_R1, -1)) {
+        x16_set(machine, R_R1, x16_reg(machine, R_R1) + 1);
+    }
+    return rv;
+}
+
+TEST_CASE("Diff.diverge", "[diff]") {
+    const image_t* image = every_opcode_image();
+    FILE* report = tmpfile();
+
+    REQUIRE(diff_run(image, NULL, 0, 1000, execute_instruction,
+                     broken_execute, report) == -1);
+
+    // The report names the register and shows the block that went wrong
+    rewind(report);
+    char text[4096];
+    size_t len = fread(text, 1, sizeof(text) - 1, report);
+    text[len] = '\0';
+    std::string s(text);
+    REQUIRE(s.find("Backends diverge after instruction 7\n") == 0);
+    REQUIRE(s.find("  R1: reference 0x0004, alternative 0x0005\n") !=
+            std::string::npos);
+    REQUIRE(s.find("> 0x3006: ") != std::string::npos);
+
+    fclose(report);
+}
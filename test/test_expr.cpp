@@ -0,0 +1,88 @@
+#include "catch.hpp"
+
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include "expr.h"
+}
+
+// SIZE is 8, base is 0x3000, loop refers to itself
+static int lookup(void* ctx, const char* name, int32_t* value) {
+    (void)ctx;
+    if (strcmp(name, "SIZE") == 0) {
+        *value = 8;
+    } else if (strcmp(name, "base") == 0) {
+        *value = 0x3000;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t eval(const char* text) {
+    int32_t value = -12345;
+    char error[64];
+    REQUIRE(expr_eval(text, lookup, NULL, &value, error, sizeof(error)) == 0);
+    return value;
+}
+
+static std::string error(const char* text) {
+    int32_t value;
+    char error[64] = "";
+    REQUIRE(expr_eval(text, lookup, NULL, &value, error, sizeof(error)) ==
+            -1);
+    return error;
+}
+
+TEST_CASE("Expr.literals", "[expr]") {
+    REQUIRE(eval("42") == 42);
+    REQUIRE(eval("0x1F") == 31);
+    REQUIRE(eval("0b101") == 5);
+    REQUIRE(eval("'A'") == 65);
+    REQUIRE(eval("'\\n'") == 10);
+    REQUIRE(eval("'\\''") == 39);
+    REQUIRE(eval("'#'") == 35);
+    REQUIRE(eval("0xffff") == 0xffff);
+}
+
+TEST_CASE("Expr.wrap", "[expr]") {
+    // 32 bits, wrapping around like the words they end up in
+    REQUIRE(eval("2147483647 + 1") == INT32_MIN);
+    REQUIRE(eval("-2147483648") == INT32_MIN);
+    REQUIRE(eval("-(2147483647 + 1) - 1") == INT32_MAX);
+    REQUIRE(eval("65536 * 65536") == 0);
+    REQUIRE(eval("0x80000000 / 2") == -0x40000000);
+}
+
+TEST_CASE("Expr.operators", "[expr]") {
+    // C precedence
+    REQUIRE(eval("1 + 2 * 3") == 7);
+    REQUIRE(eval("(1 + 2) * 3") == 9);
+    REQUIRE(eval("1 << 4 - 1") == 8);
+    REQUIRE(eval("0xf0 | 0x0f & 0x3") == 0xf3);
+    REQUIRE(eval("6 ^ 3") == 5);
+    REQUIRE(eval("-7 / 2") == -3);
+    REQUIRE(eval("~0 & 0xff") == 0xff);
+    REQUIRE(eval("--1") == 1);
+    REQUIRE(eval("256 >> 2 >> 1") == 32);
+    REQUIRE(eval("SIZE-1") == 7);
+    REQUIRE(eval("base + SIZE * 2") == 0x3010);
+}
+
+TEST_CASE("Expr.errors", "[expr]") {
+    REQUIRE(error("1 +") == "missing operand");
+    REQUIRE(error("(1 + 2") == "missing )");
+    REQUIRE(error("1 + 2)") == "unexpected )");
+    REQUIRE(error("4 / (SIZE - 8)") == "division by zero");
+    REQUIRE(error("2147483648 / -1") == "division overflows");
+    REQUIRE(error("missing + 1") == "unknown name missing");
+    REQUIRE(error("0x") == "bad number");
+    REQUIRE(error("0b12") == "bad digit in number");
+    REQUIRE(error("12ab") == "bad number");
+    REQUIRE(error("''") == "empty character");
+    REQUIRE(error("'ab'") == "character not closed");
+    REQUIRE(error("1 % 2") == "unexpected character");
+    REQUIRE(error("") == "missing operand");
+    REQUIRE(error(std::string(100, '(').c_str()) == "expression too deep");
+}
@@ -0,0 +1,206 @@
+#include "catch.hpp"
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include "gdbstub.h"
+#include "instruction.h"
+#include "io.h"
+#include "x16.h"
+}
+
+// Counts R1 down from 3, adding one to R2 each time, then halts
+static const uint16_t PROGRAM[] = {
+    emit_and_imm(R_R1, R_R1, 0),      // 0x3000
+    emit_add_imm(R_R1, R_R1, 3),      // 0x3001
+    emit_add_imm(R_R2, R_R2, 1),      // 0x3002: loop
+    emit_add_imm(R_R1, R_R1, -1),     // 0x3003
+    emit_br(false, false, true, -3),  // 0x3004: brp loop
+    emit_trap(TRAP_HALT),             // 0x3005
+};
+
+// The debugger end of a session, served on another thread
+struct Debugger {
+    x16_t* machine;
+    int fds[2];
+    int result;
+    std::thread stub;
+
+    Debugger() : result(-2) {
+        machine = x16_create();
+        memcpy(x16_memory(machine, DEFAULT_CODESTART), PROGRAM,
+               sizeof(PROGRAM));
+        io_t* io = x16_io(machine);
+        io_set_headless(io);
+        io_set_output_buffer(io);
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        stub = std::thread([this] { result = gdb_session(machine, fds[1]); });
+    }
+
+    ~Debugger() {
+        close(fds[0]);
+        if (stub.joinable()) {
+            stub.join();
+        }
+        close(fds[1]);
+        x16_free(machine);
+    }
+
+    // Send a packet and wait for it to be acknowledged
+    void send(const std::string& data) {
+        unsigned int sum = 0;
+        for (char ch : data) {
+            sum += (unsigned char) ch;
+        }
+        char check[3];
+        snprintf(check, sizeof(check), "%02x", sum & 0xff);
+        std::string out = "$" + data + "#" + check;
+        REQUIRE(write(fds[0], out.data(), out.size()) == (ssize_t) out.size());
+        REQUIRE(next() == '+');
+    }
+
+    // Send a packet and return the reply
+    std::string packet(const std::string& data) {
+        send(data);
+        REQUIRE(next() == '$');
+        std::string reply;
+        for (char ch = next(); ch != '#'; ch = next()) {
+            reply += ch;
+        }
+        next();
+        next();
+        REQUIRE(write(fds[0], "+", 1) == 1);
+        return reply;
+    }
+
+    char next() {
+        char ch = 0;
+        REQUIRE(read(fds[0], &ch, 1) == 1);
+        return ch;
+    }
+};
+
+// Memory as the debugger sees it, two bytes per word with the low first
+static std::string bytes_of(const uint16_t* words, int count) {
+    std::string out;
+    char byte[3];
+    for (int i = 0; i < count; i++) {
+        snprintf(byte, sizeof(byte), "%02x", words[i] & 0xff);
+        out += byte;
+        snprintf(byte, sizeof(byte), "%02x", words[i] >> 8);
+        out += byte;
+    }
+    return out;
+}
+
+TEST_CASE("Gdb.registers", "[gdb]") {
+    Debugger gdb;
+    REQUIRE(gdb.packet("qSupported:swbreak+").find("ReverseStep+") !=
+            std::string::npos);
+    REQUIRE(gdb.packet("?") == "S05");
+    REQUIRE(gdb.packet("g") ==
+            "0000000000000000000000000000000000300200");
+    REQUIRE(gdb.packet("p8") == "0030");
+    REQUIRE(gdb.packet("P0=3412") == "OK");
+    REQUIRE(x16_reg(gdb.machine, R_R0) == 0x1234);
+    REQUIRE(gdb.packet("p0") == "3412");
+    REQUIRE(gdb.packet("pa") == "E01");
+    REQUIRE(gdb.packet("G0100020003000400050006000700080002300100") ==
+            "OK");
+    REQUIRE(x16_reg(gdb.machine, R_R7) == 8);
+    REQUIRE(x16_pc(gdb.machine) == 0x3002);
+    REQUIRE(gdb.packet("vMustReplyEmpty") == "");
+    gdb.send("k");
+    gdb.stub.join();
+    REQUIRE(gdb.result == 0);
+}
+
+TEST_CASE("Gdb.memory", "[gdb]") {
+    Debugger gdb;
+    // Words are two bytes each, low byte first
+    std::string program = bytes_of(PROGRAM, 2);
+    REQUIRE(gdb.packet("m6000,4") == program);
+    REQUIRE(gdb.packet("m6001,2") == program.substr(2, 4));
+    REQUIRE(gdb.packet("M6100,2:3412") == "OK");
+    REQUIRE(*x16_memory(gdb.machine, 0x3080) == 0x1234);
+    REQUIRE(gdb.packet("M6101,1:ab") == "OK");
+    REQUIRE(*x16_memory(gdb.machine, 0x3080) == 0xab34);
+    gdb.send("k");
+    gdb.stub.join();
+    REQUIRE(gdb.result == 0);
+}
+
+TEST_CASE("Gdb.run", "[gdb]") {
+    Debugger gdb;
+    REQUIRE(gdb.packet("Z0,6006,2") == "OK");
+    REQUIRE(gdb.packet("c") == "S05");
+    REQUIRE(gdb.packet("p8") == "0330");
+    REQUIRE(gdb.packet("p2") == "0100");
+
+    REQUIRE(gdb.packet("s") == "S05");
+    REQUIRE(gdb.packet("p8") == "0430");
+    REQUIRE(gdb.packet("c") == "S05");
+    REQUIRE(gdb.packet("p2") == "0200");
+
+    // Backwards to the previous time through the loop, then to the start
+    REQUIRE(gdb.packet("bc") == "S05");
+    REQUIRE(gdb.packet("p8") == "0330");
+    REQUIRE(gdb.packet("p2") == "0100");
+    REQUIRE(gdb.packet("bs") == "S05");
+    REQUIRE(gdb.packet("p8") == "0230");
+    REQUIRE(gdb.packet("bc") == "T05replaylog:begin;");
+    REQUIRE(gdb.packet("p8") == "0030");
+
+    REQUIRE(gdb.packet("z0,6006,2") == "OK");
+    REQUIRE(gdb.packet("c") == "W00");
+    REQUIRE(gdb.packet("c") == "W00");
+    REQUIRE(gdb.packet("p2") == "0300");
+    REQUIRE(gdb.packet("D") == "OK");
+    gdb.stub.join();
+    REQUIRE(gdb.result == 0);
+}
+
+TEST_CASE("Gdb.detach", "[gdb]") {
+    Debugger gdb;
+    REQUIRE(gdb.packet("QStartNoAckMode") == "OK");
+    const char detach[] = "$D#44";
+    REQUIRE(write(gdb.fds[0], detach, 5) == 5);
+    char reply[7] = {0};
+    REQUIRE(read(gdb.fds[0], reply, 6) == 6);
+    REQUIRE(std::string(reply) == "$OK#9a");
+    gdb.stub.join();
+    REQUIRE(gdb.result == GDB_DETACHED);
+    // The history the session kept goes with it
+    REQUIRE(x16_direct_memory(gdb.machine));
+}
+
+TEST_CASE("Gdb.port", "[gdb]") {
+    x16_t* machine = x16_create();
+    REQUIRE(gdb_serve(machine, "0") == -1);
+    REQUIRE(gdb_serve(machine, "65536") == -1);
+    REQUIRE(gdb_serve(machine, "99999999999999999999") == -1);
+    x16_free(machine);
+}
+
+TEST_CASE("Gdb.watch", "[gdb]") {
+    Debugger gdb;
+    // Replace the halt with a store to 0x3010, followed by a halt
+    uint16_t store[] = {emit_st(R_R2, 10), emit_trap(TRAP_HALT)};
+    REQUIRE(gdb.packet("M600a,4:" + bytes_of(store, 2)) == "OK");
+
+    REQUIRE(gdb.packet("Z2,6020,2") == "OK");
+    REQUIRE(gdb.packet("c") == "T05watch:6020;");
+    REQUIRE(gdb.packet("p8") == "0630");
+    REQUIRE(*x16_memory(gdb.machine, 0x3010) == 3);
+    REQUIRE(gdb.packet("?") == "T05watch:6020;");
+    REQUIRE(gdb.packet("z2,6020,2") == "OK");
+    REQUIRE(gdb.packet("z2,6020,2") == "E01");
+    REQUIRE(x16_direct_memory(gdb.machine) == false);  // history is kept
+    REQUIRE(gdb.packet("c") == "W00");
+    gdb.send("k");
+}
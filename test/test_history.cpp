@@ -0,0 +1,169 @@
+#include "catch.hpp"
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "control.h"
+#include "fast.h"
+#include "instruction.h"
+#include "x16.h"
+}
+
+// Where the program keeps its array of 16 words
+static const uint16_t ARRAY = DEFAULT_CODESTART + 16;
+
+// A program that counts up forever in R1, storing each value in a ring of
+// 16 words, so memory keeps changing as well as registers
+static const uint16_t PROGRAM[] = {
+    emit_and_imm(R_R1, R_R1, 0),      // 0
+    emit_lea(R_R2, 14),               // 1: array
+    emit_add_imm(R_R1, R_R1, 1),      // 2: loop
+    emit_and_imm(R_R3, R_R1, 15),     // 3
+    emit_add_reg(R_R4, R_R2, R_R3),   // 4
+    emit_str(R_R1, R_R4, 0),          // 5
+    emit_br(false, false, false, -5),  // 6: always loop
+};
+
+// What is compared between the forward run and going back in time
+struct State {
+    uint16_t registers[MAX_REGISTERS];
+    uint16_t array[16];
+
+    bool operator==(const State& other) const {
+        return memcmp(this, &other, sizeof(State)) == 0;
+    }
+};
+
+static State state_of(x16_t* machine) {
+    State state;
+    memcpy(state.registers, x16_registers(machine), sizeof(state.registers));
+    memcpy(state.array, x16_memory(machine, ARRAY), sizeof(state.array));
+    return state;
+}
+
+static x16_t* setup_machine(size_t budget) {
+    x16_t* machine = x16_create();
+    memcpy(x16_memory(machine, DEFAULT_CODESTART), PROGRAM, sizeof(PROGRAM));
+    x16_set_history(machine, budget);
+    return machine;
+}
+
+// Run the given number of instructions, keeping the state after each
+static std::vector<State> run_forward(x16_t* machine, int (*step)(x16_t*),
+                                      uint64_t count) {
+    std::vector<State> states;
+    states.push_back(state_of(machine));
+    for (uint64_t i = 0; i < count; i++) {
+        REQUIRE(step(machine) == 0);
+        states.push_back(state_of(machine));
+    }
+    return states;
+}
+
+static bool at_store(x16_t* machine, void* arg) {
+    return x16_pc(machine) == DEFAULT_CODESTART + 5;
+}
+
+static bool never(x16_t* machine, void* arg) { return false; }
+
+TEST_CASE("History.travel", "[history]") {
+    x16_t* machine = setup_machine(1 << 20);
+    std::vector<State> states = run_forward(machine, execute_instruction, 2000);
+    REQUIRE(x16_history_start(machine) == 0);
+    REQUIRE(x16_travel(machine, 2001) == -1);
+
+    for (uint64_t count : {2000, 1999, 1500, 701, 700, 3, 0}) {
+        REQUIRE(x16_travel(machine, count) == 0);
+        REQUIRE(x16_icount(machine) == count);
+        REQUIRE(state_of(machine) == states[count]);
+    }
+
+    // The future was forgotten, and running again gives the same states
+    REQUIRE(x16_travel(machine, 10) == -1);
+    REQUIRE(run_forward(machine, execute_instruction, 2000) == states);
+
+    x16_free(machine);
+}
+
+TEST_CASE("History.reverse", "[history]") {
+    x16_t* machine = setup_machine(1 << 20);
+    std::vector<State> states = run_forward(machine, execute_instruction, 100);
+
+    REQUIRE(x16_reverse_step(machine) == 0);
+    REQUIRE(x16_icount(machine) == 99);
+    REQUIRE(state_of(machine) == states[99]);
+
+    // The store is the fourth instruction of each five instruction loop
+    REQUIRE(x16_reverse_continue(machine, at_store, NULL) == 0);
+    REQUIRE(x16_icount(machine) == 95);
+    REQUIRE(state_of(machine) == states[95]);
+    REQUIRE(x16_reverse_continue(machine, at_store, NULL) == 0);
+    REQUIRE(x16_icount(machine) == 90);
+
+    REQUIRE(x16_reverse_continue(machine, never, NULL) == -1);
+    REQUIRE(x16_icount(machine) == 0);
+    REQUIRE(state_of(machine) == states[0]);
+    REQUIRE(x16_reverse_step(machine) == -1);
+
+    x16_free(machine);
+}
+
+TEST_CASE("History.budget", "[history]") {
+    // Too small for snapshots, so everything is undone write by write
+    x16_t* machine = setup_machine(4096);
+    std::vector<State> states = run_forward(machine, execute_instruction,
+                                            10000);
+    uint64_t start = x16_history_start(machine);
+    REQUIRE(start > 0);
+    REQUIRE(start < 10000);
+    REQUIRE(x16_travel(machine, start - 1) == -1);
+    REQUIRE(x16_travel(machine, start) == 0);
+    REQUIRE(state_of(machine) == states[start]);
+    x16_free(machine);
+
+    // Room for snapshots, which are dropped along with the rest
+    machine = setup_machine(4 << 20);
+    states = run_forward(machine, execute_instruction, 300000);
+    start = x16_history_start(machine);
+    REQUIRE(start > 0);
+    uint64_t middle = start + (300000 - start) / 2;
+    for (uint64_t count : {(uint64_t) 299999, middle, start + 1, start}) {
+        REQUIRE(x16_travel(machine, count) == 0);
+        REQUIRE(state_of(machine) == states[count]);
+    }
+    x16_free(machine);
+}
+
+TEST_CASE("History.fast", "[history]") {
+    x16_t* machine = setup_machine(4 << 20);
+    std::vector<State> states = run_forward(machine, fast_execute, 50000);
+    for (uint64_t count : {49999, 25000, 1}) {
+        REQUIRE(x16_travel(machine, count) == 0);
+        REQUIRE(state_of(machine) == states[count]);
+    }
+    REQUIRE(fast_run(machine, 100) == X16_LIMIT);
+    REQUIRE(state_of(machine) == states[101]);
+    x16_free(machine);
+}
+
+TEST_CASE("History.restore", "[history]") {
+    x16_t* machine = setup_machine(1 << 20);
+    x16_snapshot_t* snap = x16_snapshot(machine);
+    run_forward(machine, execute_instruction, 50);
+
+    // Restoring a snapshot starts the history over
+    x16_restore(machine, snap);
+    REQUIRE(x16_history_start(machine) == 0);
+    std::vector<State> states = run_forward(machine, execute_instruction, 10);
+    REQUIRE(x16_travel(machine, 5) == 0);
+    REQUIRE(state_of(machine) == states[5]);
+
+    // Without history only the present is reachable
+    x16_set_history(machine, 0);
+    REQUIRE(x16_travel(machine, 4) == -1);
+    REQUIRE(x16_travel(machine, 5) == 0);
+
+    x16_snapshot_free(snap);
+    x16_free(machine);
+}
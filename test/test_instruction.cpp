@@ -1,6 +1,11 @@
 #include "catch.hpp"
 
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
 extern "C" {
+#include "decode.h"
 #include "instruction.h"
 }
 
@@ -23,3 +28,45 @@ TEST_CASE("Instruction.getimmediate", "[instruction]") {
     instruction = emit_add_imm(R_R1, R_R2, 10);
     REQUIRE(getimmediate(instruction) == 1);
 }
+
+// ------------------------ Test Decode ----------------------------
+
+static std::string decoded(uint16_t instruction) {
+    char buf[DECODE_SIZE];
+    size_t len = decode_into(instruction, buf);
+    REQUIRE(len == strlen(buf));
+    return buf;
+}
+
+TEST_CASE("Instruction.decode", "[instruction]") {
+    REQUIRE(decoded(emit_add_reg(R_R1, R_R2, R_R3)) == "add    %r1, %r2, %r3");
+    REQUIRE(decoded(emit_add_imm(R_R1, R_R2, -16)) == "add    %r1, %r2, $-16");
+    REQUIRE(decoded(emit_and_imm(R_R7, R_R0, 15)) == "and    %r7, %r0, $15");
+    REQUIRE(decoded(emit_not(R_R4, R_R5)) == "not    %r4, %r5");
+    REQUIRE(decoded(emit_br(true, false, true, -256)) == "brnp   $-256");
+    REQUIRE(decoded(emit_br(false, false, false, 0)) == "br     $0");
+    REQUIRE(decoded(emit_jmp(R_R7)) == "jmp    %r7");
+    REQUIRE(decoded(emit_jsr(-1024)) == "jsr    $-1024");
+    REQUIRE(decoded(emit_jsrr(R_R3)) == "jsrr   %r3");
+    REQUIRE(decoded(emit_ld(R_R2, 255)) == "ld     %r2, $255");
+    REQUIRE(decoded(emit_ldi(R_R2, -1)) == "ldi    %r2, $-1");
+    REQUIRE(decoded(emit_ldr(R_R2, R_R6, -32)) == "ldr    %r2, %r6, $-32");
+    REQUIRE(decoded(emit_lea(R_R0, 10)) == "lea    %r0, $10");
+    REQUIRE(decoded(emit_st(R_R1, 3)) == "st     %r1, $3");
+    REQUIRE(decoded(emit_sti(R_R1, 3)) == "sti    %r1, $3");
+    REQUIRE(decoded(emit_str(R_R1, R_R2, 31)) == "str    %r1, %r2, $31");
+    REQUIRE(decoded(emit_trap(TRAP_GETC)) == "getc");
+    REQUIRE(decoded(emit_trap(TRAP_HALT)) == "halt");
+    REQUIRE(decoded(emit_trap((trap_t) 0x30)) == "-");
+    REQUIRE(decoded(0x8000) == "val    0x8000");
+    REQUIRE(decoded(0xdead) == "val    0xdead");
+
+    // decode gives the same, in a string of its own
+    for (uint32_t i = 0; i <= UINT16_MAX; i++) {
+        char* str = decode((uint16_t) i);
+        if (decoded((uint16_t) i) != str) {
+            FAIL("decode differs for " << i);
+        }
+        free(str);
+    }
+}
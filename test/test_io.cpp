@@ -0,0 +1,257 @@
+#include "catch.hpp"
+
+#include <pthread.h>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include "control.h"
+#include "x16.h"
+#include "instruction.h"
+#include "trap.h"
+#include "io.h"
+}
+
+// Beginning program counter
+static int CODESTART = 300;
+
+// Keyboard status register
+static uint16_t KBSR = 0xfe00;
+
+// Create a headless machine reading from the given input and collecting
+// output in memory
+static x16_t* setup_headless_machine(const char* input) {
+    x16_t* machine = x16_create();
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_input_buffer(io, (const uint8_t*) input, strlen(input));
+    io_set_output_buffer(io);
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+// Get the output collected by a headless machine
+static std::string output_of(x16_t* machine) {
+    size_t len;
+    const char* out = io_output(x16_io(machine), &len);
+    return std::string(out == NULL ? "" : out, len);
+}
+
+TEST_CASE("IO.headless.getc", "[io]") {
+    x16_t* machine = setup_headless_machine("ab");
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_GETC));
+
+    REQUIRE(execute_instruction(machine) == 0);
+    REQUIRE(x16_reg(machine, R_R0) == 'a');
+    REQUIRE(execute_instruction(machine) == 0);
+    REQUIRE(x16_reg(machine, R_R0) == 'b');
+    REQUIRE(x16_cond(machine) == FL_POS);
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.headless.eof", "[io]") {
+    x16_t* machine = setup_headless_machine("");
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_set(machine, R_R0, 77);
+
+    // Reading past the end stops the machine instead of aborting
+    REQUIRE(execute_instruction(machine) == -1);
+    REQUIRE(x16_io(machine)->eof);
+    REQUIRE(x16_reg(machine, R_R0) == 77);
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.headless.in", "[io]") {
+    x16_t* machine = setup_headless_machine("q");
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_IN));
+
+    // The character is echoed without a prompt
+    REQUIRE(execute_instruction(machine) == 0);
+    REQUIRE(x16_reg(machine, R_R0) == 'q');
+    REQUIRE(output_of(machine) == "q");
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.headless.output", "[io]") {
+    x16_t* machine = setup_headless_machine("");
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_PUTS));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_PUTSP));
+    x16_memwrite(machine, CODESTART + 2, emit_trap(TRAP_HALT));
+    // "hi" one char per word at 400, "yo!" two chars per word at 500
+    x16_memwrite(machine, 400, 'h');
+    x16_memwrite(machine, 401, 'i');
+    x16_memwrite(machine, 402, 0);
+    x16_memwrite(machine, 500, ('o' << 8) | 'y');
+    x16_memwrite(machine, 501, '!');
+    x16_memwrite(machine, 502, 0);
+
+    x16_set(machine, R_R0, 400);
+    REQUIRE(execute_instruction(machine) == 0);
+    x16_set(machine, R_R0, 500);
+    REQUIRE(execute_instruction(machine) == 0);
+    REQUIRE(execute_instruction(machine) == -1);
+
+    REQUIRE(output_of(machine) == "hiyo!HALT\n\n");
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.headless.kbsr", "[io]") {
+    x16_t* machine = setup_headless_machine("k");
+
+    // The keyboard is ready exactly as long as input is buffered
+    REQUIRE(x16_memread(machine, KBSR) == (1 << 15));
+    REQUIRE(x16_memread(machine, KBSR + 2) == 'k');
+    REQUIRE(x16_memread(machine, KBSR) == 0);
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.headless.kbsr.eof", "[io]") {
+    x16_t* machine = setup_headless_machine("hi");
+    // Poll the keyboard and echo each key, forever
+    x16_memwrite(machine, CODESTART, emit_ldi(R_R0, 4));
+    x16_memwrite(machine, CODESTART + 1, emit_br(false, true, true, -2));
+    x16_memwrite(machine, CODESTART + 2, emit_ldi(R_R0, 3));
+    x16_memwrite(machine, CODESTART + 3, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, CODESTART + 4, emit_br(false, false, false, -5));
+    x16_memwrite(machine, CODESTART + 5, KBSR);
+    x16_memwrite(machine, CODESTART + 6, KBSR + 2);
+
+    // Once the input is used up, the polling loop ends like a read would
+    REQUIRE(x16_run(machine, 1000000) == X16_EOF);
+    REQUIRE(x16_io(machine)->eof);
+    REQUIRE(output_of(machine) == "hi");
+
+    x16_free(machine);
+}
+
+// Echo every input character back until the input runs out
+static void* run_echo(void* arg) {
+    x16_t* machine = (x16_t*) arg;
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, CODESTART + 2, emit_br(false, false, false, -3));
+    while (execute_instruction(machine) == 0) {
+    }
+    return NULL;
+}
+
+TEST_CASE("IO.threads", "[io]") {
+    // Each machine has its own input, output and trace, so they can all
+    // run at the same time
+    const int count = 8;
+    x16_t* machines[count];
+    pthread_t threads[count];
+    std::string inputs[count];
+    FILE* logs[count];
+    for (int i = 0; i < count; i++) {
+        inputs[i] = std::string(1000 + i, (char) ('a' + i));
+        machines[i] = setup_headless_machine(inputs[i].c_str());
+        logs[i] = tmpfile();
+        x16_set_log(machines[i], logs[i]);
+    }
+    for (int i = 0; i < count; i++) {
+        REQUIRE(pthread_create(&threads[i], NULL, run_echo, machines[i]) == 0);
+    }
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < count; i++) {
+        REQUIRE(output_of(machines[i]) == inputs[i]);
+        // Three instructions per character plus the final GETC
+        long lines = 0;
+        rewind(logs[i]);
+        for (int c; (c = fgetc(logs[i])) != EOF;) {
+            lines += c == '\n';
+        }
+        REQUIRE(lines == 3 * (1000 + i) + 1);
+        x16_free(machines[i]);
+        fclose(logs[i]);
+    }
+}
+
+TEST_CASE("IO.suspend", "[io]") {
+    x16_t* machine = x16_create();
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_open_input(io);
+    io_set_output_buffer(io);
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_IN));
+    x16_memwrite(machine, CODESTART + 2, emit_trap(TRAP_HALT));
+    x16_set(machine, R_PC, CODESTART);
+    x16_set(machine, R_R0, 77);
+
+    // Without input GETC waits, leaving the machine where it was
+    REQUIRE(execute_instruction(machine) == 1);
+    REQUIRE(x16_pc(machine) == CODESTART);
+    REQUIRE(x16_icount(machine) == 0);
+    REQUIRE(x16_reg(machine, R_R0) == 77);
+    REQUIRE_FALSE(io->eof);
+
+    // Feeding input resumes it
+    io_feed_input(io, (const uint8_t*) "g", 1);
+    REQUIRE(x16_run(machine, 0) == X16_WAIT);
+    REQUIRE(x16_reg(machine, R_R0) == 'g');
+    REQUIRE(x16_pc(machine) == CODESTART + 1);
+    REQUIRE(x16_icount(machine) == 1);
+
+    io_feed_input(io, (const uint8_t*) "i", 1);
+    REQUIRE(x16_run(machine, 0) == X16_HALT);
+    REQUIRE(x16_reg(machine, R_R0) == 'i');
+    REQUIRE(x16_icount(machine) == 3);
+    REQUIRE(output_of(machine) == "iHALT\n\n");
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.suspend.close", "[io]") {
+    x16_t* machine = x16_create();
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_open_input(io);
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_set(machine, R_PC, CODESTART);
+
+    REQUIRE(x16_run(machine, 0) == X16_WAIT);
+
+    // Once the input is closed, running out of it is the end
+    io_close_input(io);
+    REQUIRE(x16_run(machine, 0) == X16_EOF);
+
+    x16_free(machine);
+}
+
+TEST_CASE("IO.suspend.prompt", "[io]") {
+    static uint8_t map[X16_COVERAGE_SIZE];
+    x16_t* machine = x16_create();
+    io_t* io = x16_io(machine);
+    io_open_input(io);
+    io_set_output_buffer(io);
+    x16_set_coverage(machine, map);
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_IN));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_HALT));
+    x16_set(machine, R_PC, CODESTART);
+
+    // Waiting twice for the character shows the prompt once, and the
+    // resumed IN is not another edge
+    REQUIRE(x16_run(machine, 0) == X16_WAIT);
+    REQUIRE(x16_run(machine, 0) == X16_WAIT);
+    const uint8_t key = 'x';
+    io_feed_input(io, &key, 1);
+    REQUIRE(x16_run(machine, 0) == X16_HALT);
+    REQUIRE(output_of(machine) == "Enter a character: xHALT\n\n");
+
+    int hits = 0;
+    for (int i = 0; i < X16_COVERAGE_SIZE; i++) {
+        hits += map[i];
+    }
+    REQUIRE(hits == 2);
+
+    x16_free(machine);
+}
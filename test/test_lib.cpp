@@ -0,0 +1,158 @@
+#include "catch.hpp"
+
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "libx16.h"
+
+extern "C" {
+#include "instruction.h"
+}
+
+// Object file of a program that echoes two characters and halts:
+// getc, putc, getc, putc, halt
+static const uint8_t ECHO_IMAGE[] = {
+    0x30, 0x00,  // origin
+    0xf0, 0x20, 0xf0, 0x21, 0xf0, 0x20, 0xf0, 0x21, 0xf0, 0x25,
+};
+
+// Create a machine running the echo program on the given input
+static x16_t* setup_echo_machine(const char* input) {
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, ECHO_IMAGE, sizeof(ECHO_IMAGE)) == 0);
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_input_buffer(io, (const uint8_t*) input, strlen(input));
+    io_set_output_buffer(io);
+    return machine;
+}
+
+// Get the output collected by a headless machine
+static std::string output_of(x16_t* machine) {
+    size_t len;
+    const char* out = io_output(x16_io(machine), &len);
+    return std::string(out == NULL ? "" : out, len);
+}
+
+TEST_CASE("Lib.load", "[lib]") {
+    x16_t* machine = setup_echo_machine("");
+    REQUIRE(x16_pc(machine) == DEFAULT_CODESTART);
+    REQUIRE(*x16_memory(machine, 0x3000) == emit_trap(TRAP_GETC));
+    REQUIRE(*x16_memory(machine, 0x3004) == emit_trap(TRAP_HALT));
+
+    // An image needs at least one word after the origin
+    REQUIRE(read_image_bytes(machine, ECHO_IMAGE, 2) == -1);
+
+    x16_free(machine);
+}
+
+TEST_CASE("Lib.run", "[lib]") {
+    x16_t* a = setup_echo_machine("hi");
+    x16_t* b = setup_echo_machine("x");
+
+    // Machines are independent of each other
+    REQUIRE(x16_run(a, 2) == X16_LIMIT);
+    REQUIRE(x16_run(b, 0) == X16_EOF);
+    REQUIRE(x16_run(a, 0) == X16_HALT);
+
+    REQUIRE(output_of(a) == "hiHALT\n\n");
+    REQUIRE(output_of(b) == "x");
+    REQUIRE(x16_icount(a) == 5);
+
+    x16_free(a);
+    x16_free(b);
+}
+
+TEST_CASE("Lib.snapshot", "[lib]") {
+    x16_t* machine = setup_echo_machine("ab");
+    x16_snapshot_t* start = x16_snapshot(machine);
+
+    REQUIRE(x16_run(machine, 0) == X16_HALT);
+    REQUIRE(x16_reg(machine, R_R0) == 'b');
+
+    // Restoring brings back registers, memory and the clock
+    *x16_memory(machine, 0x3001) = 0;
+    x16_restore(machine, start);
+    REQUIRE(x16_pc(machine) == DEFAULT_CODESTART);
+    REQUIRE(x16_reg(machine, R_R0) == 0);
+    REQUIRE(x16_icount(machine) == 0);
+    REQUIRE(*x16_memory(machine, 0x3001) == emit_trap(TRAP_OUT));
+
+    // Run again on new input
+    const char* input = "cd";
+    io_set_input_buffer(x16_io(machine), (const uint8_t*) input, 2);
+    io_set_output_buffer(x16_io(machine));
+    REQUIRE(x16_run(machine, 0) == X16_HALT);
+    REQUIRE(output_of(machine) == "cdHALT\n\n");
+
+    x16_snapshot_free(start);
+    x16_free(machine);
+}
+
+TEST_CASE("Lib.cache", "[lib]") {
+    const image_t* image = image_cache_bytes(ECHO_IMAGE, sizeof(ECHO_IMAGE));
+    REQUIRE(image != NULL);
+    REQUIRE(image->hash == image_hash(ECHO_IMAGE, sizeof(ECHO_IMAGE)));
+    REQUIRE(image->origin == 0x3000);
+    REQUIRE(image->count == 5);
+    REQUIRE(image_cache_bytes(ECHO_IMAGE, 2) == NULL);
+
+    // The same contents always give the same cached image
+    REQUIRE(image_cache_bytes(ECHO_IMAGE, sizeof(ECHO_IMAGE)) == image);
+    REQUIRE(image_cache_find(image->hash) == image);
+
+    // Files are cached by content too, and read again once they change
+    char path[] = "/tmp/test_lib_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE(write(fd, ECHO_IMAGE, sizeof(ECHO_IMAGE)) ==
+            (ssize_t) sizeof(ECHO_IMAGE));
+    REQUIRE(image_cache_file(path) == image);
+    REQUIRE(image_cache_file(path) == image);
+    REQUIRE(write(fd, ECHO_IMAGE + 2, 2) == 2);
+    close(fd);
+    const image_t* longer = image_cache_file(path);
+    REQUIRE(longer != image);
+    REQUIRE(longer->count == 6);
+    unlink(path);
+    REQUIRE(image_cache_file(path) == NULL);
+
+    // Placing a cached image is the same as loading the file
+    x16_t* machine = x16_create();
+    image_place(machine, image);
+    REQUIRE(*x16_memory(machine, 0x3000) == emit_trap(TRAP_GETC));
+    REQUIRE(*x16_memory(machine, 0x3004) == emit_trap(TRAP_HALT));
+    x16_free(machine);
+}
+
+TEST_CASE("Lib.coverage", "[lib]") {
+    static uint8_t map[X16_COVERAGE_SIZE];
+    x16_t* machine = setup_echo_machine("ab");
+    x16_snapshot_t* start = x16_snapshot(machine);
+    x16_set_coverage(machine, map);
+
+    // Straight line code takes one edge per instruction
+    REQUIRE(x16_run(machine, 0) == X16_HALT);
+    int edges = 0, hits = 0;
+    for (int i = 0; i < X16_COVERAGE_SIZE; i++) {
+        edges += map[i] != 0;
+        hits += map[i];
+    }
+    REQUIRE(edges == 5);
+    REQUIRE(hits == 5);
+
+    // Counts add up across runs. The input is used up, so this run stops
+    // at the first GETC
+    x16_restore(machine, start);
+    x16_set_coverage(machine, map);
+    REQUIRE(x16_run(machine, 0) == X16_EOF);
+    hits = 0;
+    for (int i = 0; i < X16_COVERAGE_SIZE; i++) {
+        hits += map[i];
+    }
+    REQUIRE(hits == 6);
+
+    x16_snapshot_free(start);
+    x16_free(machine);
+}
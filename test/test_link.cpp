@@ -0,0 +1,262 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "control.h"
+#include "instruction.h"
+#include "io.h"
+#include "link.h"
+#include "loader.h"
+#include "object.h"
+#include "x16.h"
+}
+
+// Write a module to memory
+static std::vector<uint8_t> write_module(const std::vector<uint16_t>& words,
+                                         const object_symbol_t* exports,
+                                         size_t nexports,
+                                         const object_reloc_t* relocs,
+                                         size_t nrelocs) {
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    object_contents_t contents = {};
+    contents.origin = 0x3000;
+    contents.words = words.data();
+    contents.count = words.size();
+    contents.symbols = exports;
+    contents.nsymbols = nexports;
+    contents.module = true;
+    contents.exports = exports;
+    contents.nexports = nexports;
+    contents.relocs = relocs;
+    contents.nrelocs = nrelocs;
+    REQUIRE(object_write(fp, &contents) == 0);
+    fclose(fp);
+    std::vector<uint8_t> bytes(data, data + len);
+    free(data);
+    return bytes;
+}
+
+// Link modules, returning the number of problems and what was reported
+static int link(linker_t* linker, std::string* errors) {
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    int problems = linker_link(linker, fp);
+    fclose(fp);
+    *errors = std::string(data, len);
+    free(data);
+    return problems;
+}
+
+// A module that calls print, and one that exports it
+static std::vector<uint8_t> caller() {
+    std::vector<uint16_t> words = {
+        emit_and_imm(R_R0, R_R0, 0),
+        emit_add_imm(R_R0, R_R0, 15),
+        emit_add_imm(R_R0, R_R0, 15),
+        emit_add_imm(R_R0, R_R0, 15),
+        emit_add_imm(R_R0, R_R0, 12),  // '9'
+        emit_jsr(0),                   // 0x3005: jsr print
+        emit_trap(TRAP_HALT),
+    };
+    object_reloc_t relocs[] = {{"print", 0x3005, 11}};
+    return write_module(words, NULL, 0, relocs, 1);
+}
+
+static std::vector<uint8_t> printer() {
+    std::vector<uint16_t> words = {emit_trap(TRAP_OUT), emit_jmp(R_R7)};
+    object_symbol_t exports[] = {{"print", 0x3000}};
+    return write_module(words, exports, 1, NULL, 0);
+}
+
+TEST_CASE("Link.call", "[link]") {
+    std::vector<uint8_t> main = caller();
+    std::vector<uint8_t> lib = printer();
+    REQUIRE(object_version(main.data(), main.size()) == 3);
+    // Modules are not images
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, main.data(), main.size()) != 0);
+
+    linker_t* linker = linker_create(0x3000);
+    REQUIRE(linker_add(linker, "main", main.data(), main.size()) == 0);
+    REQUIRE(linker_add(linker, "lib", lib.data(), lib.size()) == 0);
+    std::string errors;
+    REQUIRE(link(linker, &errors) == 0);
+    REQUIRE(errors.empty());
+
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    REQUIRE(linker_write(linker, fp, false) == 0);
+    fclose(fp);
+    linker_free(linker);
+
+    // print ends up at 0x3007, two words past the jsr
+    REQUIRE(read_image_bytes(machine, (uint8_t*) data, len) == 0);
+    free(data);
+    REQUIRE(*x16_memory(machine, 0x3005) == emit_jsr(1));
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_output_buffer(io);
+    REQUIRE(x16_run(machine, 1000) == X16_HALT);
+    size_t out_len;
+    const char* out = io_output(io, &out_len);
+    REQUIRE(std::string(out, out_len).compare(0, 5, "9HALT") == 0);
+    x16_free(machine);
+}
+
+TEST_CASE("Link.errors", "[link]") {
+    std::vector<uint8_t> main = caller();
+    std::vector<uint8_t> lib = printer();
+    std::string errors;
+
+    linker_t* linker = linker_create(0x3000);
+    linker_add(linker, "main", main.data(), main.size());
+    REQUIRE(link(linker, &errors) == 1);
+    REQUIRE(errors == "main: undefined symbol print at 0x3005\n");
+    linker_free(linker);
+
+    linker = linker_create(0x3000);
+    linker_add(linker, "main", main.data(), main.size());
+    linker_add(linker, "lib", lib.data(), lib.size());
+    linker_add(linker, "lib2", lib.data(), lib.size());
+    REQUIRE(link(linker, &errors) == 1);
+    REQUIRE(errors == "duplicate symbol print in lib and lib2\n");
+    linker_free(linker);
+
+    // Not a module
+    uint8_t v1[] = {0x30, 0x00, 0xf0, 0x25};
+    linker = linker_create(0x3000);
+    REQUIRE(linker_add(linker, "v1", v1, sizeof(v1)) == -1);
+    linker_free(linker);
+}
+
+TEST_CASE("Link.range", "[link]") {
+    // A 9 bit offset reaches 255 words ahead, an 11 bit one 1023
+    std::vector<uint16_t> words(300, 0);
+    words[0] = emit_lea(R_R0, 0);
+    words[1] = emit_jsr(0);
+    object_reloc_t relocs[] = {{"print", 0x3000, 9}, {"print", 0x3001, 11}};
+    std::vector<uint8_t> far = write_module(words, NULL, 0, relocs, 2);
+    std::vector<uint8_t> lib = printer();
+
+    linker_t* linker = linker_create(0x3000);
+    linker_add(linker, "far", far.data(), far.size());
+    linker_add(linker, "lib", lib.data(), lib.size());
+    std::string errors;
+    REQUIRE(link(linker, &errors) == 1);
+    REQUIRE(errors ==
+            "far: print at 0x3000 is 299 words away, out of range of a 9 bit "
+            "offset\n");
+    linker_free(linker);
+}
+
+TEST_CASE("Link.address", "[link]") {
+    // A word with an address of its own module, and one with print's
+    std::vector<uint16_t> words = {0x3001, 0, 1};
+    object_reloc_t relocs[] = {{"", 0x3000, 16}, {"print", 0x3001, 16}};
+    std::vector<uint8_t> table = write_module(words, NULL, 0, relocs, 2);
+    std::vector<uint8_t> lib = printer();
+
+    linker_t* linker = linker_create(0x4000);
+    linker_add(linker, "lib", lib.data(), lib.size());
+    linker_add(linker, "table", table.data(), table.size());
+    std::string errors;
+    REQUIRE(link(linker, &errors) == 0);
+
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    REQUIRE(linker_write(linker, fp, false) == 0);
+    fclose(fp);
+    linker_free(linker);
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, (uint8_t*) data, len) == 0);
+    free(data);
+    // table moved to 0x4002, print is at 0x4000
+    REQUIRE(*x16_memory(machine, 0x4002) == 0x4003);
+    REQUIRE(*x16_memory(machine, 0x4003) == 0x4000);
+    REQUIRE(*x16_memory(machine, 0x4004) == 1);
+    x16_free(machine);
+}
+
+TEST_CASE("Link.val", "[link]") {
+    // The addresses in val and .fill follow their module
+    int rv = system("rm -rf link-tmp && mkdir link-tmp"
+                    " && printf '  jsr print\n  halt\n'"
+                    " > link-tmp/main.x16s"
+                    " && printf '.global print\nprint:\n  ld %%r0, ptr\n"
+                    "  puts\n  ldi %%r0, tab\n  puts\n  ret\nptr:\n"
+                    "  val msg\nmsg:\n  .stringz \"hi\"\ntab:\n"
+                    "  .fill ptr\n' > link-tmp/lib.x16s"
+                    " && ./xas -c -o link-tmp/main.obj link-tmp/main.x16s"
+                    " > /dev/null"
+                    " && ./xas -c -o link-tmp/lib.obj link-tmp/lib.x16s"
+                    " > /dev/null"
+                    " && ./xld -o link-tmp/prog.obj link-tmp/main.obj"
+                    " link-tmp/lib.obj"
+                    " && ./x16 --headless -i /dev/null link-tmp/prog.obj"
+                    " | grep -q '^hihiHALT'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // Other values computed from labels would not be right once moved
+    rv = system("printf 'start:\n  val start+1\n' > link-tmp/sum.x16s"
+                " && ./xas -c -o link-tmp/sum.obj link-tmp/sum.x16s"
+                " | grep -q 'ERROR: a module cannot compute'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    system("rm -rf link-tmp");
+}
+
+TEST_CASE("Link.relax", "[link]") {
+    // The address a far branch jumps through follows its module
+    int rv = system("rm -rf link-tmp && mkdir link-tmp"
+                    " && printf '  add %%r0, %%r0, $0\n' > link-tmp/nop.x16s"
+                    " && printf '  br skip\n  .blkw 600\nskip:\n"
+                    "  lea %%r0, msg\n  puts\n  halt\nmsg:\n"
+                    "  .stringz \"ok\"\n' > link-tmp/far.x16s"
+                    " && ./xas -c -o link-tmp/nop.obj link-tmp/nop.x16s"
+                    " > /dev/null"
+                    " && ./xas -c -o link-tmp/far.obj link-tmp/far.x16s"
+                    " > /dev/null"
+                    " && ./xld -o link-tmp/prog.obj link-tmp/nop.obj"
+                    " link-tmp/far.obj"
+                    " && ./x16 --headless -i /dev/null link-tmp/prog.obj"
+                    " | grep -q '^okHALT'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    system("rm -rf link-tmp");
+}
+
+TEST_CASE("Link.xld", "[link]") {
+    int rv = system("rm -rf link-tmp && mkdir link-tmp"
+                    " && printf '.global print\\nprint:\\n  putc\\n  ret\\n'"
+                    " > link-tmp/lib.x16s"
+                    " && printf 'begin:\\n  add %%r0, %%r0, $10\\n"
+                    "  jsr print\\n  halt\\n' > link-tmp/main.x16s"
+                    " && ./xas -c -o link-tmp/main.obj link-tmp/main.x16s"
+                    " > /dev/null"
+                    " && ./xas -c -o link-tmp/lib.obj link-tmp/lib.x16s"
+                    " > /dev/null"
+                    " && ./xld -g -o link-tmp/prog.obj link-tmp/main.obj"
+                    " link-tmp/lib.obj"
+                    " && ./xod link-tmp/prog.obj | grep -q '^print:'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    x16_t* machine = x16_create();
+    REQUIRE(read_image(machine, "link-tmp/prog.obj") == 0);
+    REQUIRE(*x16_memory(machine, 0x3001) == emit_jsr(1));
+    x16_free(machine);
+
+    // Without the module that has print
+    rv = system("./xld -o link-tmp/prog.obj link-tmp/main.obj 2> /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 1);
+    // Without -c print is not a label
+    rv = system("./xas link-tmp/main.x16s > /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 2);
+    system("rm -rf link-tmp");
+}
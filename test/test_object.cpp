@@ -0,0 +1,175 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "instruction.h"
+#include "loader.h"
+#include "object.h"
+#include "x16.h"
+}
+
+static const uint16_t WORDS[] = {
+    emit_and_imm(R_R1, R_R1, 0),  // 0x3000: start, line 3
+    emit_add_imm(R_R1, R_R1, 1),  // 0x3001: loop, line 5
+    emit_br(false, false, true, (uint16_t) -2),  // 0x3002: line 6
+    emit_trap(TRAP_HALT),         // 0x3003: done, line 9
+};
+
+static const uint32_t LINES[] = {3, 5, 6, 9};
+
+// Write an object file to memory
+static std::vector<uint8_t> write_object(const object_symbol_t* symbols,
+                                         size_t nsymbols,
+                                         const uint32_t* lines) {
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    object_contents_t contents = {};
+    contents.origin = 0x3000;
+    contents.words = WORDS;
+    contents.count = 4;
+    contents.symbols = symbols;
+    contents.nsymbols = nsymbols;
+    contents.source = "loop.x16s";
+    contents.lines = lines;
+    REQUIRE(object_write(fp, &contents) == 0);
+    fclose(fp);
+    std::vector<uint8_t> bytes(data, data + len);
+    free(data);
+    return bytes;
+}
+
+static std::vector<uint8_t> example() {
+    object_symbol_t symbols[] = {
+        {"start", 0x3000}, {"loop", 0x3001}, {"done", 0x3003}};
+    return write_object(symbols, 3, LINES);
+}
+
+TEST_CASE("Object.load", "[object]") {
+    std::vector<uint8_t> bytes = example();
+    REQUIRE(object_version(bytes.data(), bytes.size()) == 2);
+
+    object_segment_t segments[OBJECT_MAX_SEGMENTS];
+    REQUIRE(object_segments(bytes.data(), bytes.size(), segments,
+                            OBJECT_MAX_SEGMENTS) == 1);
+    REQUIRE(segments[0].origin == 0x3000);
+    REQUIRE(segments[0].count == 4);
+
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, bytes.data(), bytes.size()) == 0);
+    REQUIRE(memcmp(x16_memory(machine, 0x3000), WORDS, sizeof(WORDS)) == 0);
+    REQUIRE(*x16_memory(machine, 0x3004) == 0);
+    x16_free(machine);
+
+    const image_t* image = image_cache_bytes(bytes.data(), bytes.size());
+    REQUIRE(image != NULL);
+    REQUIRE(image->origin == 0x3000);
+    REQUIRE(image->count == 4);
+    REQUIRE(memcmp(image->words, WORDS, sizeof(WORDS)) == 0);
+
+    // Cut short, it is not a valid file
+    REQUIRE(object_version(bytes.data(), 30) == 1);
+}
+
+TEST_CASE("Object.full", "[object]") {
+    // All of memory is one word more than a segment can hold
+    std::vector<uint16_t> words(65536);
+    for (size_t i = 0; i < words.size(); i++) {
+        words[i] = (uint16_t) (i * 7);
+    }
+    char* data = NULL;
+    size_t len = 0;
+    FILE* fp = open_memstream(&data, &len);
+    object_contents_t contents = {};
+    contents.origin = 0;
+    contents.words = words.data();
+    contents.count = words.size();
+    REQUIRE(object_write(fp, &contents) == 0);
+    fclose(fp);
+
+    object_segment_t segments[OBJECT_MAX_SEGMENTS];
+    REQUIRE(object_segments((uint8_t*) data, len, segments,
+                            OBJECT_MAX_SEGMENTS) == 2);
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, (uint8_t*) data, len) == 0);
+    REQUIRE(memcmp(x16_memory(machine, 0), words.data(),
+                   words.size() * sizeof(uint16_t)) == 0);
+    x16_free(machine);
+    free(data);
+
+    // A module has a single segment, so it cannot be written
+    contents.module = true;
+    fp = open_memstream(&data, &len);
+    REQUIRE(object_write(fp, &contents) == -1);
+    fclose(fp);
+    free(data);
+}
+
+TEST_CASE("Object.version1", "[object]") {
+    // Starts like the magic, but is a version 1 file at 0x7f58
+    uint8_t v1[] = {0x7f, 'X', '1', '6', 0x00, 0x02, 0x12, 0x34};
+    REQUIRE(object_version(v1, sizeof(v1)) == 1);
+    REQUIRE(object_debug(v1, sizeof(v1)) == NULL);
+    x16_t* machine = x16_create();
+    REQUIRE(read_image_bytes(machine, v1, sizeof(v1)) == 0);
+    REQUIRE(*x16_memory(machine, 0x7f58) == 0x3136);
+    REQUIRE(*x16_memory(machine, 0x7f5a) == 0x1234);
+    x16_free(machine);
+    REQUIRE(object_version(v1, 3) == 0);
+}
+
+TEST_CASE("Object.debug", "[object]") {
+    std::vector<uint8_t> bytes = example();
+    object_debug_t* debug = object_debug(bytes.data(), bytes.size());
+    REQUIRE(debug != NULL);
+    REQUIRE(object_symbol_at(debug, 0x3001) == std::string("loop"));
+    REQUIRE(object_symbol_at(debug, 0x3002) == NULL);
+    REQUIRE(object_symbol_address(debug, "done") == 0x3003);
+    REQUIRE(object_symbol_address(debug, "missing") == -1);
+    REQUIRE(object_source(debug) == std::string("loop.x16s"));
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(object_line(debug, 0x3000 + i) == LINES[i]);
+    }
+    REQUIRE(object_line(debug, 0x2fff) == 0);
+    REQUIRE(object_line(debug, 0x3004) == 0);
+    object_debug_free(debug);
+}
+
+TEST_CASE("Object.pool", "[object]") {
+    // The same name twice is stored once
+    object_symbol_t one[] = {{"start", 0x3000}};
+    object_symbol_t two[] = {{"start", 0x3000}, {"start", 0x3002}};
+    size_t diff = write_object(two, 2, NULL).size() -
+                  write_object(one, 1, NULL).size();
+    REQUIRE(diff == 6);
+
+    std::vector<uint8_t> bytes = write_object(two, 2, NULL);
+    object_debug_t* debug = object_debug(bytes.data(), bytes.size());
+    REQUIRE(object_symbol_at(debug, 0x3002) == std::string("start"));
+    REQUIRE(object_line(debug, 0x3000) == 0);
+    object_debug_free(debug);
+}
+
+TEST_CASE("Object.xas", "[object]") {
+    // The same image with and without debug information
+    int rv = system("./xas giza.x16s > /dev/null && mv a.obj object-v1.obj"
+                    " && ./xas -g giza.x16s > /dev/null"
+                    " && ./xod a.obj | grep -q '^start1:'"
+                    " && ./xod a.obj | grep -q 'halt  # line 15$'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    x16_t* v1 = x16_create();
+    x16_t* v2 = x16_create();
+    REQUIRE(read_image(v1, "object-v1.obj") == 0);
+    REQUIRE(read_image(v2, "a.obj") == 0);
+    REQUIRE(memcmp(x16_memory(v1, 0), x16_memory(v2, 0),
+                   MAX_MEMORY * sizeof(uint16_t)) == 0);
+    x16_free(v1);
+    x16_free(v2);
+    remove("object-v1.obj");
+}
@@ -0,0 +1,128 @@
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+extern "C" {
+#include "instruction.h"
+#include "peephole.h"
+#include "trap.h"
+}
+
+// Run the pass over instructions, the ones in labels get a label
+static std::vector<uint16_t> optimize(std::vector<uint16_t> words,
+                                      std::vector<size_t> labels,
+                                      std::vector<size_t>* map,
+                                      peephole_stats_t* stats) {
+    std::vector<peephole_word_t> code;
+    for (uint16_t word : words) {
+        code.push_back({word, false, false, false});
+    }
+    for (size_t label : labels) {
+        code[label].label = true;
+    }
+    map->resize(words.size() + 1);
+    size_t n = peephole_optimize(code.data(), code.size(), map->data(),
+                                 stats);
+    std::vector<uint16_t> out;
+    for (size_t i = 0; i < n; i++) {
+        out.push_back(code[i].word);
+    }
+    return out;
+}
+
+TEST_CASE("Peephole.add", "[peephole]") {
+    std::vector<size_t> map;
+    peephole_stats_t stats;
+    // Only when R_COND is set again before anything can look at it
+    std::vector<uint16_t> out = optimize(
+        {emit_add_imm(R_R1, R_R1, 0), emit_and_imm(R_R2, R_R2, 0),
+         emit_add_imm(R_R1, R_R1, 0), emit_br(false, true, false, 1),
+         emit_add_imm(R_R1, R_R2, 0), emit_not(R_R1, R_R1)},
+        {}, &map, &stats);
+    REQUIRE(out.size() == 5);
+    REQUIRE(out[0] == emit_and_imm(R_R2, R_R2, 0));
+    REQUIRE(stats.words == 1);
+    REQUIRE(map[0] == 0);
+    REQUIRE(map[1] == 0);
+    REQUIRE(map[6] == 5);
+}
+
+TEST_CASE("Peephole.branches", "[peephole]") {
+    std::vector<size_t> map;
+    peephole_stats_t stats;
+    std::vector<uint16_t> out = optimize(
+        {
+            emit_and_imm(R_R1, R_R1, 0),     // 0: loop
+            emit_br(false, true, false, 0),  // 1: brz 2, removed
+            emit_br(true, true, true, 1),    // 2: brnzp 4, removed
+            emit_add_imm(R_R1, R_R1, 1),     // 3: never run, removed
+            emit_br(false, false, true, (uint16_t) -5),  // 4: brp 0
+            emit_trap(TRAP_HALT),
+        },
+        {}, &map, &stats);
+    REQUIRE(out.size() == 3);
+    REQUIRE(out[1] == emit_br(false, false, true, (uint16_t) -2));
+    REQUIRE(stats.words == 3);
+    // Two of them ran in the loop, the skipped one never did
+    REQUIRE(stats.executed == 20);
+    REQUIRE(map[3] == 1);
+
+    // A labeled instruction can be reached, so it stays
+    out = optimize({emit_br(true, true, true, 1), emit_add_imm(R_R1, R_R1, 1),
+                    emit_trap(TRAP_HALT)},
+                   {1}, &map, &stats);
+    REQUIRE(out.size() == 3);
+}
+
+TEST_CASE("Peephole.load", "[peephole]") {
+    std::vector<size_t> map;
+    peephole_stats_t stats;
+    // All three load the halt as a value
+    std::vector<uint16_t> out =
+        optimize({emit_ld(R_R0, 2), emit_ld(R_R0, 1), emit_ld(R_R1, 0),
+                  emit_trap(TRAP_HALT)},
+                 {}, &map, &stats);
+    REQUIRE(out.size() == 3);
+    REQUIRE(out[0] == emit_ld(R_R0, 1));
+    REQUIRE(out[1] == emit_ld(R_R1, 0));
+
+    // An offset out of the code leaves it as it is
+    out = optimize({emit_br(false, false, false, 0), emit_ld(R_R0, 100)}, {},
+                   &map, &stats);
+    REQUIRE(out.size() == 2);
+    REQUIRE(stats.words == 0);
+}
+
+TEST_CASE("Peephole.xas", "[peephole]") {
+    // The program prints the same with and without -O
+    int rv = system("./xas -o peephole.obj test/samples/peephole.x16s"
+                    " > /dev/null"
+                    "; ./x16 --headless -i /dev/null peephole.obj"
+                    " > peephole.out"
+                    "; ./xas -O -o peephole.obj test/samples/peephole.x16s"
+                    " | grep -q '^Optimized away 5 words, about 22 '"
+                    " && ./x16 --headless -i /dev/null peephole.obj"
+                    " | cmp - peephole.out");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    remove("peephole.obj");
+    remove("peephole.out");
+}
+
+TEST_CASE("Peephole.label", "[peephole]") {
+    // entry is only reached through the address in ptr. Once the add is
+    // gone, entry is on the load after it, which must stay
+    std::ofstream out("peephole-label.x16s");
+    out << "start:\n  and %r0, %r0, $0\n  ld %r3, ptr\n  jmp %r3\n"
+        << "  ld %r0, chr\nentry:\n  add %r0, %r0, $0\n  ld %r0, chr\n"
+        << "  putc\n  halt\nchr:\n  val $65\nptr:\n  val entry\n";
+    out.close();
+    int rv = system("./xas -O -o peephole.obj peephole-label.x16s"
+                    " | grep -q '^Optimized away 1 words'"
+                    " && ./x16 --headless -i /dev/null peephole.obj"
+                    " | grep -q '^AHALT'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    remove("peephole-label.x16s");
+    remove("peephole.obj");
+}
@@ -0,0 +1,117 @@
+#include "catch.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include "control.h"
+#include "x16.h"
+#include "instruction.h"
+#include "trap.h"
+#include "io.h"
+}
+
+// Beginning program counter
+static int CODESTART = 300;
+
+// Log file used by the tests
+static const char* LOGPATH = "session.log";
+
+// Wait for a key through the keyboard registers, then read one more
+// character with GETC and halt
+static x16_t* setup_poll_machine(const uint8_t* input, size_t len) {
+    x16_t* machine = x16_create();
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_input_buffer(io, input, len);
+    io_set_output_buffer(io);
+
+    x16_memwrite(machine, CODESTART, emit_ldi(R_R1, 9));       // KBSR
+    x16_memwrite(machine, CODESTART + 1, emit_br(true, false, false, 1));
+    x16_memwrite(machine, CODESTART + 2, emit_br(false, false, false, -3));
+    x16_memwrite(machine, CODESTART + 3, emit_ldi(R_R0, 7));   // KBDR
+    x16_memwrite(machine, CODESTART + 4, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, CODESTART + 5, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 6, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, CODESTART + 7, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, CODESTART + 10, 0xfe00);
+    x16_memwrite(machine, CODESTART + 11, 0xfe02);
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+// Run until the machine halts
+static void run(x16_t* machine) {
+    while (execute_instruction(machine) == 0) {
+    }
+}
+
+// Get the output collected by a headless machine
+static std::string output_of(x16_t* machine) {
+    size_t len;
+    const char* out = io_output(x16_io(machine), &len);
+    return std::string(out == NULL ? "" : out, len);
+}
+
+TEST_CASE("Record.replay", "[record]") {
+    const uint8_t input[] = {'a', 'b'};
+    x16_t* recorded = setup_poll_machine(input, sizeof(input));
+    REQUIRE(x16_record(recorded, LOGPATH) == 0);
+    run(recorded);
+
+    // The replayed machine has no input at all, only the log
+    x16_t* replayed = setup_poll_machine(NULL, 0);
+    REQUIRE(x16_replay(replayed, LOGPATH) == 0);
+    run(replayed);
+
+    REQUIRE(output_of(recorded) == "abHALT\n\n");
+    REQUIRE(output_of(replayed) == output_of(recorded));
+    REQUIRE(x16_icount(replayed) == x16_icount(recorded));
+    for (int i = 0; i < MAX_REGISTERS; i++) {
+        REQUIRE(x16_reg(replayed, (reg_t) i) == x16_reg(recorded, (reg_t) i));
+    }
+    REQUIRE_FALSE(x16_replay_diverged(replayed));
+
+    x16_free(recorded);
+    x16_free(replayed);
+    remove(LOGPATH);
+}
+
+TEST_CASE("Record.diverged", "[record]") {
+    FILE* fp = fopen(LOGPATH, "w");
+    REQUIRE(fp != NULL);
+    // The key arrives on the first poll, but GETC is claimed to run at an
+    // instruction that is not a GETC
+    fprintf(fp, "K 1 120\nG 4 121\n");
+    fclose(fp);
+
+    x16_t* machine = setup_poll_machine(NULL, 0);
+    REQUIRE(x16_replay(machine, LOGPATH) == 0);
+    run(machine);
+
+    REQUIRE(x16_replay_diverged(machine));
+    REQUIRE(output_of(machine) == "x");
+
+    x16_free(machine);
+    remove(LOGPATH);
+}
+
+TEST_CASE("Record.late", "[record]") {
+    FILE* fp = fopen(LOGPATH, "w");
+    REQUIRE(fp != NULL);
+    // The guest polls 10000 times before the key arrives. The empty input
+    // of the console does not end the replay, the log does.
+    fprintf(fp, "K 30001 120\nG 30005 121\n");
+    fclose(fp);
+
+    x16_t* machine = setup_poll_machine(NULL, 0);
+    REQUIRE(x16_replay(machine, LOGPATH) == 0);
+    REQUIRE(x16_run(machine, 100000) == X16_HALT);
+
+    REQUIRE_FALSE(x16_replay_diverged(machine));
+    REQUIRE(output_of(machine) == "xyHALT\n\n");
+
+    x16_free(machine);
+    remove(LOGPATH);
+}
@@ -0,0 +1,118 @@
+#include "catch.hpp"
+
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "control.h"
+#include "x16.h"
+#include "instruction.h"
+#include "io.h"
+#include "scheduler.h"
+}
+
+// Beginning program counter
+static int CODESTART = 300;
+
+// Echo every input character back until the input runs out
+static x16_t* setup_echo_machine() {
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_trap(TRAP_GETC));
+    x16_memwrite(machine, CODESTART + 1, emit_trap(TRAP_OUT));
+    x16_memwrite(machine, CODESTART + 2, emit_br(false, false, false, -3));
+    x16_set(machine, R_PC, CODESTART);
+    io_set_output_buffer(x16_io(machine));
+    return machine;
+}
+
+// Spin on the keyboard status register until a key arrives, then halt
+static x16_t* setup_poll_machine() {
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_ldi(R_R1, 2));
+    x16_memwrite(machine, CODESTART + 1, emit_br(false, true, true, -2));
+    x16_memwrite(machine, CODESTART + 2, emit_trap(TRAP_HALT));
+    x16_memwrite(machine, CODESTART + 3, 0xfe00);
+    x16_set(machine, R_PC, CODESTART);
+    io_set_output_buffer(x16_io(machine));
+    return machine;
+}
+
+// Get the output collected by a headless machine
+static std::string output_of(x16_t* machine) {
+    size_t len;
+    const char* out = io_output(x16_io(machine), &len);
+    return std::string(out == NULL ? "" : out, len);
+}
+
+static std::atomic<int> finished;
+
+static void count_done(sched_guest_t* guest, x16_t* machine,
+                       x16_exit_t reason, void* arg) {
+    *(x16_exit_t*) arg = reason;
+    finished++;
+}
+
+TEST_CASE("Sched.echo", "[sched]") {
+    const int count = 300;
+    sched_t* sched = sched_create(4, 100);
+    std::vector<x16_t*> machines(count);
+    std::vector<sched_guest_t*> guests(count);
+    std::vector<x16_exit_t> reasons(count, X16_LIMIT);
+    finished = 0;
+
+    for (int i = 0; i < count; i++) {
+        machines[i] = setup_echo_machine();
+        guests[i] = sched_add(sched, machines[i], count_done, &reasons[i]);
+    }
+
+    // Feed the input in pieces, so guests park and wake repeatedly
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < count; i++) {
+            std::string piece = std::to_string(i) + ",";
+            sched_feed(sched, guests[i], (const uint8_t*) piece.data(),
+                       piece.size());
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        sched_close_input(sched, guests[i]);
+    }
+    sched_wait(sched);
+
+    REQUIRE(finished == count);
+    for (int i = 0; i < count; i++) {
+        std::string piece = std::to_string(i) + ",";
+        REQUIRE(output_of(machines[i]) == piece + piece + piece + piece + piece);
+        REQUIRE(reasons[i] == X16_EOF);
+        sched_release(sched, guests[i]);
+        x16_free(machines[i]);
+    }
+    sched_free(sched);
+}
+
+TEST_CASE("Sched.park", "[sched]") {
+    sched_t* sched = sched_create(2, 1000);
+    x16_t* machine = setup_poll_machine();
+    x16_exit_t reason = X16_LIMIT;
+    finished = 0;
+    sched_guest_t* guest = sched_add(sched, machine, count_done, &reason);
+
+    // Without input the guest is parked and stops consuming time
+    usleep(50000);
+    uint64_t parked = x16_icount(machine);
+    usleep(50000);
+    REQUIRE(x16_icount(machine) == parked);
+    REQUIRE(finished == 0);
+
+    const uint8_t key = 'k';
+    sched_feed(sched, guest, &key, 1);
+    sched_wait(sched);
+    REQUIRE(finished == 1);
+    REQUIRE(reason == X16_HALT);
+    REQUIRE(output_of(machine) == "HALT\n\n");
+
+    sched_release(sched, guest);
+    sched_free(sched);
+    x16_free(machine);
+}
@@ -0,0 +1,345 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+
+extern "C" {
+#include "control.h"
+#include "fast.h"
+#include "instruction.h"
+#include "io.h"
+#include "x16.h"
+}
+
+// Random programs are checked instruction by instruction against a simple
+// model of the machine. Set X16_STRESS_INSTRUCTIONS to run more of them,
+// and X16_STRESS_SEED to try other programs.
+
+// Words in a random program, placed at DEFAULT_CODESTART
+static const int PROGRAM_SIZE = 256;
+
+// Instructions a program may run before it is cut off
+static const uint64_t PROGRAM_LIMIT = 20000;
+
+// First address of the memory mapped registers
+static const uint16_t MMIO_BASE = 0xfe00;
+
+// What the model did with an instruction
+enum step_t {
+    STEP_OK,    // executed it
+    STEP_STOP,  // it is out of scope for the model, end the program here
+    STEP_HALT,  // HALT
+    STEP_EOF    // GETC ran out of input
+};
+
+// The machine as the ISA describes it, written independently of control.c
+struct Model {
+    uint16_t mem[MAX_MEMORY];
+    uint16_t reg[MAX_REGISTERS];
+    std::string input;
+    size_t in_pos;
+    std::string out;
+    int written;  // address stored to by the last instruction, or -1
+
+    void set(int r, uint16_t value) {
+        reg[r] = value;
+        reg[R_COND] = value == 0 ? FL_ZRO : (value >> 15) ? FL_NEG : FL_POS;
+    }
+
+    // Execute one instruction. Instructions the model does not cover are
+    // not executed: the memory mapped registers, OP_RES, OP_RTI and traps
+    // other than GETC, OUT and HALT.
+    step_t step() {
+        uint16_t pc = reg[R_PC];
+        if (pc >= MMIO_BASE) {
+            return STEP_STOP;
+        }
+        uint16_t ins = mem[pc];
+        uint16_t next = pc + 1;
+        int r1 = (ins >> 9) & 7, r2 = (ins >> 6) & 7;
+        uint16_t operand = (ins & 0x20) ? sext(ins, 5) : reg[ins & 7];
+        uint16_t a, b;
+        written = -1;
+        switch (ins >> 12) {
+            case OP_ADD:
+                set(r1, reg[r2] + operand);
+                break;
+            case OP_AND:
+                set(r1, reg[r2] & operand);
+                break;
+            case OP_NOT:
+                set(r1, ~reg[r2]);
+                break;
+            case OP_BR:
+                if (r1 == 0 || ((r1 & 4) && reg[R_COND] == FL_NEG) ||
+                    ((r1 & 2) && reg[R_COND] == FL_ZRO) ||
+                    ((r1 & 1) && reg[R_COND] == FL_POS)) {
+                    next += sext(ins, 9);
+                }
+                break;
+            case OP_JMP:
+                next = reg[r2];
+                break;
+            case OP_JSR:
+                reg[R_R7] = next;
+                next = (ins & 0x800) ? next + sext(ins, 11) : reg[r2];
+                break;
+            case OP_LD:
+                a = next + sext(ins, 9);
+                if (a >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                set(r1, mem[a]);
+                break;
+            case OP_LDI:
+                a = next + sext(ins, 9);
+                if (a >= MMIO_BASE || mem[a] >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                set(r1, mem[mem[a]]);
+                break;
+            case OP_LDR:
+                a = reg[r2] + sext(ins, 6);
+                if (a >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                set(r1, mem[a]);
+                break;
+            case OP_LEA:
+                set(r1, next + sext(ins, 9));
+                break;
+            case OP_ST:
+                a = next + sext(ins, 9);
+                if (a >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                mem[written = a] = reg[r1];
+                break;
+            case OP_STI:
+                a = next + sext(ins, 9);
+                if (a >= MMIO_BASE || mem[a] >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                b = mem[a];
+                mem[written = b] = reg[r1];
+                break;
+            case OP_STR:
+                a = reg[r2] + sext(ins, 6);
+                if (a >= MMIO_BASE) {
+                    return STEP_STOP;
+                }
+                mem[written = a] = reg[r1];
+                break;
+            case OP_TRAP:
+                switch (ins & 0xff) {
+                    case TRAP_GETC:
+                        reg[R_PC] = next;
+                        if (in_pos == input.size()) {
+                            return STEP_EOF;
+                        }
+                        set(R_R0, (uint8_t) input[in_pos++]);
+                        break;
+                    case TRAP_OUT:
+                        out += (char) reg[R_R0];
+                        break;
+                    case TRAP_HALT:
+                        reg[R_PC] = next;
+                        out += "HALT\n\n";
+                        return STEP_HALT;
+                    default:
+                        return STEP_STOP;
+                }
+                break;
+            default:
+                return STEP_STOP;
+        }
+        reg[R_PC] = next;
+        return STEP_OK;
+    }
+
+    static uint16_t sext(uint16_t value, int bits) {
+        value &= (1 << bits) - 1;
+        if (value & (1 << (bits - 1))) {
+            value |= 0xffff << bits;
+        }
+        return value;
+    }
+};
+
+// A random but valid instruction, built with the emit functions
+static uint16_t random_instruction(std::mt19937& rng) {
+    reg_t d = (reg_t) (rng() % 8), s = (reg_t) (rng() % 8),
+          t = (reg_t) (rng() % 8);
+    // Mostly short offsets, so loops and nearby data are common
+    uint16_t near = rng() % 65 - 32;
+    switch (rng() % 40) {
+        case 0: case 1: case 2:
+            return emit_add_reg(d, s, t);
+        case 3: case 4: case 5: case 6:
+            return emit_add_imm(d, s, rng());
+        case 7: case 8:
+            return emit_and_reg(d, s, t);
+        case 9: case 10:
+            return emit_and_imm(d, s, rng());
+        case 11: case 12:
+            return emit_not(d, s);
+        case 13: case 14: case 15: case 16: case 17:
+            return emit_br(rng() % 2, rng() % 2, rng() % 2, near);
+        case 18:
+            return emit_jmp(s);
+        case 19:
+            return emit_jsr(near);
+        case 20:
+            return emit_jsrr(s);
+        case 21: case 22:
+            return emit_ld(d, near);
+        case 23:
+            return emit_ldi(d, near);
+        case 24: case 25:
+            return emit_ldr(d, s, rng());
+        case 26: case 27:
+            return emit_lea(d, rng());
+        case 28: case 29:
+            return emit_st(d, near);
+        case 30:
+            return emit_sti(d, near);
+        case 31: case 32:
+            return emit_str(d, s, rng());
+        case 33: case 34:
+            return emit_trap(TRAP_GETC);
+        case 35: case 36:
+            return emit_trap(TRAP_OUT);
+        case 37:
+            return rng() % 8 == 0 ? emit_trap(TRAP_HALT) : emit_not(d, s);
+        default:
+            return emit_value(rng());  // data, often not an instruction
+    }
+}
+
+// An execution backend under test
+struct Backend {
+    const char* name;
+    int (*step)(x16_t*);
+    x16_exit_t (*run)(x16_t*, uint64_t);
+};
+
+// Put a random program with random registers and input in the model
+static void setup_program(std::mt19937& rng, Model* model) {
+    memset(model->mem, 0, sizeof(model->mem));
+    for (int i = 0; i < PROGRAM_SIZE; i++) {
+        model->mem[DEFAULT_CODESTART + i] = random_instruction(rng);
+    }
+    for (int r = 0; r < 8; r++) {
+        model->reg[r] = rng();
+    }
+    model->reg[R_PC] = DEFAULT_CODESTART;
+    model->reg[R_COND] = FL_ZRO;
+    model->input.clear();
+    for (int n = rng() % 32; n > 0; n--) {
+        model->input += (char) rng();
+    }
+    model->in_pos = 0;
+    model->out.clear();
+}
+
+// Create a machine in the start state of the model
+static x16_t* machine_of(const Model& model, const std::string& input) {
+    x16_t* machine = x16_create();
+    memcpy(x16_memory(machine, 0), model.mem, sizeof(model.mem));
+    memcpy(x16_registers(machine), model.reg, sizeof(model.reg));
+    io_t* io = x16_io(machine);
+    io_set_headless(io);
+    io_set_input_buffer(io, (const uint8_t*) input.data(), input.size());
+    io_set_output_buffer(io);
+    return machine;
+}
+
+static std::string output_of(x16_t* machine) {
+    size_t len;
+    const char* out = io_output(x16_io(machine), &len);
+    return std::string(out == NULL ? "" : out, len);
+}
+
+static uint64_t env_or(const char* name, uint64_t fallback) {
+    const char* value = getenv(name);
+    return value != NULL ? strtoull(value, NULL, 10) : fallback;
+}
+
+static void stress(const Backend& backend) {
+    uint64_t budget = env_or("X16_STRESS_INSTRUCTIONS", 5000000);
+    uint64_t seed = env_or("X16_STRESS_SEED", 1);
+    std::mt19937 rng(seed);
+    static Model model;
+    uint64_t checked = 0, programs = 0;
+    double run_seconds = 0;
+
+    while (checked < budget) {
+        setup_program(rng, &model);
+        std::string input = model.input;
+        x16_t* machine = machine_of(model, input);
+        x16_t* rerun = machine_of(model, input);
+        INFO(backend.name << " seed " << seed << " program " << programs);
+
+        // Step both in lockstep for as long as the model covers the program
+        uint64_t steps = 0;
+        step_t st = STEP_OK;
+        while (steps < PROGRAM_LIMIT && (st = model.step()) != STEP_STOP) {
+            int rv = backend.step(machine);
+            steps++;
+            uint16_t cond = x16_cond(machine);
+            if (cond != FL_POS && cond != FL_ZRO && cond != FL_NEG) {
+                FAIL("R_COND is " << cond << " after " << steps);
+            }
+            if (memcmp(x16_registers(machine), model.reg,
+                       sizeof(model.reg)) != 0 ||
+                (model.written >= 0 &&
+                 *x16_memory(machine, model.written) !=
+                     model.mem[model.written])) {
+                FAIL("state differs from the model after " << steps);
+            }
+            if (rv != (st == STEP_OK ? 0 : -1)) {
+                FAIL("result " << rv << " after " << steps);
+            }
+            if (st != STEP_OK) {
+                break;
+            }
+        }
+        REQUIRE(memcmp(x16_memory(machine, 0), model.mem,
+                       sizeof(model.mem)) == 0);
+        REQUIRE(output_of(machine) == model.out);
+        REQUIRE(x16_icount(machine) == steps);
+
+        // Run the same program again unchecked to measure throughput. It
+        // has to end up in the same state. A limit of 0 would mean none.
+        auto begin = std::chrono::steady_clock::now();
+        if (steps > 0) {
+            backend.run(rerun, steps);
+        }
+        run_seconds += std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - begin).count();
+        REQUIRE(memcmp(x16_registers(rerun), model.reg,
+                       sizeof(model.reg)) == 0);
+        REQUIRE(x16_icount(rerun) == steps);
+
+        x16_free(machine);
+        x16_free(rerun);
+        checked += steps;
+        programs++;
+    }
+    printf("stress %s: %llu instructions in %llu programs, %.1f M/s\n",
+           backend.name, (unsigned long long) checked,
+           (unsigned long long) programs,
+           run_seconds > 0 ? checked / run_seconds / 1e6 : 0.0);
+}
+
+TEST_CASE("Stress.reference", "[stress]") {
+    stress({"execute_instruction", execute_instruction, x16_run});
+}
+
+TEST_CASE("Stress.fast", "[stress]") {
+    stress({"fast_execute", fast_execute, fast_run});
+}
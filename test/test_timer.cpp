@@ -0,0 +1,74 @@
+#include "catch.hpp"
+
+#include <time.h>
+
+extern "C" {
+#include "control.h"
+#include "x16.h"
+#include "instruction.h"
+}
+
+// Beginning program counter
+static int CODESTART = 300;
+
+// Clock and timer registers
+static uint16_t CLKL = 0xfe08;
+static uint16_t CLKH = 0xfe0a;
+static uint16_t TMR = 0xfe0c;
+
+// A machine that loops forever on a branch to itself
+static x16_t* setup_loop_machine() {
+    x16_t* machine = x16_create();
+    x16_memwrite(machine, CODESTART, emit_br(false, false, false, -1));
+    x16_set(machine, R_PC, CODESTART);
+    return machine;
+}
+
+TEST_CASE("Timer.clock", "[timer]") {
+    x16_t* machine = setup_loop_machine();
+
+    for (int i = 0; i < 70000; i++) {
+        REQUIRE(execute_instruction(machine) == 0);
+    }
+    REQUIRE(x16_icount(machine) == 70000);
+
+    // The low word latches the high word
+    REQUIRE(x16_memread(machine, CLKL) == (uint16_t) 70000);
+    REQUIRE(x16_memread(machine, CLKH) == 1);
+
+    x16_free(machine);
+}
+
+TEST_CASE("Timer.countdown", "[timer]") {
+    x16_t* machine = setup_loop_machine();
+
+    x16_memwrite(machine, TMR, 10);
+    for (int i = 0; i < 4; i++) {
+        REQUIRE(execute_instruction(machine) == 0);
+    }
+    REQUIRE(x16_memread(machine, TMR) == 6);
+    for (int i = 0; i < 10; i++) {
+        REQUIRE(execute_instruction(machine) == 0);
+    }
+    REQUIRE(x16_memread(machine, TMR) == 0);
+
+    x16_free(machine);
+}
+
+TEST_CASE("Timer.pace", "[timer]") {
+    x16_t* machine = setup_loop_machine();
+
+    // 2000 instructions at 20000 per second take at least 0.1 seconds
+    x16_set_pace(machine, 20000);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 2000; i++) {
+        REQUIRE(execute_instruction(machine) == 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1e9;
+    REQUIRE(elapsed >= 0.09);
+
+    x16_free(machine);
+}
@@ -0,0 +1,113 @@
+#include "catch.hpp"
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "control.h"
+#include "fast.h"
+#include "instruction.h"
+#include "io.h"
+#include "x16.h"
+}
+
+// Stores R1 to 0x4000 and 0x4001, loads 0x4001 back, then halts
+static const uint16_t PROGRAM[] = {
+    emit_add_imm(R_R1, R_R1, 7),   // 0x3000
+    emit_ld(R_R2, 5),              // 0x3001: ptr
+    emit_str(R_R1, R_R2, 0),       // 0x3002
+    emit_str(R_R1, R_R2, 1),       // 0x3003
+    emit_ldr(R_R3, R_R2, 1),       // 0x3004
+    emit_trap(TRAP_HALT),          // 0x3005
+    emit_value(0),                 // 0x3006
+    emit_value(0x4000),            // 0x3007: ptr
+};
+
+struct Access {
+    uint16_t address;
+    uint16_t value;
+    x16_watch_t kind;
+    uint16_t pc;
+
+    bool operator==(const Access& other) const {
+        return address == other.address && value == other.value &&
+               kind == other.kind && pc == other.pc;
+    }
+};
+
+static void record(x16_t* machine, uint16_t address, uint16_t value,
+                   x16_watch_t kind, void* arg) {
+    // The PC already points past the instruction making the access
+    ((std::vector<Access>*) arg)->push_back(
+        {address, value, kind, (uint16_t) (x16_pc(machine) - 1)});
+}
+
+static x16_t* setup_machine() {
+    x16_t* machine = x16_create();
+    memcpy(x16_memory(machine, DEFAULT_CODESTART), PROGRAM, sizeof(PROGRAM));
+    io_set_headless(x16_io(machine));
+    io_set_output_buffer(x16_io(machine));
+    return machine;
+}
+
+TEST_CASE("Watch.write", "[watch]") {
+    for (auto run : {x16_run, fast_run}) {
+        x16_t* machine = setup_machine();
+        std::vector<Access> seen;
+        REQUIRE(x16_watch(machine, 0x4001, 0x4001, X16_WATCH_WRITE, record,
+                          &seen) >= 0);
+        REQUIRE_FALSE(x16_direct_memory(machine));
+        run(machine, 0);
+        // The store to 0x4000 is on a watched page but not watched
+        REQUIRE(seen == std::vector<Access>{{0x4001, 7, X16_WATCH_WRITE,
+                                             0x3003}});
+        x16_free(machine);
+    }
+}
+
+TEST_CASE("Watch.access", "[watch]") {
+    x16_t* machine = setup_machine();
+    std::vector<Access> reads, all;
+    int ptr = x16_watch(machine, 0x3007, 0x3007, X16_WATCH_READ, record,
+                        &reads);
+    REQUIRE(x16_watch(machine, 0x4000, 0x40ff, X16_WATCH_ACCESS, record,
+                      &all) >= 0);
+    x16_run(machine, 0);
+    REQUIRE(reads == std::vector<Access>{{0x3007, 0x4000, X16_WATCH_READ,
+                                          0x3001}});
+    REQUIRE(all == std::vector<Access>{
+                       {0x4000, 7, X16_WATCH_WRITE, 0x3002},
+                       {0x4001, 7, X16_WATCH_WRITE, 0x3003},
+                       {0x4001, 7, X16_WATCH_READ, 0x3004},
+                   });
+
+    // Removing one leaves the other
+    x16_unwatch(machine, ptr);
+    reads.clear();
+    all.clear();
+    x16_set(machine, R_PC, DEFAULT_CODESTART);
+    x16_run(machine, 0);
+    REQUIRE(reads.empty());
+    REQUIRE(all.size() == 3);
+    x16_free(machine);
+}
+
+TEST_CASE("Watch.unwatch", "[watch]") {
+    x16_t* machine = setup_machine();
+    std::vector<Access> seen;
+    int ids[X16_MAX_WATCHES];
+    for (int i = 0; i < X16_MAX_WATCHES; i++) {
+        ids[i] = x16_watch(machine, 0x4000, 0x4001, X16_WATCH_ACCESS, record,
+                           &seen);
+        REQUIRE(ids[i] >= 0);
+    }
+    REQUIRE(x16_watch(machine, 0, 0, X16_WATCH_READ, record, &seen) == -1);
+    for (int id : ids) {
+        x16_unwatch(machine, id);
+    }
+    x16_unwatch(machine, ids[0]);
+    REQUIRE(x16_direct_memory(machine));
+    x16_run(machine, 0);
+    REQUIRE(seen.empty());
+    x16_free(machine);
+}
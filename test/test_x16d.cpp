@@ -0,0 +1,117 @@
+#include "catch.hpp"
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// Object file of a program that echoes two characters and halts:
+// getc, putc, getc, putc, halt
+static const uint8_t ECHO_IMAGE[] = {
+    0x30, 0x00,  // origin
+    0xf0, 0x20, 0xf0, 0x21, 0xf0, 0x20, 0xf0, 0x21, 0xf0, 0x25,
+};
+
+static const char* SOCKET = "/tmp/test_x16d.sock";
+
+// Runs the daemon for the lifetime of a test, even one that fails
+struct Daemon {
+    pid_t pid;
+
+    Daemon() {
+        pid = fork();
+        if (pid == 0) {
+            freopen("/dev/null", "w", stdout);
+            execl("./x16d", "x16d", "-j", "2", SOCKET, (char*) NULL);
+            _exit(127);
+        }
+    }
+
+    ~Daemon() {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+};
+
+// Connect to the daemon, retrying while it starts up
+static FILE* connect_daemon() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKET);
+    for (int tries = 0; tries < 200; tries++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) == 0) {
+            return fdopen(fd, "r+");
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return NULL;
+}
+
+// Send a request line and payload, and read back the reply line
+static std::string request(FILE* fp, const std::string& line,
+                           const std::string& payload) {
+    fprintf(fp, "%s\n", line.c_str());
+    fwrite(payload.data(), 1, payload.size(), fp);
+    fflush(fp);
+    char reply[256];
+    REQUIRE(fgets(reply, sizeof(reply), fp) != NULL);
+    return std::string(reply);
+}
+
+// Read the output that follows a RUN reply
+static std::string read_output(FILE* fp, const std::string& reply) {
+    size_t len = std::stoul(reply.substr(reply.rfind(' ') + 1));
+    std::string out(len, '\0');
+    REQUIRE(fread(&out[0], 1, len, fp) == len);
+    return out;
+}
+
+TEST_CASE("X16d.run", "[x16d]") {
+    Daemon daemon;
+    FILE* fp = connect_daemon();
+    REQUIRE(fp != NULL);
+
+    std::string image((const char*) ECHO_IMAGE, sizeof(ECHO_IMAGE));
+    std::string loaded = request(fp, "LOAD " + std::to_string(image.size()),
+                                 image);
+    REQUIRE(loaded.substr(0, 3) == "OK ");
+    std::string hash = loaded.substr(3, 16);
+
+    // The same machine is reused for every job, starting fresh each time
+    for (int i = 0; i < 3; i++) {
+        std::string reply = request(fp, "RUN " + hash + " 0 2", "hi");
+        REQUIRE(reply ==
+                "OK halt 5 105 0 0 0 0 0 0 0 12293 1 8\n");
+        REQUIRE(read_output(fp, reply) == "hiHALT\n\n");
+    }
+
+    std::string reply = request(fp, "RUN " + hash + " 2 2", "hi");
+    REQUIRE(reply.substr(0, 16) == "OK limit 2 104 0");
+    REQUIRE(read_output(fp, reply) == "h");
+
+    reply = request(fp, "RUN " + hash + " 0 1", "x");
+    REQUIRE(reply.substr(0, 12) == "OK eof 3 120");
+    REQUIRE(read_output(fp, reply) == "x");
+
+    REQUIRE(request(fp, "RUN 0123456789abcdef 0 0", "") ==
+            "ERR unknown image\n");
+
+    // An invalid instruction ends the job, not the daemon
+    std::string bad("\x30\x00\x80\x00", 4);
+    loaded = request(fp, "LOAD 4", bad);
+    REQUIRE(loaded.substr(0, 3) == "OK ");
+    reply = request(fp, "RUN " + loaded.substr(3, 16) + " 0 0", "");
+    REQUIRE(reply == "OK fault 0 0 0 0 0 0 0 0 0 12288 2 0\n");
+    reply = request(fp, "RUN " + hash + " 0 2", "hi");
+    REQUIRE(reply.substr(0, 8) == "OK halt ");
+    REQUIRE(read_output(fp, reply) == "hiHALT\n\n");
+
+    fclose(fp);
+}
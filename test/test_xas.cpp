@@ -1,7 +1,16 @@
 #include "catch.hpp"
+#include <fstream>
 #include <iostream>
+#include <sstream>
 using namespace std;
 
+static string read_file(const char* path) {
+    ifstream in(path);
+    stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
 // Test a simple one line case
 TEST_CASE("Xas.simple", "[xas]") {
     cout << "Testing simple one line assembler...";
@@ -130,3 +139,170 @@ TEST_CASE("Xas.error.imm", "[xas]") {
 
     cout << "Passed" << endl;
 }
+
+// Test reassembling with a cache after edits
+TEST_CASE("Xas.cache", "[xas]") {
+    cout << "Testing incremental assembly with a cache... ";
+
+    // An edit at the top moves every label, one in the loop moves only the
+    // labels after it; the output is always that of a clean build
+    int rv = system("rm -rf xas-cache && mkdir xas-cache"
+                    " && cp test/samples/loop.x16s xas-cache/p.x16s"
+                    " && ./xas -k xas-cache/k -o xas-cache/warm.obj"
+                    " xas-cache/p.x16s > /dev/null"
+                    " && sed -i '1i\\        add %r2, %r2, $1' xas-cache/p.x16s"
+                    " && ./xas -k xas-cache/k -o xas-cache/warm.obj"
+                    " xas-cache/p.x16s > /dev/null"
+                    " && ./xas -o xas-cache/clean.obj xas-cache/p.x16s"
+                    " > /dev/null"
+                    " && cmp xas-cache/warm.obj xas-cache/clean.obj"
+                    " && sed -i '4i\\        val $7' xas-cache/p.x16s"
+                    " && ./xas -k xas-cache/k -o xas-cache/warm.obj"
+                    " xas-cache/p.x16s > /dev/null"
+                    " && ./xas -o xas-cache/clean.obj xas-cache/p.x16s"
+                    " > /dev/null"
+                    " && cmp xas-cache/warm.obj xas-cache/clean.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // A cache cut short is used as far as it goes
+    rv = system("head -c 60 xas-cache/k > xas-cache/short"
+                " && mv xas-cache/short xas-cache/k"
+                " && ./xas -k xas-cache/k -o xas-cache/warm.obj"
+                " xas-cache/p.x16s > /dev/null"
+                " && cmp xas-cache/warm.obj xas-cache/clean.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    system("rm -rf xas-cache");
+
+    cout << "Passed" << endl;
+}
+
+// Test labels out of reach of the offset of an instruction
+TEST_CASE("Xas.relax", "[xas]") {
+    cout << "Testing long forms of far branches in assembler... ";
+
+    // A conditional branch, a JSR and loads over 1100 words of data
+    std::ofstream out("xas-far.x16s");
+    out << "begin:\n  and %r1, %r1, $0\n  brz forward\n  halt\n"
+        << "backward:\n  ld %r0, star\n  putc\n  lea %r2, star\n"
+        << "  ldr %r0, %r2, $0\n  putc\n  jsr sub\n  halt\n";
+    for (int i = 0; i < 1100; i++) {
+        out << "  val $0\n";
+    }
+    out << "forward:\n  br backward\n"
+        << "sub:\n  add %r0, %r0, $1\n  putc\n  ret\n"
+        << "star:\n  val $42\n";
+    out.close();
+
+    int rv = system("./xas -r 5 -o xas-far.obj xas-far.x16s > /dev/null"
+                    " && ./xod xas-far.obj | grep -q 'jsrr   %r5'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    rv = system("./x16 --headless -i /dev/null xas-far.obj > xas-far.out");
+    REQUIRE(read_file("xas-far.out").compare(0, 3, "**+") == 0);
+
+    // Each line that overwrites the scratch register says so
+    rv = system("./xas -r 5 -o xas-far.obj xas-far.x16s"
+                " | grep -c 'overwrites %r5 and the condition codes'"
+                " | grep -q '^3$'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // %r7 cannot hold the target of a JSRR
+    rv = system("./xas -r 7 xas-far.x16s 2> /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 1);
+
+    // Far stores leave %r6 as it was
+    out.open("xas-far.x16s");
+    out << "begin:\n  and %r6, %r6, $0\n  add %r6, %r6, $5\n"
+        << "  ld %r0, zero\n  st %r0, far\n  sti %r6, farptr\n"
+        << "  add %r0, %r0, %r6\n  putc\n  ld %r0, far\n  putc\n"
+        << "  ld %r0, far+1\n  add %r0, %r0, %r6\n  putc\n  halt\n"
+        << "zero:\n  val '0'\n  .blkw 600\nfar:\n  val 0\n  val '0'\n"
+        << "farptr:\n  val far+1\n";
+    out.close();
+    rv = system("./xas -o xas-far.obj xas-far.x16s"
+                " | grep -q 'WARNING: line 6: sti to a far label changes'"
+                " && ./x16 --headless -i /dev/null xas-far.obj > xas-far.out");
+    REQUIRE(read_file("xas-far.out").compare(0, 3, "50\n") == 0);
+    remove("xas-far.x16s");
+    remove("xas-far.obj");
+    remove("xas-far.out");
+
+    cout << "Passed" << endl;
+}
+
+TEST_CASE("Xas.macro", "[xas]") {
+    cout << "Testing macros and constants in assembler... ";
+
+    int rv = system("./xas -g -o xas-macro.obj test/samples/macro.x16s"
+                    " > /dev/null"
+                    " && ./x16 --headless -i /dev/null xas-macro.obj"
+                    " > xas-macro.out");
+    REQUIRE(read_file("xas-macro.out").compare(0, 6, "***AA4") == 0);
+    // Expanded lines are at the line of the macro use
+    rv = system("./xod xas-macro.obj"
+                " | grep -q 'and    %r1, %r1, $0  # line 24'"
+                " && ./xod xas-macro.obj | grep -q '^again1:'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // LEN depends on labels, so -O would change it
+    rv = system("./xas -O -o xas-macro.obj test/samples/macro.x16s"
+                " | grep -q 'Not optimizing'");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    std::ofstream out("xas-macro.x16s");
+    out << ".macro two a, b\n  add \\a, \\a, \\b\n.endm\n  two %r1, $1, $2\n";
+    out.close();
+    rv = system("./xas -o xas-macro.obj xas-macro.x16s > /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 2);
+    out.open("xas-macro.x16s");
+    out << ".equ A, B + 1\n.equ B, A\n  halt\n";
+    out.close();
+    rv = system("./xas -o xas-macro.obj xas-macro.x16s > /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 2);
+    remove("xas-macro.x16s");
+    remove("xas-macro.obj");
+    remove("xas-macro.out");
+
+    cout << "Passed" << endl;
+}
+
+TEST_CASE("Xas.data", "[xas]") {
+    cout << "Testing data directives in assembler... ";
+
+    std::ofstream bin("xas-data.bin");
+    bin << "\x12\x34\x56";
+    bin.close();
+    // The block puts msg out of reach of the first lea
+    std::ofstream out("xas-data.x16s");
+    out << ".equ N, 3\n"
+        << "start:\n  lea %r0, msg\n  puts\n  lea %r0, packed\n  putsp\n"
+        << "  ld %r0, table+2\n  putc\n  halt\n"
+        << "  .blkw N*100, 0xffff\n"
+        << "msg:\n  .stringz \"# \\\"x\\\"\\n\"\n"
+        << "packed:\n  .packed \"abc\"\n"
+        << "table:\n  .fill 'A', 'B', N+'0', end-table\n"
+        << "bin:\n  .incbin \"xas-data.bin\"\nend:\n";
+    out.close();
+    int rv = system("./xas -o xas-data.obj xas-data.x16s > /dev/null"
+                    " && ./x16 --headless -i /dev/null xas-data.obj"
+                    " > xas-data.out");
+    REQUIRE(read_file("xas-data.out").compare(0, 10, "# \"x\"\nabc3") == 0);
+    // end-table, then the bytes of the file
+    rv = system("./xod xas-data.obj > xas-data.out"
+                " && grep -q '^0x3147: 0000 0000 0000 0110' xas-data.out"
+                " && grep -q '^0x3148: 0001 0010 0011 0100' xas-data.out"
+                " && grep -q '^0x3149: 0101 0110 0000 0000' xas-data.out");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // The size of a block must be known before it
+    out.open("xas-data.x16s");
+    out << "  .blkw later\nlater:\n  halt\n";
+    out.close();
+    rv = system("./xas -o xas-data.obj xas-data.x16s > /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 2);
+    remove("xas-data.bin");
+    remove("xas-data.x16s");
+    remove("xas-data.obj");
+    remove("xas-data.out");
+
+    cout << "Passed" << endl;
+}
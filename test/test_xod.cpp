@@ -0,0 +1,67 @@
+#include "catch.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static std::string read_file(const char* path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// Images for the tests, assembled into xod-in/
+static void make_images() {
+    int rv = system("rm -rf xod-in xod-out && mkdir xod-in xod-out"
+                    " && ./xas test/samples/loop.x16s > /dev/null"
+                    " && mv a.obj xod-in/loop.obj"
+                    " && ./xas test/samples/all.x16s > /dev/null"
+                    " && mv a.obj xod-in/all.obj"
+                    " && ./xas giza.x16s > /dev/null"
+                    " && mv a.obj xod-in/giza.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+}
+
+// Each file written in parallel is what xod writes for the image alone
+TEST_CASE("Xod.parallel", "[xod]") {
+    make_images();
+    int rv = system("./xod -j 3 -o xod-out xod-in/loop.obj xod-in/all.obj"
+                    " xod-in/giza.obj");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    for (const char* name : {"loop", "all", "giza"}) {
+        std::string cmd = std::string("./xod xod-in/") + name +
+                          ".obj | cmp - xod-out/" + name + ".lst";
+        rv = system(cmd.c_str());
+        REQUIRE(WEXITSTATUS(rv) == 0);
+    }
+
+    rv = system("./xod -j 2 -a -o xod-out xod-in/giza.obj"
+                " && ./xod -a xod-in/giza.obj | cmp - xod-out/giza.x16s");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+
+    // A bad image fails on its own
+    rv = system("./xod -j 2 -o xod-out xod-in/missing.obj xod-in/loop.obj"
+                " 2> /dev/null");
+    REQUIRE(WEXITSTATUS(rv) == 2);
+    REQUIRE(read_file("xod-out/loop.lst").compare(0, 15, "Origin: 0x3000\n")
+            == 0);
+    system("rm -rf xod-in xod-out");
+}
+
+TEST_CASE("Xod.summary", "[xod]") {
+    make_images();
+    int rv = system("./xod -s -j 2 xod-in/loop.obj xod-in/giza.obj"
+                    " > xod-out/summary.csv");
+    REQUIRE(WEXITSTATUS(rv) == 0);
+    std::string csv = read_file("xod-out/summary.csv");
+    REQUIRE(csv.compare(0, 18, "image,words,br,add") == 0);
+    // Rows are in the order given. giza.x16s has add, enter, ld, putc,
+    // add, brz, jsr and halt, and two values that decode as br.
+    size_t giza = csv.find("xod-in/giza.obj");
+    REQUIRE(csv.find("xod-in/loop.obj") < giza);
+    REQUIRE(csv.substr(giza) ==
+            "xod-in/giza.obj,10,3,2,1,0,1,0,0,0,0,0,0,0,0,0,0,3\n");
+    system("rm -rf xod-in xod-out");
+}
@@ -8,9 +8,11 @@
 #include "bits.h"
 #include "control.h"
 #include "instruction.h"
+#include "io.h"
 
 int trap(x16_t* machine, uint16_t instruction) {
   uint16_t vec = getbits(instruction, 0, 8);
+  io_t* io = x16_io(machine);
   uint16_t* ptr;
   uint16_t c;
   int key;
@@ -20,13 +22,18 @@ int trap(x16_t* machine, uint16_t instruction) {
     case TRAP_GETC:
       // TRAP GETC
       // read a single ASCII char and put it in R0
-      // We do this by calling getchar, and setting the data to be
+      // We do this by reading from the console, and setting the data to be
       // in the memory data register. It will get moved to R0 in the
       // WB stage.
-      key = getchar();
-      if (key == EOF) {
-        perror("Getchar error");
-        abort();
+      key = x16_getc(machine);
+      if (key == IO_WAIT) {
+        // Suspend until the host feeds more input
+        x16_rewind(machine);
+        return 1;
+      }
+      if (key == IO_EOF) {
+        // No more input will ever arrive, so stop the machine
+        return -1;
       }
       x16_set(machine, R_R0, (uint16_t)key);
       update_cond(machine, R_R0);
@@ -36,8 +43,8 @@ int trap(x16_t* machine, uint16_t instruction) {
       // TRAP OUT
       // Write a single char in R0 to output
       c = x16_reg(machine, R_R0);
-      putchar((char)c);
-      fflush(stdout);
+      io_putc(io, (char)c);
+      io_flush(io);
       break;
 
     case TRAP_PUTS:
@@ -46,18 +53,34 @@ int trap(x16_t* machine, uint16_t instruction) {
       base = x16_reg(machine, R_R0);
       char c = (char)x16_memread(machine, base);
       while (c != '\0') {
-        putc(c, stdout);
+        io_putc(io, c);
         c = (char)x16_memread(machine, ++base);
       }
-      fflush(stdout);
+      io_flush(io);
       break;
 
     case TRAP_IN:
-      // Read and echo a character, put it in R0
-      printf("Enter a character: ");
-      c = getchar();
-      putc(c, stdout);
-      fflush(stdout);
+      // Read and echo a character, put it in R0. The prompt is shown once,
+      // not again when IN runs again after waiting for input.
+      if (!io->headless && !io->prompted) {
+        io_puts(io, "Enter a character: ");
+        io_flush(io);
+      }
+      key = x16_getc(machine);
+      if (key == IO_WAIT) {
+        // Suspend until the host feeds more input
+        io->prompted = true;
+        x16_rewind(machine);
+        return 1;
+      }
+      io->prompted = false;
+      if (key == IO_EOF) {
+        // No more input will ever arrive, so stop the machine
+        return -1;
+      }
+      c = (uint16_t)key;
+      io_putc(io, c);
+      io_flush(io);
       // Setting the data to be in the memory data register.
       // It will get moved to R0 in the WB stage.
       x16_set(machine, R_R0, c);
@@ -72,26 +95,25 @@ int trap(x16_t* machine, uint16_t instruction) {
       for (int val = x16_memread(machine, base);
            (val = x16_memread(machine, base)) != 0; base++) {
         char char1 = (val) & 0xff;
-        putc(char1, stdout);
-        fprintf(stderr, "Putting %c\n", char1);
+        io_putc(io, char1);
         char char2 = (val) >> 8;
         if (char2) {
-          putc(char2, stdout);
-          fprintf(stderr, "Putting %c\n", char2);
+          io_putc(io, char2);
         }
       }
-      fflush(stdout);
+      io_flush(io);
       break;
 
     case TRAP_HALT:
       // TRAP HALT
-      puts("HALT\n");
-      fflush(stdout);
+      io_puts(io, "HALT\n\n");
+      io_flush(io);
       return -1;
 
     default:
-      // Bad trap vector
-      abort();
+      // Bad trap vector, the guest faults at the trap
+      x16_rewind(machine);
+      return -2;
   }
 
   return 0;
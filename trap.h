@@ -13,7 +13,10 @@ typedef enum {
   TRAP_HALT = 0x25    // halt the program
 } trap_t;
 
-// Service the trap instruction. Return -1 to halt or 0 to continue
+// Service the trap instruction. Return -1 to halt, 0 to continue, 1 if
+// the trap has to wait for input, or -2 for a vector that is not a trap.
+// A waiting trap leaves the machine at the trap instruction, so executing
+// it again once input is fed resumes it; so does a bad one.
 int trap(x16_t* machine, uint16_t instruction);
 
 #endif  // TRAP_H_
@@ -4,13 +4,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
-#include <unistd.h>
+#include <time.h>
 
+#include "history.h"
 #include "instruction.h"
 
-int LOG = 0;
-FILE* LOGFP = NULL;
+// Words per page of the watched page map
+#define WATCH_PAGE_BITS 8
+
+// A watchpoint on a range of addresses
+typedef struct {
+  uint16_t first;
+  uint16_t last;
+  x16_watch_t kind;  // 0 if the slot is free
+  x16_watch_fn fn;
+  void* arg;
+} watch_t;
 
 // The X16 machine
 typedef struct x16 {
@@ -20,25 +29,89 @@ typedef struct x16 {
 
   // The register file contains R0-R7, PC and condition registers
   uint16_t registers[MAX_REGISTERS];
+
+  // The console used by the keyboard registers and the traps
+  io_t io;
+
+  // Set when a keyboard poll finds the input ended for good
+  bool input_ended;
+
+  // Number of instructions executed so far
+  uint64_t icount;
+
+  // Session log of the console input
+  record_t rec;
+
+  // Instruction count at which the countdown timer expires
+  uint64_t timer_deadline;
+
+  // Edge coverage counters, if collected, and the previous location
+  uint8_t* coverage;
+  uint16_t prev_loc;
+
+  // Set when the instruction at rewound_pc was fetched, counted and then
+  // rewound, so fetching it again is not another edge
+  bool rewound;
+  uint16_t rewound_pc;
+
+  // History for going back in time, if kept
+  history_t* history;
+
+  // Watchpoints, and for each page the kinds of access watched on it, so
+  // that accesses to other pages cost a single load
+  watch_t watches[X16_MAX_WATCHES];
+  int nwatches;
+  uint8_t watched[MAX_MEMORY >> WATCH_PAGE_BITS];
+
+  // Pacing: target instructions per second (0 for full speed), the
+  // instruction count of the next pacing check, and the instruction count
+  // and wall clock time pacing started at
+  uint32_t pace_ips;
+  uint64_t pace_next;
+  uint64_t pace_start_count;
+  struct timespec pace_start;
 } x16_t;
 
+// A copy of the architectural state of a machine
+typedef struct x16_snapshot {
+  uint16_t memory[MAX_MEMORY];
+  uint16_t registers[MAX_REGISTERS];
+  uint64_t icount;
+  uint64_t timer_deadline;
+} x16_snapshot_t;
+
 // Special location in memory for memory mapped registers
 typedef enum {
   MR_KBSR = 0xfe00,  // keyboard status
-  MR_KBDR = 0xfe02   // keyboard data
+  MR_KBDR = 0xfe02,  // keyboard data
+  MR_CLKL = 0xfe08,  // virtual clock, low word. Reading it latches MR_CLKH
+  MR_CLKH = 0xfe0a,  // virtual clock, high word
+  MR_TMR = 0xfe0c    // countdown timer, in instructions
 } mmap_reg_t;
 
+// Number of pacing checks per second of guest time
+#define PACE_CHECKS_PER_SEC 1000
+
 // Initialize the x16 machine
 x16_t* x16_create() {
   x16_t* machine = (x16_t*)malloc(sizeof(x16_t));
   memset(machine, 0, sizeof(x16_t));
   x16_set(machine, R_PC, DEFAULT_CODESTART);  // default PC start
   x16_set(machine, R_COND, FL_ZRO);           // default last code is 0
+  io_init(&machine->io);
   return machine;
 }
 
 // Free the memory consumed by the machine
-void x16_free(x16_t* machine) { free(machine); }
+void x16_free(x16_t* machine) {
+  restore_input_buffering(&machine->io);
+  record_stop(&machine->rec);
+  io_free(&machine->io);
+  if (machine->history != NULL) {
+    history_free(machine->history);
+  }
+  free(machine);
+}
 
 // Get the program counter
 uint16_t x16_pc(x16_t* machine) { return x16_reg(machine, R_PC); }
@@ -54,39 +127,296 @@ void x16_set(x16_t* machine, reg_t reg, uint16_t value) {
   machine->registers[reg] = value;
 }
 
-// Check Key
-static uint16_t check_key() {
-  fd_set readfds;
-  FD_ZERO(&readfds);
-  FD_SET(STDIN_FILENO, &readfds);
+// Set the execution trace file
+void x16_set_log(x16_t* machine, FILE* fp) { machine->io.log_fp = fp; }
+
+// Get the execution trace file
+FILE* x16_log(x16_t* machine) { return machine->io.log_fp; }
+
+// Get the register file
+uint16_t* x16_registers(x16_t* machine) { return machine->registers; }
+
+// Get the console of the machine
+io_t* x16_io(x16_t* machine) { return &machine->io; }
+
+// Read a character for GETC/IN
+int x16_getc(x16_t* machine) {
+  return record_getc(&machine->rec, &machine->io, machine->icount);
+}
+
+// Did the current instruction find the input ended
+bool x16_input_ended(x16_t* machine) {
+  bool ended = machine->input_ended;
+  machine->input_ended = false;
+  return ended;
+}
+
+// Get the instruction count
+uint64_t x16_icount(x16_t* machine) { return machine->icount; }
+
+// Nanoseconds between two points in time
+static int64_t elapsed_ns(const struct timespec* from,
+                          const struct timespec* to) {
+  return (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 +
+         (to->tv_nsec - from->tv_nsec);
+}
+
+// Sleep until the wall clock catches up with the instructions executed
+// since pacing started
+static void pace(x16_t* machine) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t executed = machine->icount - machine->pace_start_count;
+  // Split so the product stays within 64 bits however long the run
+  uint64_t ips = machine->pace_ips;
+  int64_t due = (int64_t)(executed / ips * 1000000000 +
+                          executed % ips * 1000000000 / ips);
+  int64_t ahead = due - elapsed_ns(&machine->pace_start, &now);
+  if (ahead > 0) {
+    struct timespec delay;
+    delay.tv_sec = ahead / 1000000000;
+    delay.tv_nsec = ahead % 1000000000;
+    nanosleep(&delay, NULL);
+  }
+  uint64_t interval = machine->pace_ips / PACE_CHECKS_PER_SEC;
+  machine->pace_next = machine->icount + (interval > 0 ? interval : 1);
+}
+
+// Count an instruction. Unpaced machines never reach pace_next, since it
+// stays 0 and the count starts at 1.
+void x16_tick(x16_t* machine) {
+  if (machine->history != NULL) {
+    history_step(machine->history, machine);
+  }
+  if (++machine->icount == machine->pace_next) {
+    pace(machine);
+  }
+}
+
+// Start or stop collecting edge coverage
+void x16_set_coverage(x16_t* machine, uint8_t* map) {
+  machine->coverage = map;
+  machine->prev_loc = 0;
+}
+
+// Count the edge from the previous instruction to this one. Addresses are
+// scattered first, as neighbouring instructions would share most edges
+// otherwise, and the previous location is shifted so that A -> B and
+// B -> A are different edges.
+void x16_cover(x16_t* machine, uint16_t pc) {
+  if (machine->rewound) {
+    machine->rewound = false;
+    if (pc == machine->rewound_pc) {
+      return;
+    }
+  }
+  if (machine->coverage != NULL) {
+    uint16_t loc = pc * 40503;
+    machine->coverage[machine->prev_loc ^ loc]++;
+    machine->prev_loc = loc >> 1;
+  }
+}
+
+// Undo the fetch of the current instruction
+void x16_rewind(x16_t* machine) {
+  machine->registers[R_PC]--;
+  machine->icount--;
+  machine->rewound = true;
+  machine->rewound_pc = machine->registers[R_PC];
+  if (machine->history != NULL) {
+    history_unstep(machine->history, machine->icount);
+  }
+}
+
+// Set the instruction count
+void x16_set_icount(x16_t* machine, uint64_t count) {
+  machine->icount = count;
+}
+
+// Start or stop keeping history
+void x16_set_history(x16_t* machine, size_t budget) {
+  if (machine->history != NULL) {
+    history_free(machine->history);
+    machine->history = NULL;
+  }
+  if (budget > 0) {
+    machine->history = history_create(budget, machine->icount);
+  }
+}
+
+// Get the earliest instruction count the machine can go back to
+uint64_t x16_history_start(x16_t* machine) {
+  return machine->history != NULL ? history_start(machine->history)
+                                  : machine->icount;
+}
+
+// Go back to the given instruction count
+int x16_travel(x16_t* machine, uint64_t count) {
+  if (machine->history == NULL) {
+    return count == machine->icount ? 0 : -1;
+  }
+  return history_travel(machine->history, machine, count);
+}
+
+// Work out which kinds of access are watched on each page
+static void update_watched(x16_t* machine) {
+  memset(machine->watched, 0, sizeof(machine->watched));
+  for (int i = 0; i < X16_MAX_WATCHES; i++) {
+    watch_t* w = &machine->watches[i];
+    if (w->kind != 0) {
+      for (int page = w->first >> WATCH_PAGE_BITS;
+           page <= w->last >> WATCH_PAGE_BITS; page++) {
+        machine->watched[page] |= w->kind;
+      }
+    }
+  }
+}
+
+// Add a watchpoint
+int x16_watch(x16_t* machine, uint16_t first, uint16_t last,
+              x16_watch_t kind, x16_watch_fn fn, void* arg) {
+  for (int i = 0; i < X16_MAX_WATCHES; i++) {
+    watch_t* w = &machine->watches[i];
+    if (w->kind == 0) {
+      w->first = first;
+      w->last = last;
+      w->kind = kind;
+      w->fn = fn;
+      w->arg = arg;
+      machine->nwatches++;
+      update_watched(machine);
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Remove a watchpoint
+void x16_unwatch(x16_t* machine, int id) {
+  if (id >= 0 && id < X16_MAX_WATCHES && machine->watches[id].kind != 0) {
+    machine->watches[id].kind = 0;
+    machine->nwatches--;
+    update_watched(machine);
+  }
+}
+
+// Call the watchpoints on a watched page that cover an access
+static void notify_watches(x16_t* machine, uint16_t address, uint16_t value,
+                           x16_watch_t kind) {
+  for (int i = 0; i < X16_MAX_WATCHES; i++) {
+    watch_t* w = &machine->watches[i];
+    if ((w->kind & kind) && address >= w->first && address <= w->last) {
+      w->fn(machine, address, value, kind, w->arg);
+    }
+  }
+}
+
+// Can plain memory be accessed without x16_memread/x16_memwrite
+bool x16_direct_memory(x16_t* machine) {
+  return machine->history == NULL && machine->nwatches == 0;
+}
+
+// Set the pacing rate
+void x16_set_pace(x16_t* machine, uint32_t ips) {
+  machine->pace_ips = ips;
+  machine->pace_next = 0;
+  if (ips != 0) {
+    machine->pace_start_count = machine->icount;
+    clock_gettime(CLOCK_MONOTONIC, &machine->pace_start);
+    machine->pace_next = machine->icount + 1;
+  }
+}
+
+// Record the session
+int x16_record(x16_t* machine, const char* path) {
+  record_stop(&machine->rec);
+  return record_start(&machine->rec, path);
+}
 
-  struct timeval timeout;
-  timeout.tv_sec = 0;
-  timeout.tv_usec = 0;
-  return select(1, &readfds, NULL, NULL, &timeout) != 0;
+// Replay a session
+int x16_replay(x16_t* machine, const char* path) {
+  record_stop(&machine->rec);
+  return replay_start(&machine->rec, path);
 }
 
+// Did the replay diverge
+bool x16_replay_diverged(x16_t* machine) { return machine->rec.diverged; }
+
 // Read memory. Handles memory mapped registers
 uint16_t x16_memread(x16_t* machine, uint16_t address) {
   if (address == MR_KBSR) {
     // LOG = 0;
-    if (check_key()) {
+    int key;
+    if (record_key_ready(&machine->rec, &machine->io, machine->icount,
+                         &key)) {
       machine->memory[MR_KBSR] = (1 << 15);
-      machine->memory[MR_KBDR] = getchar();
+      machine->memory[MR_KBDR] = key;
+      machine->io.idle_polls = 0;
+      machine->io.eof_polls = 0;
       // printf("check_key: got %d\n", (int) machine->memory[MR_KBDR]);
       // LOG = 1;
     } else {
       machine->memory[MR_KBSR] = 0;
+      if (io_idle_poll(&machine->io,
+                       record_input_ended(&machine->rec, &machine->io))) {
+        machine->input_ended = true;
+      }
     }
+  } else if (address == MR_CLKL) {
+    machine->memory[MR_CLKL] = (uint16_t)machine->icount;
+    machine->memory[MR_CLKH] = (uint16_t)(machine->icount >> 16);
+  } else if (address == MR_TMR) {
+    uint64_t left = machine->timer_deadline > machine->icount
+                        ? machine->timer_deadline - machine->icount
+                        : 0;
+    machine->memory[MR_TMR] = left > UINT16_MAX ? UINT16_MAX : left;
+  }
+  uint16_t value = machine->memory[address];
+  if (machine->watched[address >> WATCH_PAGE_BITS] & X16_WATCH_READ) {
+    notify_watches(machine, address, value, X16_WATCH_READ);
   }
-  return machine->memory[address];
+  return value;
 }
 
-// Memory write
+// Memory write. Writing the timer register starts the countdown.
 void x16_memwrite(x16_t* machine, uint16_t address, uint16_t val) {
+  if (machine->watched[address >> WATCH_PAGE_BITS] & X16_WATCH_WRITE) {
+    notify_watches(machine, address, val, X16_WATCH_WRITE);
+  }
+  if (machine->history != NULL) {
+    history_write(machine->history, machine->icount, address,
+                  machine->memory[address]);
+  }
+  if (address == MR_TMR) {
+    machine->timer_deadline = machine->icount + val;
+  }
   machine->memory[address] = val;
 }
 
+// Take a snapshot
+x16_snapshot_t* x16_snapshot(x16_t* machine) {
+  x16_snapshot_t* snap = (x16_snapshot_t*)malloc(sizeof(x16_snapshot_t));
+  memcpy(snap->memory, machine->memory, sizeof(snap->memory));
+  memcpy(snap->registers, machine->registers, sizeof(snap->registers));
+  snap->icount = machine->icount;
+  snap->timer_deadline = machine->timer_deadline;
+  return snap;
+}
+
+// Restore a snapshot
+void x16_restore(x16_t* machine, const x16_snapshot_t* snap) {
+  memcpy(machine->memory, snap->memory, sizeof(snap->memory));
+  memcpy(machine->registers, snap->registers, sizeof(snap->registers));
+  machine->icount = snap->icount;
+  machine->timer_deadline = snap->timer_deadline;
+  if (machine->history != NULL) {
+    history_reset(machine->history, machine->icount);
+  }
+}
+
+// Free a snapshot
+void x16_snapshot_free(x16_snapshot_t* snap) { free(snap); }
+
 // Get a pointer to the 16bit word in the given offset in memoty
 uint16_t* x16_memory(x16_t* machine, uint16_t offset) {
   return &machine->memory[offset];
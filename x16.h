@@ -5,6 +5,9 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "io.h"
+#include "record.h"
+
 // Total amount of memory for 16 bit address
 #define MAX_MEMORY 65536
 
@@ -32,6 +35,9 @@ typedef enum {
 // The X16 machine
 typedef struct x16 x16_t;
 
+// A saved copy of the memory, registers and clock of a machine
+typedef struct x16_snapshot x16_snapshot_t;
+
 // Initialize and return a new x16 machine. The program counter
 // is set to the default start location DEFAULT_CODESTART
 // All registers and memory are cleared to 0
@@ -61,16 +67,125 @@ void x16_memwrite(x16_t *machine, uint16_t address, uint16_t val);
 // Get a pointer to the 16bit word in the given offset in memoty
 uint16_t *x16_memory(x16_t *machine, uint16_t offset);
 
+// Get the register file, indexed by reg_t
+uint16_t *x16_registers(x16_t *machine);
+
+// Get the console the machine reads input from and writes output to
+io_t *x16_io(x16_t *machine);
+
+// Read a character of console input for GETC/IN. Return IO_EOF when no
+// more input will arrive, or IO_WAIT when it has not arrived yet. Goes
+// through the session log, if any.
+int x16_getc(x16_t *machine);
+
+// True if the instruction being executed polled the keyboard after the
+// input ended for good (see io_idle_poll), so the machine has to stop.
+// Clears the condition.
+bool x16_input_ended(x16_t *machine);
+
+// Get the number of instructions executed so far
+uint64_t x16_icount(x16_t *machine);
+
+// Count one more executed instruction. This is the virtual clock of the
+// machine: guests read it through the clock registers, and the countdown
+// timer runs on it.
+void x16_tick(x16_t *machine);
+
+// Number of counters in an edge coverage map
+#define X16_COVERAGE_SIZE 65536
+
+// Count every edge (previous PC -> PC) the machine executes in the given
+// map of X16_COVERAGE_SIZE counters, e.g. to guide a fuzzer. NULL stops
+// collecting. The map may be shared by several machines.
+void x16_set_coverage(x16_t *machine, uint8_t *map);
+
+// Record that the instruction at pc is executed next
+void x16_cover(x16_t *machine, uint16_t pc);
+
+// Undo the fetch of the instruction being executed: the PC goes back to
+// it and it is no longer counted, so it runs again from scratch later.
+// Its edge was already covered, so fetching it again is not counted.
+void x16_rewind(x16_t *machine);
+
+// Set the instruction count, e.g. when going back in time
+void x16_set_icount(x16_t *machine, uint64_t count);
+
+// Keep history within about budget bytes, so the machine can go back to
+// recent instruction counts (see history.h). 0 stops keeping history.
+void x16_set_history(x16_t *machine, size_t budget);
+
+// Get the earliest instruction count the machine can go back to
+uint64_t x16_history_start(x16_t *machine);
+
+// Go back to the state at the given instruction count. Return 0 on
+// success or -1 if it is not in the history.
+int x16_travel(x16_t *machine, uint64_t count);
+
+// Most watchpoints a machine can have at once
+#define X16_MAX_WATCHES 16
+
+// Kinds of memory access a watchpoint triggers on
+typedef enum {
+  X16_WATCH_READ = 1,
+  X16_WATCH_WRITE = 2,
+  X16_WATCH_ACCESS = 3  // either
+} x16_watch_t;
+
+// Called on an access to a watched address through x16_memread, after
+// the read with the value read, or through x16_memwrite, before the write
+// with the value about to be written. Instruction fetches are reads too.
+typedef void (*x16_watch_fn)(x16_t *machine, uint16_t address,
+                             uint16_t value, x16_watch_t kind, void *arg);
+
+// Watch the addresses from first to last, inclusive. Return an id for
+// x16_unwatch, or -1 if the machine has X16_MAX_WATCHES already.
+int x16_watch(x16_t *machine, uint16_t first, uint16_t last,
+              x16_watch_t kind, x16_watch_fn fn, void *arg);
+
+// Remove a watchpoint
+void x16_unwatch(x16_t *machine, int id);
+
+// True if plain memory (below the memory mapped registers) may be read and
+// written directly, without going through x16_memread/x16_memwrite
+bool x16_direct_memory(x16_t *machine);
+
+// Pace the machine to run the given number of instructions per second of
+// wall clock time, sleeping as needed. 0 runs at full speed.
+void x16_set_pace(x16_t *machine, uint32_t ips);
+
+// Log every console input of the session to the given file. Return 0 on
+// success or -1 for failure
+int x16_record(x16_t *machine, const char *path);
+
+// Take all console input from a log written by x16_record instead of the
+// console. Return 0 on success or -1 for failure
+int x16_replay(x16_t *machine, const char *path);
+
+// True if the guest asked for input at a point where the replayed
+// session did not
+bool x16_replay_diverged(x16_t *machine);
+
+// Log each executed instruction to the given file, or stop logging if it
+// is NULL. The file is not closed by the machine.
+void x16_set_log(x16_t *machine, FILE *fp);
+
+// Get the file instructions are logged to, or NULL
+FILE *x16_log(x16_t *machine);
+
+// Save the memory, registers and clock of the machine. The console and
+// session log are not part of the snapshot.
+x16_snapshot_t *x16_snapshot(x16_t *machine);
+
+// Put the machine back in the state saved in the snapshot
+void x16_restore(x16_t *machine, const x16_snapshot_t *snap);
+
+// Free a snapshot
+void x16_snapshot_free(x16_snapshot_t *snap);
+
 // Dump X16
 void x16_print(x16_t *machine);
 
 // Execute one single instruction. Return 0 on success or -1 for HALT
 int x16_exec(x16_t *machine);
 
-// This variable is set to 1 to turn on logging at each instruction execution
-extern int LOG;
-
-// The file to log to
-extern FILE *LOGFP;
-
 #endif  // X16_H_
@@ -0,0 +1,300 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "io.h"
+#include "loader.h"
+#include "object.h"
+#include "x16.h"
+
+// x16d runs jobs for clients on a Unix domain socket. Images stay
+// resident in the image cache, identified by their content hash, and each
+// image keeps a pool of machines that already have it loaded.
+//
+// Requests and replies are a line of text, optionally followed by a
+// payload of the length given in the line:
+//
+//   LOAD <len>\n<object file>       -> OK <hash>\n
+//   RUN <hash> <limit> <len>\n<input>
+//     -> OK <reason> <count> <r0> .. <r7> <pc> <cond> <len>\n<output>
+//
+// Hashes are 16 hex digits. A limit of 0 uses the default limit. The
+// reason is halt, eof, fault or limit. Errors are reported as
+// ERR <message>\n.
+
+#define LINESIZE 256
+
+// Largest input of a job
+#define MAX_INPUT (1 << 20)
+
+// Instructions a job may run when it does not give a limit
+#define DEFAULT_LIMIT 100000000
+
+// The idle machines that have an image loaded
+typedef struct pool {
+  const image_t* image;
+  x16_snapshot_t* start;  // state right after loading
+  x16_t** idle;
+  int nidle;
+  int cap;
+  struct pool* next;
+} pool_t;
+
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static pool_t* pools = NULL;
+static uint64_t default_limit = DEFAULT_LIMIT;
+static const char* socket_path = NULL;
+
+// Find the pool of an image. Called with pools_lock held.
+static pool_t* find_pool(uint64_t hash) {
+  for (pool_t* pool = pools; pool != NULL; pool = pool->next) {
+    if (pool->image->hash == hash) {
+      return pool;
+    }
+  }
+  return NULL;
+}
+
+// Make a cached image resident by giving it a pool
+static void add_pool(const image_t* image) {
+  pthread_mutex_lock(&pools_lock);
+  if (find_pool(image->hash) == NULL) {
+    x16_t* machine = x16_create();
+    image_place(machine, image);
+    pool_t* pool = (pool_t*)calloc(1, sizeof(pool_t));
+    pool->image = image;
+    pool->start = x16_snapshot(machine);
+    pool->next = pools;
+    pools = pool;
+    x16_free(machine);
+  }
+  pthread_mutex_unlock(&pools_lock);
+}
+
+// Get a machine in the start state of the image, from the pool if one is
+// idle. Return NULL if the image is not resident.
+static x16_t* acquire(uint64_t hash, pool_t** poolp) {
+  pthread_mutex_lock(&pools_lock);
+  pool_t* pool = find_pool(hash);
+  x16_t* machine = NULL;
+  if (pool != NULL && pool->nidle > 0) {
+    machine = pool->idle[--pool->nidle];
+  }
+  pthread_mutex_unlock(&pools_lock);
+  if (pool == NULL) {
+    return NULL;
+  }
+  if (machine == NULL) {
+    machine = x16_create();
+    io_set_headless(x16_io(machine));
+  }
+  // Snapshots are never freed, so this is safe without the lock
+  x16_restore(machine, pool->start);
+  *poolp = pool;
+  return machine;
+}
+
+// Put a machine back in the pool of its image
+static void release(pool_t* pool, x16_t* machine) {
+  pthread_mutex_lock(&pools_lock);
+  if (pool->nidle == pool->cap) {
+    pool->cap = pool->cap == 0 ? 4 : pool->cap * 2;
+    pool->idle = (x16_t**)realloc(pool->idle, pool->cap * sizeof(x16_t*));
+  }
+  pool->idle[pool->nidle++] = machine;
+  pthread_mutex_unlock(&pools_lock);
+}
+
+// Read a payload of the given length, or return NULL
+static uint8_t* read_payload(FILE* in, size_t len) {
+  uint8_t* data = (uint8_t*)malloc(len > 0 ? len : 1);
+  if (fread(data, 1, len, in) != len) {
+    free(data);
+    return NULL;
+  }
+  return data;
+}
+
+static const char* reason_name(x16_exit_t reason) {
+  switch (reason) {
+    case X16_HALT:
+      return "halt";
+    case X16_EOF:
+      return "eof";
+    case X16_FAULT:
+      return "fault";
+    default:
+      return "limit";
+  }
+}
+
+// Run one job and write the reply
+static void run_job(FILE* out, uint64_t hash, uint64_t limit,
+                    const uint8_t* input, size_t len) {
+  pool_t* pool;
+  x16_t* machine = acquire(hash, &pool);
+  if (machine == NULL) {
+    fprintf(out, "ERR unknown image\n");
+    return;
+  }
+  io_t* io = x16_io(machine);
+  io_set_input_buffer(io, input, len);
+  io_set_output_buffer(io);
+
+  x16_exit_t reason = x16_run(machine, limit > 0 ? limit : default_limit);
+
+  size_t outlen;
+  const char* output = io_output(io, &outlen);
+  fprintf(out, "OK %s %" PRIu64, reason_name(reason), x16_icount(machine));
+  for (int i = 0; i < MAX_REGISTERS; i++) {
+    fprintf(out, " %u", (unsigned int)x16_reg(machine, (reg_t)i));
+  }
+  fprintf(out, " %zu\n", outlen);
+  fwrite(output, 1, outlen, out);
+
+  release(pool, machine);
+}
+
+// Serve the requests of one client until it disconnects
+static void serve(int fd) {
+  FILE* in = fdopen(fd, "r");
+  FILE* out = fdopen(dup(fd), "w");
+  char line[LINESIZE];
+  while (fgets(line, sizeof(line), in) != NULL) {
+    uint64_t hash, limit;
+    size_t len;
+    if (sscanf(line, "LOAD %zu", &len) == 1) {
+      uint8_t* data = len <= OBJECT_MAX_SIZE ? read_payload(in, len) : NULL;
+      if (data == NULL) {
+        fprintf(out, "ERR bad payload\n");
+        break;
+      }
+      const image_t* image = image_cache_bytes(data, len);
+      free(data);
+      if (image == NULL) {
+        fprintf(out, "ERR bad image\n");
+      } else {
+        add_pool(image);
+        fprintf(out, "OK %016" PRIx64 "\n", image->hash);
+      }
+    } else if (sscanf(line, "RUN %" SCNx64 " %" SCNu64 " %zu", &hash, &limit,
+                      &len) == 3) {
+      uint8_t* input = len <= MAX_INPUT ? read_payload(in, len) : NULL;
+      if (input == NULL) {
+        fprintf(out, "ERR bad payload\n");
+        break;
+      }
+      run_job(out, hash, limit, input, len);
+      free(input);
+    } else {
+      fprintf(out, "ERR bad request\n");
+      break;
+    }
+    fflush(out);
+  }
+  fflush(out);
+  fclose(out);
+  fclose(in);
+}
+
+// Each worker takes connections off the shared listening socket
+static void* worker_main(void* arg) {
+  int listen_fd = *(int*)arg;
+  for (;;) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) {
+      serve(fd);
+    }
+  }
+  return NULL;
+}
+
+// Load an object file from disk and print its hash
+static void preload(const char* path) {
+  const image_t* image = image_cache_file(path);
+  if (image == NULL) {
+    fprintf(stderr, "Failed to read image: %s\n", path);
+    exit(1);
+  }
+  add_pool(image);
+  printf("%016" PRIx64 " %s\n", image->hash, path);
+}
+
+static void handle_signal(int signal) {
+  unlink(socket_path);
+  _exit(0);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: x16d [-j workers] [-n limit] socket-path [image-file ...]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  int workers = 4;
+  int ch;
+  while ((ch = getopt(argc, argv, "j:n:")) != -1) {
+    switch (ch) {
+      case 'j':
+        workers = atoi(optarg);
+        break;
+
+      case 'n':
+        default_limit = strtoull(optarg, NULL, 10);
+        break;
+
+      default:
+        usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1 || workers < 1 || default_limit == 0) {
+    usage();
+  }
+  socket_path = argv[0];
+
+  for (int i = 1; i < argc; i++) {
+    preload(argv[i]);
+  }
+  fflush(stdout);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, socket_path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socket_path);
+  if (listen_fd < 0 ||
+      bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, 64) != 0) {
+    perror("x16d");
+    exit(1);
+  }
+
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t* threads = (pthread_t*)malloc(workers * sizeof(pthread_t));
+  for (int i = 0; i < workers; i++) {
+    pthread_create(&threads[i], NULL, worker_main, &listen_fd);
+  }
+  for (int i = 0; i < workers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "diff.h"
+#include "fast.h"
+#include "loader.h"
+
+// Largest input read from a file
+#define MAX_INPUT (1 << 20)
+
+static void usage() {
+  fprintf(stderr, "Usage: x16diff [-n limit] [-i input-file] image-file\n");
+  exit(1);
+}
+
+// Run an image on the reference interpreter and on the fast one, and
+// report the first point where they disagree
+int main(int argc, char** argv) {
+  uint64_t limit = 0;
+  const char* input_path = NULL;
+  int ch;
+  while ((ch = getopt(argc, argv, "n:i:")) != -1) {
+    switch (ch) {
+      case 'n':
+        limit = strtoull(optarg, NULL, 10);
+        break;
+
+      case 'i':
+        input_path = optarg;
+        break;
+
+      default:
+        usage();
+    }
+  }
+  if (optind != argc - 1) {
+    usage();
+  }
+
+  const image_t* image = image_cache_file(argv[optind]);
+  if (image == NULL) {
+    fprintf(stderr, "Failed to read image: %s\n", argv[optind]);
+    exit(1);
+  }
+
+  uint8_t* input = (uint8_t*)malloc(MAX_INPUT);
+  size_t len = 0;
+  if (input_path != NULL) {
+    FILE* fp = fopen(input_path, "rb");
+    if (fp == NULL) {
+      fprintf(stderr, "Cannot open %s\n", input_path);
+      exit(1);
+    }
+    len = fread(input, 1, MAX_INPUT, fp);
+    fclose(fp);
+  }
+
+  int rv = diff_run(image, input, len, limit, execute_instruction,
+                    fast_execute, stdout);
+  if (rv == 0) {
+    printf("Backends agree\n");
+  }
+  free(input);
+  return rv == 0 ? 0 : 2;
+}
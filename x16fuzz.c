@@ -0,0 +1,249 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "io.h"
+#include "loader.h"
+#include "x16.h"
+
+// x16fuzz fuzzes the console input of a guest program: each fuzzer input
+// is the whole input stream the guest reads through GETC, IN and the
+// keyboard registers. The image is loaded once, and every run starts
+// from a snapshot of the loaded machine. Edges between instructions of
+// the guest are counted in a coverage map.
+//
+// Built with clang -fsanitize=fuzzer -DX16_LIBFUZZER it is a libFuzzer
+// target, and the coverage map is handed to libFuzzer as extra counters.
+// The image is named by X16_FUZZ_IMAGE. Otherwise it has its own main,
+// which runs the given inputs or does simple coverage guided mutation.
+
+// Instructions a run may take before it is cut off as a hang
+#define DEFAULT_LIMIT 100000
+
+// Largest input the standalone fuzzer makes
+#define MAX_INPUT 256
+
+// Number of inputs the standalone fuzzer keeps
+#define MAX_CORPUS 1024
+
+static x16_t* machine = NULL;
+static x16_snapshot_t* start = NULL;
+static uint64_t limit = DEFAULT_LIMIT;
+
+#ifdef X16_LIBFUZZER
+__attribute__((section("__libfuzzer_extra_counters")))
+#endif
+static uint8_t coverage[X16_COVERAGE_SIZE];
+
+// Load the image and take the snapshot every run starts from
+static int fuzz_init(const char* path) {
+  machine = x16_create();
+  if (read_image(machine, path) != 0) {
+    fprintf(stderr, "Failed to read image: %s\n", path);
+    return -1;
+  }
+  io_set_headless(x16_io(machine));
+  start = x16_snapshot(machine);
+  return 0;
+}
+
+int LLVMFuzzerInitialize(int* argc, char*** argv) {
+  const char* path = getenv("X16_FUZZ_IMAGE");
+  if (path == NULL) {
+    fprintf(stderr, "Set X16_FUZZ_IMAGE to the image to fuzz\n");
+    exit(1);
+  }
+  const char* lim = getenv("X16_FUZZ_LIMIT");
+  if (lim != NULL) {
+    limit = strtoull(lim, NULL, 10);
+  }
+  if (fuzz_init(path) != 0) {
+    exit(1);
+  }
+  return 0;
+}
+
+// Run the guest on one input
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  io_t* io = x16_io(machine);
+  x16_restore(machine, start);
+  x16_set_coverage(machine, coverage);
+  io_set_input_buffer(io, data, size);
+  io_set_output_buffer(io);
+  // An invalid instruction is a crash of the guest
+  if (x16_run(machine, limit) == X16_FAULT) {
+    abort();
+  }
+  return 0;
+}
+
+#ifndef X16_LIBFUZZER
+
+// The input being run, saved if the emulator aborts on it
+static const uint8_t* current = NULL;
+static size_t current_len = 0;
+
+static void handle_abort(int signal) {
+  FILE* fp = fopen("crash.bin", "wb");
+  if (fp != NULL) {
+    fwrite(current, 1, current_len, fp);
+    fclose(fp);
+  }
+  fprintf(stderr, "Aborted, input saved to crash.bin\n");
+  _exit(1);
+}
+
+// Run an input and return the number of edges it found that no earlier
+// run took
+static int run_input(const uint8_t* data, size_t len, uint8_t* seen) {
+  current = data;
+  current_len = len;
+  LLVMFuzzerTestOneInput(data, len);
+  // Most of the map is untouched, so skip it a word at a time
+  int found = 0;
+  for (int i = 0; i < X16_COVERAGE_SIZE; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, coverage + i, sizeof(word));
+    if (word == 0) {
+      continue;
+    }
+    for (int j = i; j < i + (int)sizeof(uint64_t); j++) {
+      if (coverage[j] != 0 && !seen[j]) {
+        seen[j] = 1;
+        found++;
+      }
+    }
+    memset(coverage + i, 0, sizeof(word));
+  }
+  return found;
+}
+
+// Change an input a little: flip, replace, insert or drop a byte
+static size_t mutate(uint8_t* data, size_t len, unsigned int* seed) {
+  size_t pos = len > 0 ? rand_r(seed) % len : 0;
+  switch (rand_r(seed) % 4) {
+    case 0:
+      if (len > 0) {
+        data[pos] ^= 1 << (rand_r(seed) % 8);
+        break;
+      }
+      // fall through
+    case 1:
+      if (len < MAX_INPUT) {
+        memmove(data + pos + 1, data + pos, len - pos);
+        data[pos] = rand_r(seed);
+        return len + 1;
+      }
+      // fall through
+    case 2:
+      if (len > 0) {
+        data[pos] = rand_r(seed);
+      }
+      break;
+
+    default:
+      if (len > 0) {
+        memmove(data + pos, data + pos + 1, len - pos - 1);
+        return len - 1;
+      }
+  }
+  return len;
+}
+
+static double seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "Usage: x16fuzz [-n runs] [-s seed] [-t limit] image-file "
+          "[input-file ...]\n");
+  exit(1);
+}
+
+int main(int argc, char** argv) {
+  long runs = 100000;
+  unsigned int seed = 1;
+  int ch;
+  while ((ch = getopt(argc, argv, "n:s:t:")) != -1) {
+    switch (ch) {
+      case 'n':
+        runs = atol(optarg);
+        break;
+
+      case 's':
+        seed = atoi(optarg);
+        break;
+
+      case 't':
+        limit = strtoull(optarg, NULL, 10);
+        break;
+
+      default:
+        usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1 || fuzz_init(argv[0]) != 0) {
+    usage();
+  }
+  signal(SIGABRT, handle_abort);
+
+  uint8_t* seen = (uint8_t*)calloc(X16_COVERAGE_SIZE, 1);
+  int edges = 0;
+
+  // Replay inputs from files
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      uint8_t data[MAX_INPUT];
+      FILE* fp = fopen(argv[i], "rb");
+      if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s\n", argv[i]);
+        exit(1);
+      }
+      size_t len = fread(data, 1, sizeof(data), fp);
+      fclose(fp);
+      edges += run_input(data, len, seen);
+    }
+    printf("%d inputs, %d edges\n", argc - 1, edges);
+    return 0;
+  }
+
+  // Mutate inputs from the corpus, keeping those that find new edges
+  static uint8_t corpus[MAX_CORPUS][MAX_INPUT];
+  static size_t corpus_len[MAX_CORPUS];
+  int ncorpus = 1;
+  edges = run_input(corpus[0], 0, seen);
+
+  double begin = seconds();
+  for (long run = 0; run < runs; run++) {
+    uint8_t data[MAX_INPUT];
+    int pick = rand_r(&seed) % ncorpus;
+    size_t len = corpus_len[pick];
+    memcpy(data, corpus[pick], len);
+    for (int n = 1 + rand_r(&seed) % 4; n > 0; n--) {
+      len = mutate(data, len, &seed);
+    }
+    int found = run_input(data, len, seen);
+    if (found > 0) {
+      edges += found;
+      int slot = ncorpus < MAX_CORPUS ? ncorpus++ : rand_r(&seed) % ncorpus;
+      memcpy(corpus[slot], data, len);
+      corpus_len[slot] = len;
+    }
+  }
+  double elapsed = seconds() - begin;
+  printf("%ld runs, %d edges, %d inputs kept, %.0f runs/s\n", runs, edges,
+         ncorpus, elapsed > 0 ? runs / elapsed : 0);
+  return 0;
+}
+
+#endif  // X16_LIBFUZZER
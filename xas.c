@@ -1,22 +1,40 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <assert.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "expr.h"
 #include "instruction.h"
+#include "object.h"
+#include "peephole.h"
 #include "trap.h"
 #include "x16.h"
 #define REG 1111        // code for register
 #define IMM 2222        // code for immediate
 #define INST 3333       // code for instruction
 #define LABEL 4444      // code for labels
+#define IMPORT 5555     // code for labels of other modules (with -c)
+#define EXPR 6666       // code for expressions giving a target address
 #define ASSEMBLYERROR 2 // code for error in assembly
 #define FILEERROR 1     // code for file error (e.g no file specified)
 #define SUCCESS 0
 #define LINESIZE 200
 #define START 0x3000
+#define LONGFORMSIZE 9  // most words an instruction can take
+#define MACRODEPTH 16   // most macros expanded within each other
+#define MACROARGS 8     // most parameters of a macro
+#define MAXWORDS ((0x10000 - START) / 2 - 1) // labels count bytes in 16 bits
+// data directives, see detectDataDirective
+#define FILL 1
+#define BLKW 2
+#define STRINGZ 3
+#define PACKED 4
+#define INCBIN 5
 // stores where all the labels are located, necessary for jumping
 // to work
 typedef struct {
@@ -24,15 +42,90 @@ typedef struct {
   uint16_t labelAddress; // label location
 } labelTable;
 
+// a name given a value with .equ, evaluated when it is first used
+typedef struct {
+  char *name;
+  char *text;      // the expression
+  int32_t value;
+  int state;       // 0 not evaluated yet, 1 being evaluated, 2 known
+  bool usesLabels; // the value depends on where labels are
+} constantTable;
+
 // store collected data about the file here
 typedef struct {
   uint16_t *binaryInstructions; // array of binary instructions
+  uint32_t *sourceLines;        // source line of each instruction
+  bool *dataWords;              // which instructions came from val
+  bool *addressWords;           // which hold the address of a label
   int numInstructions;          // track how many instructions we have
   labelTable *table;            // table of all the labels
   int numLabels;                // number of labels
   uint16_t currentAddress;      // keep track of where we are now
+  char **globalNames;           // labels exported with .global
+  int numGlobals;               // number of exported labels
+  object_reloc_t *relocations;  // uses of labels of other modules, and
+                                // with -c of addresses of this one
+  int numRelocations;           // number of relocations
+  int relocationCapacity;       // relocations there is room for
+  char labelUsed[LINESIZE];     // label the last instruction refers to
+  bool importUsed;              // the last instruction refers to another module
+  uint8_t *lineSizes;           // words of each line made longer, 0 if not
+  int lineIndex;                // line being assembled, from 0
+  bool relaxAgain;              // a line became longer, assemble again
+  uint16_t longForm[LONGFORMSIZE]; // words of the last instruction made
+  int longFormWords;               // longer, 0 if it was not
+  int longFormData;             // its first word that is data
+  bool *lineWarned;             // lines warned about their long form
+  constantTable *constants;     // names given values with .equ
+  int numConstants;             // number of constants
+  uint32_t *lineMap;            // source line of each line after macros
+  bool noCache;                 // the last line used a name or a target
+  int exprLabels;               // labels the last expression used
+  bool exprReported;            // the last expression error was printed
+  bool labelArithmetic;         // a value was computed from label addresses
+  int *blockSizes;              // words of each data directive line, -1 if
+                                // not known before the line
+  int capacity;                 // words there is room for
 } fileData;
 
+// a macro, defined with .macro name params ... .endm
+typedef struct {
+  char *name;
+  char *params[MACROARGS];
+  int numParams;
+  char **body;  // cleaned lines
+  int numLines;
+} macroDef;
+
+// the macros of a file and the file with all of them expanded
+typedef struct {
+  macroDef *macros;
+  int numMacros;
+  FILE *out;          // the expanded file
+  uint32_t *lineMap;  // source line of each line of out
+  int numLines;
+  int capacity;
+  int expansions;     // for \@, a number unique to each expansion
+} macroState;
+
+// a line encoded by an earlier run, see -k. Its word only depends on the
+// text, and on the distance to the label it refers to if there is one
+typedef struct {
+  uint64_t hash;  // of the cleaned line
+  char *text;     // the cleaned line
+  char *label;    // label it refers to, NULL if none
+  int32_t delta;  // label address - line address (in bytes, like the table)
+  uint16_t word;  // encoding of the line
+} cacheEntry;
+
+// lines cached by the last run, and the lines of this run to cache
+typedef struct {
+  cacheEntry *old;  // sorted by hash
+  int numOld;
+  cacheEntry *fresh; // in source order
+  int numFresh;
+} lineCache;
+
 uint16_t assembleInstructionfromMetaData(opcode_t opcode, int numTokens,
                                          int registerCount, reg_t *reg1,
                                          reg_t *reg2, reg_t *reg3,
@@ -49,13 +142,18 @@ void determineisRet(char *tokenizedStr, bool *isRet);
 void extractNZP(char *tokenizedStr, bool *n, bool *z, bool *p);
 opcode_t parseValidInstruction(char *tokenizedStr);
 reg_t parseRegister(char *tokenizedStr);
-uint16_t parseImmediate(char *tokenizedStr);
+uint16_t parseImmediate(char *tokenizedStr, fileData *data, int *ErrorCode);
 int identifyType(char *tokenizedStr, fileData *data);
 void cleanToken(char *tokenizedStr);
 bool detectRegister(char *tokenizedStr);
 bool detectImmediate(char *tokenizedStr);
 bool detectValidInstruction(char *tokenizedStr);
-uint16_t processVal(char *line);
+bool detectSymbolName(char *tokenizedStr);
+int relocationBits(opcode_t opcode, bool isJsrR);
+object_reloc_t *addRelocation(fileData *data, const char *name,
+                              int index, int bits);
+void relocateAddress(fileData *data, int index);
+uint16_t processVal(char *line, fileData *data, int *ErrorCode);
 char *processLabel(char *line);
 uint16_t processInstruction(char *line, int *ErrorCode, fileData *data);
 bool detectVal(char *line);
@@ -63,69 +161,188 @@ void delSpace(char *line);
 int parseLine(char *line, fileData *data, int *ErrorCode);
 void delComment(char *line);
 bool detectLabel(char *line);
+bool detectDirective(char *line);
+int processDirective(char *line, fileData *data, int *ErrorCode);
+int checkGlobals(fileData *data);
 fileData *initfileData(int labelCount, int lineCount);
 int countLabels(FILE *file, int *lineCount);
 void addLabelsToTable(FILE *file, fileData *data);
+void writeObjectFile(FILE *outputFile, fileData *data, const char *source);
+labelTable *findLabel(fileData *data, const char *name);
+uint16_t labelWordAddress(labelTable *label);
+uint64_t hashLine(const char *line);
+lineCache *readCache(const char *path, int lineCount);
+int writeCache(const char *path, lineCache *cache);
+void freeCache(lineCache *cache);
+int assembleLine(char *line, fileData *data, lineCache *cache,
+                 int *ErrorCode);
+void optimizeInstructions(fileData *data);
+int assembleFile(FILE *file, fileData *data, lineCache *cache);
+void resetfileData(fileData *data, lineCache *cache);
+int lineWords(fileData *data, int lineIndex);
+int longFormSize(opcode_t opcode, bool neg, bool zero, bool pos);
+int emitLongForm(fileData *data, opcode_t opcode, reg_t reg, bool neg,
+                 bool zero, bool pos, uint16_t target);
+int evaluate(fileData *data, const char *text, int32_t *value);
+int lookupName(void *ctx, const char *name, int32_t *value);
+constantTable *findConstant(fileData *data, const char *name);
+bool splitEqu(char *line, char **name, char **text);
+void freeConstants(fileData *data);
+FILE *expandMacros(FILE *file, uint32_t **lineMap);
+int defineMacro(FILE *file, char *line, uint32_t *lineNumber,
+                macroState *state);
+int emitLine(macroState *state, char *line, uint32_t lineNumber, int depth);
+int substitute(const char *text, macroDef *macro, char **args, int unique,
+               char *out);
+int splitArguments(char *text, char **args, int max);
+char *findUnquoted(char *line, char c);
+int detectDataDirective(char *line);
+int dataSize(char *line, fileData *data);
+int processData(char *line, fileData *data, int *ErrorCode);
+int parseString(char *text, char *out, int *length);
+uint16_t *reserveWords(fileData *data, int count);
+uint8_t *readIncbin(char *text, long *size);
+macroDef *findMacro(macroState *state, const char *name);
 
 void usage() {
-  fprintf(stderr, "Usage: ./xas file");
+  fprintf(stderr,
+          "Usage: ./xas [-g] [-c] [-O] [-r reg] [-o output] [-k cache] file");
   exit(1);
 }
 int labelCount = 0;
 int lineCount = 0;
 int ErrorCode = 0;
+bool assembleModule = false; // -c: unknown labels are left for xld
+const char *sourcePath = NULL; // .incbin files are next to it
+reg_t scratchRegister = R_R6; // -r: used by branches to far labels
 int main(int argc, char **argv) {
-  if (argc != 2) {
+  bool debugInfo = false; // write object format 2 with symbols and lines
+  const char *outputName = "a.obj";
+  const char *cacheName = NULL; // reuse the encoding of unchanged lines
+  bool optimize = false;        // peephole pass over the instructions
+  int ch;
+  while ((ch = getopt(argc, argv, "gcOo:k:r:")) != -1) {
+    if (ch == 'g') {
+      debugInfo = true;
+    } else if (ch == 'c') {
+      assembleModule = true;
+    } else if (ch == 'o') {
+      outputName = optarg;
+    } else if (ch == 'k') {
+      cacheName = optarg;
+    } else if (ch == 'O') {
+      optimize = true;
+    } else if (ch == 'r') {
+      // JSRR sets R7 before it jumps, so R7 cannot hold the target
+      if (optarg[0] < '0' || optarg[0] > '6' || optarg[1] != '\0') {
+        usage();
+      }
+      scratchRegister = optarg[0] - '0';
+    } else {
+      usage();
+    }
+  }
+  if (argc - optind != 1) {
     usage();
     return 1; // NOTE: not sure if this is necessary
   }
+  const char *sourceName = argv[optind];
+  sourcePath = sourceName;
   labelCount = 0; // count the total number of labels in file
   // grab the file
-  FILE *file = fopen(argv[1], "r");
+  FILE *file = fopen(sourceName, "r");
   if (!file) {
-    fprintf(stderr, "Cannot open %s\n", argv[1]);
+    fprintf(stderr, "Cannot open %s\n", sourceName);
     return FILEERROR;
   }
+  // the rest of the assembler reads the file with the macros expanded
+  uint32_t *lineMap = NULL;
+  FILE *expanded = expandMacros(file, &lineMap);
+  fclose(file);
+  if (expanded == NULL) {
+    return ASSEMBLYERROR;
+  }
+  file = expanded;
   // calculate number of labels;
   labelCount = countLabels(file, &lineCount);
   fseek(file, 0, SEEK_SET); // move file pointer back to beginning
   // initiallize struct that will store all the data
   fileData *data = initfileData(labelCount, lineCount);
-  addLabelsToTable(file, data);
-  data->currentAddress = START;
-  fseek(file, 0, SEEK_SET);
-  // main loop that will parse the file MAINLOOP
-  char line[LINESIZE];
-  while (fgets(line, sizeof(line), file) != NULL) { // iterate thought ines
-    // clean up the line
-    delComment(line); // delete comments
-    delSpace(line);   // delete leading and trailing spaces
-    if (ErrorCode == 2 || parseLine(line, data, &ErrorCode) == ASSEMBLYERROR) {
+  data->lineMap = lineMap;
+  lineCache *cache = cacheName ? readCache(cacheName, lineCount) : NULL;
+  // a line whose label is out of reach takes more words, which moves the
+  // labels after it, so assemble again until no line grows. Lines only
+  // grow, so this ends
+  do {
+    resetfileData(data, cache);
+    addLabelsToTable(file, data);
+    if (assembleFile(file, data, cache) == ASSEMBLYERROR) {
       printf("ERROR: Invalid assembly (in main)\n");
       return ASSEMBLYERROR;
     }
-    //   // only increment if we processed an actual instruction/val
-    if (strlen(line) > 0 && !detectLabel(line)) {
-      data->currentAddress += 2; // each instruction is 2 bytes (as we have
-      // a 16 bit comp)
+  } while (data->relaxAgain);
+  if (checkGlobals(data) == ASSEMBLYERROR) {
+    return ASSEMBLYERROR;
+  }
+  if (assembleModule && data->labelArithmetic) {
+    // only a label on its own is relocated when xld moves the module
+    printf("ERROR: a module cannot compute values from label addresses\n");
+    return ASSEMBLYERROR;
+  }
+  // only a successful run is cached
+  if (cache != NULL) {
+    if (writeCache(cacheName, cache) != SUCCESS) {
+      fprintf(stderr, "Cannot write %s\n", cacheName);
     }
+    freeCache(cache);
+  }
+  if (optimize && data->labelArithmetic) {
+    // the pass moves labels, which would change such values
+    printf("Not optimizing: a value is computed from label addresses\n");
+  } else if (optimize) {
+    optimizeInstructions(data);
   }
   // WRITE TO OUTPUT FILE:
   int totalInstructions = data->numInstructions;
-  FILE *outputFile = fopen("a.obj", "wb"); // write binary
-  uint16_t origin = htons(START);
-  fwrite(&origin, sizeof(uint16_t), 1, outputFile);
-  for (int i = 0; i < totalInstructions; i++) {
-    uint16_t instruction =
-        htons(data->binaryInstructions[i]); // convert to network byte order
-    fwrite(&instruction, sizeof(uint16_t), 1, outputFile);
+  FILE *outputFile = fopen(outputName, "wb"); // write binary
+  if (!outputFile) {
+    fprintf(stderr, "Cannot open %s\n", outputName);
+    return FILEERROR;
+  }
+  if (debugInfo || assembleModule) {
+    writeObjectFile(outputFile, data, sourceName);
+  } else {
+    uint16_t origin = htons(START);
+    fwrite(&origin, sizeof(uint16_t), 1, outputFile);
+    for (int i = 0; i < totalInstructions; i++) {
+      uint16_t instruction =
+          htons(data->binaryInstructions[i]); // convert to network byte order
+      fwrite(&instruction, sizeof(uint16_t), 1, outputFile);
+    }
   }
   // Free and close the file
   for (int i = 0; i < data->numLabels; i++) {
     free(data->table[i].labelName); // strdup uses malloc, so need to free
   }
+  for (int i = 0; i < data->numGlobals; i++) {
+    free(data->globalNames[i]);
+  }
+  for (int i = 0; i < data->numRelocations; i++) {
+    free((char *)data->relocations[i].name);
+  }
   free(data->binaryInstructions);
+  free(data->sourceLines);
+  free(data->dataWords);
+  free(data->addressWords);
+  free(data->lineSizes);
+  free(data->lineWarned);
+  free(data->globalNames);
+  free(data->relocations);
   free(data->table);
+  freeConstants(data);
+  free(data->constants);
+  free(data->lineMap);
+  free(data->blockSizes);
   free(data);
   fclose(outputFile);
   return SUCCESS;
@@ -153,10 +370,864 @@ fileData *initfileData(int labelCount, int lineCount) {
   data->table = table;
   data->numLabels = 0;
   data->currentAddress = 0x3000; // start here
-  data->binaryInstructions = malloc(lineCount * sizeof(uint16_t) * 2);
+  data->binaryInstructions =
+      malloc(lineCount * sizeof(uint16_t) * LONGFORMSIZE);
+  data->sourceLines = malloc(lineCount * sizeof(uint32_t) * LONGFORMSIZE);
+  data->dataWords = malloc(lineCount * sizeof(bool) * LONGFORMSIZE);
+  data->addressWords = malloc(lineCount * sizeof(bool) * LONGFORMSIZE);
+  data->lineSizes = calloc(lineCount + 1, sizeof(uint8_t));
+  data->lineWarned = calloc(lineCount + 1, sizeof(bool));
+  data->relaxAgain = false;
+  data->globalNames = malloc((lineCount + 1) * sizeof(char *));
+  data->numGlobals = 0;
+  data->relocations = malloc((lineCount + 1) * sizeof(object_reloc_t));
+  data->numRelocations = 0;
+  data->relocationCapacity = lineCount + 1;
+  data->constants = malloc((lineCount + 1) * sizeof(constantTable));
+  data->numConstants = 0;
+  data->lineMap = NULL;
+  data->labelArithmetic = false;
+  data->blockSizes = calloc(lineCount + 1, sizeof(int));
+  data->capacity = lineCount * LONGFORMSIZE;
   return data;
 }
 
+// forget what the last pass assembled, keeping the sizes of lines made
+// longer
+void resetfileData(fileData *data, lineCache *cache) {
+  for (int i = 0; i < data->numLabels; i++) {
+    free(data->table[i].labelName);
+  }
+  for (int i = 0; i < data->numGlobals; i++) {
+    free(data->globalNames[i]);
+  }
+  for (int i = 0; i < data->numRelocations; i++) {
+    free((char *)data->relocations[i].name);
+  }
+  freeConstants(data);
+  data->numLabels = 0;
+  data->numGlobals = 0;
+  data->numRelocations = 0;
+  data->numInstructions = 0;
+  data->currentAddress = START;
+  data->relaxAgain = false;
+  data->labelArithmetic = false;
+  if (cache != NULL) {
+    for (int i = 0; i < cache->numFresh; i++) {
+      free(cache->fresh[i].text);
+      free(cache->fresh[i].label);
+    }
+    cache->numFresh = 0;
+  }
+}
+
+// main loop that will parse the file once the labels are known MAINLOOP
+int assembleFile(FILE *file, fileData *data, lineCache *cache) {
+  fseek(file, 0, SEEK_SET);
+  char line[LINESIZE];
+  uint32_t lineNumber = 0;
+  while (fgets(line, sizeof(line), file) != NULL) { // iterate thought ines
+    lineNumber++;
+    data->lineIndex = lineNumber - 1;
+    // clean up the line
+    delComment(line); // delete comments
+    delSpace(line);   // delete leading and trailing spaces
+    int before = data->numInstructions;
+    if (ErrorCode == 2 ||
+        assembleLine(line, data, cache, &ErrorCode) == ASSEMBLYERROR) {
+      return ASSEMBLYERROR;
+    }
+    for (int i = before; i < data->numInstructions; i++) {
+      data->sourceLines[i] = data->lineMap[lineNumber - 1];
+    }
+    //   // only increment if we processed an actual instruction/val
+    if (strlen(line) > 0 && !detectLabel(line) && !detectDirective(line)) {
+      // each instruction is 2 bytes (as we have a 16 bit comp)
+      data->currentAddress += 2 * lineWords(data, data->lineIndex);
+    } else if (data->blockSizes[data->lineIndex] > 0) {
+      data->currentAddress += 2 * data->blockSizes[data->lineIndex];
+    }
+  }
+  return SUCCESS;
+}
+
+// words a line with an instruction or val takes
+int lineWords(fileData *data, int lineIndex) {
+  return data->lineSizes[lineIndex] ? data->lineSizes[lineIndex] : 1;
+}
+
+// words of the long form of an instruction whose label is out of reach:
+// the address of the label is loaded from a word after the code, and a
+// branch goes through a register
+int longFormSize(opcode_t opcode, bool neg, bool zero, bool pos) {
+  switch (opcode) {
+  case OP_BR:
+    return neg == zero && zero == pos ? 3 : 4; // always, or inverted first
+  case OP_LEA:
+  case OP_ST:
+    return 3;
+  case OP_LD:
+  case OP_JSR:
+    return 4;
+  case OP_LDI:
+    return 5;
+  case OP_STI:
+    return 9;
+  default:
+    return 0;
+  }
+}
+
+// put the long form of an instruction in data->longForm, target is the
+// word address of the label. reg is the destination of loads and the
+// source of stores. Branches and JSR go through the scratch register and
+// overwrite it, STI puts it back after using it. Those set the condition
+// codes too, so xas warns about each of them, once
+int emitLongForm(fileData *data, opcode_t opcode, reg_t reg, bool neg,
+                 bool zero, bool pos, uint16_t target) {
+  uint16_t *w = data->longForm;
+  reg_t s = scratchRegister;
+  uint16_t skip = emit_br(true, true, true, 1); // over the address
+  int n = 0;
+  switch (opcode) {
+  case OP_BR:
+    if (!(neg == zero && zero == pos)) {
+      w[n++] = emit_br(!neg, !zero, !pos, 3); // not taken: skip it all
+    }
+    w[n++] = emit_ld(s, 1);
+    w[n++] = emit_jmp(s);
+    break;
+  case OP_JSR:
+    w[n++] = emit_ld(s, 2);
+    w[n++] = emit_jsrr(s);
+    w[n++] = skip; // where the routine returns to
+    break;
+  case OP_LD:
+  case OP_LDI:
+    w[n++] = emit_ld(reg, opcode == OP_LD ? 2 : 3);
+    w[n++] = emit_ldr(reg, reg, 0);
+    if (opcode == OP_LDI) {
+      w[n++] = emit_ldr(reg, reg, 0);
+    }
+    w[n++] = skip;
+    break;
+  case OP_LEA:
+    w[n++] = emit_ld(reg, 1);
+    w[n++] = skip;
+    break;
+  case OP_ST:
+    w[n++] = emit_sti(reg, 1); // through the address
+    w[n++] = skip;
+    break;
+  case OP_STI:
+    // the address at the label goes in a word for an sti, the scratch
+    // register is saved meanwhile
+    w[n++] = emit_st(s, 5);
+    w[n++] = emit_ldi(s, 6);
+    w[n++] = emit_st(s, 4);
+    w[n++] = emit_ld(s, 2);
+    w[n++] = emit_sti(reg, 2);
+    w[n++] = emit_br(true, true, true, 3); // over the three words
+    w[n++] = 0;
+    w[n++] = 0;
+    break;
+  default:
+    return ASSEMBLYERROR;
+  }
+  data->longFormData = opcode == OP_STI ? n - 2 : n;
+  w[n++] = target;
+  data->longFormWords = n;
+  if (!data->lineWarned[data->lineIndex] &&
+      (opcode == OP_BR || opcode == OP_JSR || opcode == OP_STI)) {
+    // loads set the condition codes from the same value either way
+    uint32_t line = data->lineMap[data->lineIndex];
+    if (opcode == OP_BR || opcode == OP_JSR) {
+      printf("WARNING: line %u: %s to a far label overwrites %%r%d and the "
+             "condition codes\n",
+             line, opcode == OP_BR ? "branch" : "jsr", s);
+    } else {
+      printf("WARNING: line %u: sti to a far label changes the condition "
+             "codes\n",
+             line);
+    }
+    data->lineWarned[data->lineIndex] = true;
+  }
+  return SUCCESS;
+}
+
+// find a label in the table, labels are not case sensitive
+labelTable *findLabel(fileData *data, const char *name) {
+  for (int i = 0; i < data->numLabels; i++) {
+    if (strcasecmp(data->table[i].labelName, name) == 0) {
+      return &data->table[i];
+    }
+  }
+  return NULL;
+}
+
+// label addresses count bytes from START, memory counts words
+uint16_t labelWordAddress(labelTable *label) {
+  return START + (label->labelAddress - START) / 2;
+}
+
+// evaluate an expression of the source, where constants are known by name
+// and labels by their word address. Prints what is wrong with it
+int evaluate(fileData *data, const char *text, int32_t *value) {
+  char error[LINESIZE];
+  data->exprLabels = 0;
+  data->exprReported = false;
+  if (expr_eval(text, lookupName, data, value, error, sizeof(error)) != 0) {
+    if (!data->exprReported) {
+      printf("ERROR: %s in %s\n", error, text);
+    }
+    return ASSEMBLYERROR;
+  }
+  return SUCCESS;
+}
+
+// names in expressions, a constant is evaluated the first time it is used
+int lookupName(void *ctx, const char *name, int32_t *value) {
+  fileData *data = ctx;
+  data->noCache = true;
+  constantTable *constant = findConstant(data, name);
+  if (constant == NULL) {
+    labelTable *label = findLabel(data, name);
+    if (label == NULL) {
+      return -1;
+    }
+    data->exprLabels++;
+    *value = labelWordAddress(label);
+    return 0;
+  }
+  if (constant->state == 1) {
+    printf("ERROR: .equ %s depends on itself\n", constant->name);
+    data->exprReported = true;
+    return -1;
+  }
+  if (constant->state == 0) {
+    char error[LINESIZE];
+    int labels = data->exprLabels;
+    constant->state = 1;
+    if (expr_eval(constant->text, lookupName, data, &constant->value, error,
+                  sizeof(error)) != 0) {
+      if (!data->exprReported) {
+        printf("ERROR: %s in .equ %s\n", error, constant->name);
+        data->exprReported = true;
+      }
+      constant->state = 0;
+      return -1;
+    }
+    constant->state = 2;
+    constant->usesLabels = data->exprLabels > labels;
+  } else if (constant->usesLabels) {
+    data->exprLabels++;
+  }
+  *value = constant->value;
+  return 0;
+}
+
+// find a constant, names are not case sensitive like labels
+constantTable *findConstant(fileData *data, const char *name) {
+  for (int i = 0; i < data->numConstants; i++) {
+    if (strcasecmp(data->constants[i].name, name) == 0) {
+      return &data->constants[i];
+    }
+  }
+  return NULL;
+}
+
+// split a cleaned line ".equ NAME, expression" into its name and
+// expression, the comma is optional. Returns false if it is not a .equ
+bool splitEqu(char *line, char **name, char **text) {
+  if (strncasecmp(line, ".equ", 4) != 0 || !isspace((unsigned char)line[4])) {
+    return false;
+  }
+  char *c = line + 4;
+  c += strspn(c, " \t");
+  *name = c;
+  while (isalnum((unsigned char)*c) || *c == '_') {
+    c++;
+  }
+  char *end = c;
+  c += strspn(c, " \t");
+  if (*c == ',') {
+    c++;
+  }
+  c += strspn(c, " \t");
+  *end = '\0';
+  *text = c;
+  return detectSymbolName(*name) && **text != '\0';
+}
+
+// forget the constants, the next pass finds them again
+void freeConstants(fileData *data) {
+  for (int i = 0; i < data->numConstants; i++) {
+    free(data->constants[i].name);
+    free(data->constants[i].text);
+  }
+  data->numConstants = 0;
+}
+
+// write object format 2: the instructions along with the label table as
+// symbols and the source line of every instruction. With -c it is a
+// module (format 3) that also has the exports and relocations
+void writeObjectFile(FILE *outputFile, fileData *data, const char *source) {
+  object_symbol_t *symbols =
+      malloc((data->numLabels + 1) * sizeof(object_symbol_t));
+  for (int i = 0; i < data->numLabels; i++) {
+    symbols[i].name = data->table[i].labelName;
+    symbols[i].address = labelWordAddress(&data->table[i]);
+  }
+  object_symbol_t *exports =
+      malloc((data->numGlobals + 1) * sizeof(object_symbol_t));
+  for (int i = 0; i < data->numGlobals; i++) {
+    labelTable *label = findLabel(data, data->globalNames[i]);
+    exports[i].name = label->labelName;
+    exports[i].address = labelWordAddress(label);
+  }
+  object_contents_t contents = {
+      .origin = START,
+      .words = data->binaryInstructions,
+      .count = data->numInstructions,
+      .symbols = symbols,
+      .nsymbols = data->numLabels,
+      .source = source,
+      .lines = data->sourceLines,
+      .module = assembleModule,
+      .exports = exports,
+      .nexports = data->numGlobals,
+      .relocs = data->relocations,
+      .nrelocs = data->numRelocations,
+  };
+  object_write(outputFile, &contents);
+  free(symbols);
+  free(exports);
+}
+
+// parse a line, or take its word from the cache when the same line was
+// encoded before at the same distance from the label it refers to. Every
+// line that makes a word is cached for the next run
+int assembleLine(char *line, fileData *data, lineCache *cache,
+                 int *ErrorCode) {
+  if (cache == NULL || strlen(line) == 0 || detectLabel(line) ||
+      detectDirective(line) || data->lineSizes[data->lineIndex] > 0) {
+    return parseLine(line, data, ErrorCode);
+  }
+  uint64_t hash = hashLine(line);
+  // find the first entry with the hash
+  int low = 0;
+  int high = cache->numOld;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (cache->old[mid].hash < hash) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  cacheEntry *found = NULL;
+  for (int i = low; i < cache->numOld && cache->old[i].hash == hash; i++) {
+    cacheEntry *entry = &cache->old[i];
+    if (strcmp(entry->text, line) != 0) {
+      continue;
+    }
+    if (entry->label == NULL) {
+      found = entry;
+      break;
+    }
+    labelTable *label = findLabel(data, entry->label);
+    if (label != NULL &&
+        label->labelAddress - data->currentAddress == entry->delta) {
+      found = entry;
+      break;
+    }
+  }
+
+  cacheEntry *fresh = &cache->fresh[cache->numFresh];
+  if (found != NULL) {
+    data->dataWords[data->numInstructions] = detectVal(line);
+    data->addressWords[data->numInstructions] = false;
+    data->binaryInstructions[data->numInstructions++] = found->word;
+    *fresh = *found;
+  } else {
+    data->labelUsed[0] = '\0';
+    data->importUsed = false;
+    data->noCache = false;
+    if (parseLine(line, data, ErrorCode) == ASSEMBLYERROR) {
+      return ASSEMBLYERROR;
+    }
+    if (data->importUsed || data->relaxAgain) {
+      return SUCCESS; // patched by xld, and needs its relocation every time
+    }
+    if (data->noCache) {
+      return SUCCESS; // the values of names can change without the line
+    }
+    fresh->hash = hash;
+    fresh->text = NULL;
+    fresh->label = NULL;
+    fresh->delta = 0;
+    fresh->word = data->binaryInstructions[data->numInstructions - 1];
+    if (data->labelUsed[0] != '\0') {
+      labelTable *label = findLabel(data, data->labelUsed);
+      fresh->label = label->labelName;
+      fresh->delta = label->labelAddress - data->currentAddress;
+    }
+  }
+  // the strings belong to the old entries or the label table, copy them
+  fresh->text = strdup(line);
+  fresh->label = fresh->label ? strdup(fresh->label) : NULL;
+  cache->numFresh++;
+  return SUCCESS;
+}
+
+// FNV-1a hash of a cleaned line
+uint64_t hashLine(const char *line) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *c = line; *c != '\0'; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// cache files start with this, bump CACHEVERSION whenever an encoding
+// changes so old caches are dropped
+#define CACHEMAGIC "XASC"
+#define CACHEVERSION 2
+
+int compareCacheEntries(const void *a, const void *b) {
+  uint64_t x = ((const cacheEntry *)a)->hash;
+  uint64_t y = ((const cacheEntry *)b)->hash;
+  return x < y ? -1 : x > y;
+}
+
+// read a string of a cache entry, len bytes without the NUL
+char *readCacheString(FILE *file, uint16_t len) {
+  char *str = malloc(len + 1);
+  if (fread(str, 1, len, file) != len) {
+    free(str);
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+// read the cache of the last run. A missing or broken cache is just empty,
+// then every line is parsed
+lineCache *readCache(const char *path, int lineCount) {
+  lineCache *cache = calloc(1, sizeof(lineCache));
+  cache->fresh = malloc((lineCount + 1) * sizeof(cacheEntry));
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return cache;
+  }
+  char magic[4];
+  uint32_t version, count;
+  if (fread(magic, 1, 4, file) != 4 || memcmp(magic, CACHEMAGIC, 4) != 0 ||
+      fread(&version, sizeof(version), 1, file) != 1 ||
+      version != CACHEVERSION || fread(&count, sizeof(count), 1, file) != 1 ||
+      count > (uint32_t)lineCount * 2 + 1024) {
+    fclose(file);
+    return cache;
+  }
+  cache->old = malloc((count + 1) * sizeof(cacheEntry));
+  for (uint32_t i = 0; i < count; i++) {
+    cacheEntry *entry = &cache->old[cache->numOld];
+    uint16_t textLen, labelLen;
+    if (fread(&entry->hash, sizeof(entry->hash), 1, file) != 1 ||
+        fread(&entry->delta, sizeof(entry->delta), 1, file) != 1 ||
+        fread(&entry->word, sizeof(entry->word), 1, file) != 1 ||
+        fread(&textLen, sizeof(textLen), 1, file) != 1 ||
+        fread(&labelLen, sizeof(labelLen), 1, file) != 1 ||
+        textLen >= LINESIZE || labelLen >= LINESIZE) {
+      break;
+    }
+    entry->text = readCacheString(file, textLen);
+    entry->label = labelLen > 0 ? readCacheString(file, labelLen) : NULL;
+    if (entry->text == NULL || (labelLen > 0 && entry->label == NULL) ||
+        hashLine(entry->text) != entry->hash) {
+      free(entry->text);
+      free(entry->label);
+      break;
+    }
+    cache->numOld++;
+  }
+  fclose(file);
+  qsort(cache->old, cache->numOld, sizeof(cacheEntry), compareCacheEntries);
+  return cache;
+}
+
+// write the lines of this run for the next one. The file is replaced as a
+// whole so a run that is cut short leaves the old cache
+int writeCache(const char *path, lineCache *cache) {
+  char tmpPath[LINESIZE + 8];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE *file = fopen(tmpPath, "wb");
+  if (!file) {
+    return FILEERROR;
+  }
+  uint32_t version = CACHEVERSION;
+  uint32_t count = cache->numFresh;
+  fwrite(CACHEMAGIC, 1, 4, file);
+  fwrite(&version, sizeof(version), 1, file);
+  fwrite(&count, sizeof(count), 1, file);
+  for (int i = 0; i < cache->numFresh; i++) {
+    cacheEntry *entry = &cache->fresh[i];
+    uint16_t textLen = strlen(entry->text);
+    uint16_t labelLen = entry->label ? strlen(entry->label) : 0;
+    fwrite(&entry->hash, sizeof(entry->hash), 1, file);
+    fwrite(&entry->delta, sizeof(entry->delta), 1, file);
+    fwrite(&entry->word, sizeof(entry->word), 1, file);
+    fwrite(&textLen, sizeof(textLen), 1, file);
+    fwrite(&labelLen, sizeof(labelLen), 1, file);
+    fwrite(entry->text, 1, textLen, file);
+    fwrite(entry->label, 1, labelLen, file);
+  }
+  if (fclose(file) != 0 || rename(tmpPath, path) != 0) {
+    remove(tmpPath);
+    return FILEERROR;
+  }
+  return SUCCESS;
+}
+
+void freeCache(lineCache *cache) {
+  for (int i = 0; i < cache->numOld; i++) {
+    free(cache->old[i].text);
+    free(cache->old[i].label);
+  }
+  for (int i = 0; i < cache->numFresh; i++) {
+    free(cache->fresh[i].text);
+    free(cache->fresh[i].label);
+  }
+  free(cache->old);
+  free(cache->fresh);
+  free(cache);
+}
+
+// -O: run the peephole pass, then move the labels, source lines and
+// relocations along with their instructions
+void optimizeInstructions(fileData *data) {
+  int count = data->numInstructions;
+  peephole_word_t *code = malloc((count + 1) * sizeof(peephole_word_t));
+  size_t *map = malloc((count + 1) * sizeof(size_t));
+  for (int i = 0; i < count; i++) {
+    code[i].word = data->binaryInstructions[i];
+    code[i].data = data->dataWords[i] || data->addressWords[i];
+    code[i].label = false;
+    code[i].fixed = false;
+  }
+  for (int i = 0; i < data->numLabels; i++) {
+    int index = (data->table[i].labelAddress - START) / 2;
+    if (index < count) {
+      code[index].label = true;
+    }
+  }
+  for (int i = 0; i < data->numRelocations; i++) {
+    code[data->relocations[i].address - START].fixed = true;
+  }
+
+  peephole_stats_t stats;
+  int kept = peephole_optimize(code, count, map, &stats);
+  for (int i = 0; i < count; i++) {
+    // a word is kept if the next one does not take its place
+    if (map[i] < map[i + 1]) {
+      data->binaryInstructions[map[i]] = code[map[i]].word;
+      data->sourceLines[map[i]] = data->sourceLines[i];
+      data->dataWords[map[i]] = data->dataWords[i];
+      data->addressWords[map[i]] = data->addressWords[i];
+    }
+  }
+  // addresses of labels in long forms move with the labels
+  for (int i = 0; i < kept; i++) {
+    uint16_t target = data->binaryInstructions[i];
+    if (data->addressWords[i] && target >= START && target <= START + count) {
+      data->binaryInstructions[i] = START + map[target - START];
+    }
+  }
+  for (int i = 0; i < data->numLabels; i++) {
+    int index = (data->table[i].labelAddress - START) / 2;
+    data->table[i].labelAddress = START + map[index] * 2;
+  }
+  for (int i = 0; i < data->numRelocations; i++) {
+    object_reloc_t *reloc = &data->relocations[i];
+    reloc->address = START + map[reloc->address - START];
+  }
+  data->numInstructions = kept;
+  printf("Optimized away %zu words, about %llu instructions fewer run\n",
+         stats.words, (unsigned long long)stats.executed);
+  free(code);
+  free(map);
+}
+
+// every label exported with .global must be defined
+int checkGlobals(fileData *data) {
+  for (int i = 0; i < data->numGlobals; i++) {
+    if (findLabel(data, data->globalNames[i]) == NULL) {
+      printf("ERROR: .global %s is not a label\n", data->globalNames[i]);
+      return ASSEMBLYERROR;
+    }
+  }
+  return SUCCESS;
+}
+
+// expand the macros of a file into a temporary file. A macro is defined
+// with .macro name param1, param2 up to .endm before it is used, and used
+// with a line starting with its name followed by the arguments. \param in
+// its lines stands for an argument and \@ for a number unique to each use,
+// for labels. lineMap gets the source line of each line of the result
+FILE *expandMacros(FILE *file, uint32_t **lineMap) {
+  macroState state = {NULL, 0, tmpfile(), NULL, 0, 0, 0};
+  if (state.out == NULL) {
+    fprintf(stderr, "Cannot create a temporary file\n");
+    return NULL;
+  }
+  char line[LINESIZE];
+  uint32_t lineNumber = 0;
+  int result = SUCCESS;
+  while (result == SUCCESS && fgets(line, sizeof(line), file) != NULL) {
+    lineNumber++;
+    delComment(line);
+    delSpace(line);
+    if (strncasecmp(line, ".macro", 6) == 0 &&
+        (line[6] == '\0' || isspace((unsigned char)line[6]))) {
+      result = defineMacro(file, line, &lineNumber, &state);
+    } else if (strcasecmp(line, ".endm") == 0) {
+      printf("ERROR: .endm without .macro (line %u)\n", lineNumber);
+      result = ASSEMBLYERROR;
+    } else {
+      result = emitLine(&state, line, lineNumber, 0);
+    }
+  }
+  for (int i = 0; i < state.numMacros; i++) {
+    macroDef *macro = &state.macros[i];
+    free(macro->name);
+    for (int j = 0; j < macro->numParams; j++) {
+      free(macro->params[j]);
+    }
+    for (int j = 0; j < macro->numLines; j++) {
+      free(macro->body[j]);
+    }
+    free(macro->body);
+  }
+  free(state.macros);
+  if (result != SUCCESS) {
+    fclose(state.out);
+    free(state.lineMap);
+    return NULL;
+  }
+  rewind(state.out);
+  *lineMap = state.lineMap;
+  return state.out;
+}
+
+// read the definition of a macro up to its .endm
+int defineMacro(FILE *file, char *line, uint32_t *lineNumber,
+                macroState *state) {
+  uint32_t start = *lineNumber;
+  char *rest = line + 6;
+  rest += strspn(rest, " \t");
+  char *name = rest;
+  rest += strcspn(rest, " \t");
+  if (*rest != '\0') {
+    *rest++ = '\0';
+  }
+  char *params[MACROARGS + 1];
+  int numParams = splitArguments(rest, params, MACROARGS + 1);
+  bool valid = detectSymbolName(name) && numParams <= MACROARGS;
+  for (int i = 0; valid && i < numParams; i++) {
+    valid = detectSymbolName(params[i]);
+  }
+  if (!valid) {
+    printf("ERROR: Invalid macro definition: %s (line %u)\n", line, start);
+    return ASSEMBLYERROR;
+  }
+  if (findMacro(state, name) != NULL) {
+    printf("ERROR: macro %s is defined twice (line %u)\n", name, start);
+    return ASSEMBLYERROR;
+  }
+  state->macros =
+      realloc(state->macros, (state->numMacros + 1) * sizeof(macroDef));
+  macroDef *macro = &state->macros[state->numMacros++];
+  macro->name = strdup(name);
+  macro->numParams = numParams;
+  for (int i = 0; i < numParams; i++) {
+    macro->params[i] = strdup(params[i]);
+  }
+  macro->body = NULL;
+  macro->numLines = 0;
+  char bodyLine[LINESIZE];
+  while (fgets(bodyLine, sizeof(bodyLine), file) != NULL) {
+    (*lineNumber)++;
+    delComment(bodyLine);
+    delSpace(bodyLine);
+    if (strcasecmp(bodyLine, ".endm") == 0) {
+      return SUCCESS;
+    }
+    if (strncasecmp(bodyLine, ".macro", 6) == 0) {
+      printf("ERROR: .macro inside macro %s (line %u)\n", macro->name,
+             *lineNumber);
+      return ASSEMBLYERROR;
+    }
+    if (strlen(bodyLine) > 0) {
+      macro->body =
+          realloc(macro->body, (macro->numLines + 1) * sizeof(char *));
+      macro->body[macro->numLines++] = strdup(bodyLine);
+    }
+  }
+  printf("ERROR: macro %s has no .endm (line %u)\n", macro->name, start);
+  return ASSEMBLYERROR;
+}
+
+// write a cleaned line to the expanded file, or the lines of the macro it
+// uses, expanded in turn
+int emitLine(macroState *state, char *line, uint32_t lineNumber, int depth) {
+  char name[LINESIZE];
+  size_t length = strcspn(line, " \t");
+  memcpy(name, line, length);
+  name[length] = '\0';
+  macroDef *macro = detectLabel(line) ? NULL : findMacro(state, name);
+  if (macro == NULL) {
+    if (state->numLines == state->capacity) {
+      state->capacity = state->capacity ? 2 * state->capacity : 256;
+      state->lineMap =
+          realloc(state->lineMap, state->capacity * sizeof(uint32_t));
+    }
+    state->lineMap[state->numLines++] = lineNumber;
+    fprintf(state->out, "%s\n", line);
+    return SUCCESS;
+  }
+  if (depth == MACRODEPTH) {
+    printf("ERROR: macros used within each other too deep at %s (line %u)\n",
+           name, lineNumber);
+    return ASSEMBLYERROR;
+  }
+  char rest[LINESIZE];
+  strcpy(rest, line + length);
+  char *args[MACROARGS + 1];
+  int numArgs = splitArguments(rest, args, MACROARGS + 1);
+  if (numArgs != macro->numParams) {
+    printf("ERROR: macro %s takes %d arguments, not %d (line %u)\n",
+           macro->name, macro->numParams, numArgs, lineNumber);
+    return ASSEMBLYERROR;
+  }
+  int unique = state->expansions++;
+  for (int i = 0; i < macro->numLines; i++) {
+    char expanded[LINESIZE];
+    if (substitute(macro->body[i], macro, args, unique, expanded) !=
+        SUCCESS) {
+      printf("ERROR: line of macro %s too long (line %u)\n", macro->name,
+             lineNumber);
+      return ASSEMBLYERROR;
+    }
+    if (emitLine(state, expanded, lineNumber, depth + 1) != SUCCESS) {
+      return ASSEMBLYERROR;
+    }
+  }
+  return SUCCESS;
+}
+
+// put the arguments in place of the parameters of a line of a macro, out
+// has room for LINESIZE characters
+int substitute(const char *text, macroDef *macro, char **args, int unique,
+               char *out) {
+  size_t n = 0;
+  char number[16];
+  for (const char *c = text; *c != '\0';) {
+    const char *insert = NULL;
+    size_t skip = 1;
+    if (c[0] == '\\' && c[1] == '@') {
+      snprintf(number, sizeof(number), "%d", unique);
+      insert = number;
+      skip = 2;
+    } else if (c[0] == '\\') {
+      // the longest parameter name that follows
+      size_t length = 0;
+      while (isalnum((unsigned char)c[1 + length]) || c[1 + length] == '_') {
+        length++;
+      }
+      for (; length > 0 && insert == NULL; length--) {
+        for (int i = 0; i < macro->numParams; i++) {
+          if (strlen(macro->params[i]) == length &&
+              strncasecmp(macro->params[i], c + 1, length) == 0) {
+            insert = args[i];
+            skip = length + 1;
+            break;
+          }
+        }
+      }
+    }
+    if (insert == NULL) {
+      insert = c; // copied as it is
+    }
+    size_t length = insert == c ? 1 : strlen(insert);
+    if (n + length >= LINESIZE - 1) {
+      return ASSEMBLYERROR;
+    }
+    memcpy(out + n, insert, length);
+    n += length;
+    c += skip;
+  }
+  out[n] = '\0';
+  return SUCCESS;
+}
+
+// split the arguments of a macro or a directive at commas that are not in
+// quotes, trimming each. Returns how many there are, at most max. With args
+// NULL they are only counted
+int splitArguments(char *text, char **args, int max) {
+  delSpace(text);
+  if (*text == '\0') {
+    return 0;
+  }
+  int count = 0;
+  char *start = text;
+  while (true) {
+    char *comma = findUnquoted(start, ',');
+    bool end = comma == NULL;
+    if (!end) {
+      *comma = '\0';
+    }
+    if (count < max && args != NULL) {
+      delSpace(start);
+      args[count] = start;
+    }
+    count++;
+    if (end) {
+      break;
+    }
+    start = comma + 1;
+  }
+  return count < max ? count : max;
+}
+
+// find the first c in a line that is not in a character ('#') or a string
+// ("a: b"), or NULL
+char *findUnquoted(char *line, char c) {
+  char quote = '\0';
+  for (char *p = line; *p != '\0'; p++) {
+    if (quote != '\0' && *p == '\\' && p[1] != '\0') {
+      p++; // escaped, e.g '\''
+    } else if (quote != '\0') {
+      quote = *p == quote ? '\0' : quote;
+    } else if (*p == '\'' || *p == '"') {
+      quote = *p;
+    } else if (*p == c) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// find a macro, names are not case sensitive
+macroDef *findMacro(macroState *state, const char *name) {
+  for (int i = 0; i < state->numMacros; i++) {
+    if (strcasecmp(state->macros[i].name, name) == 0) {
+      return &state->macros[i];
+    }
+  }
+  return NULL;
+}
+
 int countLabels(FILE *file, int *lineCount) {
   char line[LINESIZE];
   int labelCount = 0;
@@ -174,6 +1245,7 @@ void addLabelsToTable(FILE *file, fileData *data) {
   long originalPosition = ftell(file); // save original posiiton
   fseek(file, 0, SEEK_SET);            // move to the beginning of the file
   uint16_t tempAddress = START;
+  int lineIndex = 0;
   while (fgets(line, sizeof(line), file) != NULL) { // iterate thought ines
     delComment(line);                               // clean up the line
     delSpace(line);
@@ -190,10 +1262,29 @@ void addLabelsToTable(FILE *file, fileData *data) {
       // printf("addLabelsToTable: Total labels: %d\n", data->numLabels); //
       // DEBUG:
     }
-    // Increment address only for actuall instructions or val
-    if (!detectLabel(line) && strlen(line) > 0) {
-      tempAddress += 2; // each instruction is 2 bytes (16 bit computer)
+    // constants are known by name from the start, processDirective checks
+    // them
+    char *name, *text;
+    if (detectDirective(line) && splitEqu(lineCopy, &name, &text)) {
+      constantTable *constant = &data->constants[data->numConstants++];
+      constant->name = strdup(name);
+      constant->text = strdup(text);
+      constant->state = 0;
+      constant->usesLabels = false;
     }
+    // Increment address only for actuall instructions, val and data
+    data->blockSizes[lineIndex] = 0;
+    if (!detectLabel(line) && !detectDirective(line) && strlen(line) > 0) {
+      // each instruction is 2 bytes (16 bit computer)
+      tempAddress += 2 * lineWords(data, lineIndex);
+    } else if (detectDataDirective(line)) {
+      // the size of a block may use the constants and labels before it
+      data->blockSizes[lineIndex] = dataSize(line, data);
+      if (data->blockSizes[lineIndex] > 0) {
+        tempAddress += 2 * data->blockSizes[lineIndex];
+      }
+    }
+    lineIndex++;
   }
   fseek(file, originalPosition, SEEK_SET); // move back to where we started
 }
@@ -210,9 +1301,15 @@ int parseLine(char *line, fileData *data, int *ErrorCode) {
     //      strdup(line); // add label (making sure it is a clean string)
     //  data->table[data->numLabels].labelAddress = data->currentAddress;
     //  data->numLabels++; // keep track of number of labels
+  } else if (detectDirective(line)) {
+    return processDirective(line, data, ErrorCode);
   } else if (detectVal(line)) {
     // deal with val
-    uint16_t instruction = processVal(line);
+    uint16_t instruction = processVal(line, data, ErrorCode);
+    if (*ErrorCode == ASSEMBLYERROR) {
+      return ASSEMBLYERROR;
+    }
+    data->dataWords[data->numInstructions] = true;
     data->binaryInstructions[data->numInstructions] =
         instruction;         // add instruction to arrray
     data->numInstructions++; // increment instruction count;
@@ -223,15 +1320,30 @@ int parseLine(char *line, fileData *data, int *ErrorCode) {
     if (instruction == ASSEMBLYERROR) {
       return ASSEMBLYERROR;
     }
+    if (data->longFormWords > 0) {
+      // the last word is the address of the label
+      for (int i = 0; i < data->longFormWords; i++) {
+        bool last = i == data->longFormWords - 1;
+        if (last) {
+          relocateAddress(data, data->numInstructions);
+        }
+        data->dataWords[data->numInstructions] = i >= data->longFormData;
+        data->addressWords[data->numInstructions] = last;
+        data->binaryInstructions[data->numInstructions++] = data->longForm[i];
+      }
+      return SUCCESS;
+    }
+    data->dataWords[data->numInstructions] = false;
+    data->addressWords[data->numInstructions] = false;
     data->binaryInstructions[data->numInstructions] =
         instruction;         // add instruction to arrray
     data->numInstructions++; // increment instruction count;
   }
   return SUCCESS;
 }
-// deletes comments from the line
+// deletes comments from the line, a # in quotes ('#') is kept
 void delComment(char *line) {
-  char *commentPointer = strchr(line, '#'); // get address pointer to comment
+  char *commentPointer = findUnquoted(line, '#');
   if (commentPointer != NULL) {
     *commentPointer = '\0';
   }
@@ -249,6 +1361,7 @@ void delSpace(char *line) {
   if (trimmedLine != line) {
     // strcpy(line, trimmedLine);
     memmove(line, trimmedLine, strlen(trimmedLine) + 1);
+    trimmedLine = line;
   }
   // trim trailing space
   size_t len = strlen(trimmedLine);
@@ -258,15 +1371,314 @@ void delSpace(char *line) {
     len--;
   }
 }
-// detect the labels e.g start:
-bool detectLabel(char *line) {
-  for (char *charachter = line; *charachter != '\0'; charachter++) {
-    if (*charachter == ':') {
-      return true;
+// detect the labels e.g start:, a : in quotes (':') is not one
+bool detectLabel(char *line) { return findUnquoted(line, ':') != NULL; }
+// detect directives, e.g .global name
+bool detectDirective(char *line) { return line[0] == '.'; }
+
+// handle a directive line. .global exports a label to other modules; it
+// is kept track of even without -c so the same file assembles either way.
+// .equ gives a name to the value of an expression
+int processDirective(char *line, fileData *data, int *ErrorCode) {
+  char lineCopy[LINESIZE];
+  strcpy(lineCopy, line);
+  char *name, *text;
+  if (splitEqu(lineCopy, &name, &text)) {
+    int count = 0;
+    for (int i = 0; i < data->numConstants; i++) {
+      count += strcasecmp(data->constants[i].name, name) == 0;
+    }
+    if (count > 1 || findLabel(data, name) != NULL) {
+      printf("ERROR: %s is defined more than once\n", name);
+      *ErrorCode = ASSEMBLYERROR;
+      return ASSEMBLYERROR;
     }
+    // report a bad expression even if the constant is never used
+    int32_t value;
+    if (evaluate(data, name, &value) == ASSEMBLYERROR) {
+      *ErrorCode = ASSEMBLYERROR;
+      return ASSEMBLYERROR;
+    }
+    return SUCCESS;
   }
-  return false;
+  if (detectDataDirective(line)) {
+    return processData(line, data, ErrorCode);
+  }
+  strcpy(lineCopy, line);
+  char *directive = strtok(lineCopy, " \t");
+  name = strtok(NULL, " \t");
+  if (strcasecmp(directive, ".global") == 0 && name != NULL &&
+      strtok(NULL, " \t") == NULL && detectSymbolName(name)) {
+    data->globalNames[data->numGlobals++] = strdup(name);
+    return SUCCESS;
+  }
+  printf("ERROR: Invalid directive: %s\n", line);
+  *ErrorCode = ASSEMBLYERROR;
+  return ASSEMBLYERROR;
 }
+
+// detect a directive that puts data in memory, returns which one (FILL,
+// BLKW, STRINGZ, PACKED, INCBIN) or 0
+int detectDataDirective(char *line) {
+  static const char *names[] = {".fill", ".blkw", ".stringz", ".packed",
+                                ".incbin"};
+  size_t length = strcspn(line, " \t");
+  for (int i = 0; i < 5; i++) {
+    if (strlen(names[i]) == length &&
+        strncasecmp(line, names[i], length) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// words a data directive puts in memory, or -1 if it is invalid or its
+// size is not known yet. Nothing is printed, processData reports errors
+int dataSize(char *line, fileData *data) {
+  char args[LINESIZE];
+  strcpy(args, line + strcspn(line, " \t"));
+  delSpace(args);
+  char text[LINESIZE];
+  char *list[2];
+  int length;
+  int32_t value;
+  char error[LINESIZE];
+  switch (detectDataDirective(line)) {
+  case FILL:
+    return splitArguments(args, NULL, MAXWORDS + 1);
+  case BLKW:
+    if (splitArguments(args, list, 2) == 0 ||
+        expr_eval(list[0], lookupName, data, &value, error,
+                  sizeof(error)) != 0) {
+      return -1;
+    }
+    return value >= 0 && value <= MAXWORDS ? value : -1;
+  case STRINGZ:
+    return parseString(args, text, &length) == SUCCESS ? length + 1 : -1;
+  case PACKED:
+    return parseString(args, text, &length) == SUCCESS ? (length + 1) / 2 + 1
+                                                        : -1;
+  case INCBIN: {
+    long size;
+    uint8_t *bytes = readIncbin(args, &size);
+    free(bytes);
+    return bytes != NULL ? (size + 1) / 2 : -1;
+  }
+  default:
+    return -1;
+  }
+}
+
+// put the words of a data directive in memory, all at once:
+//   .fill a, b, ...     a word for each expression
+//   .blkw count, value  count words of value (0 if not given), count must
+//                       be known before the line
+//   .stringz "text"     a character per word, then 0, for puts
+//   .packed "text"      two characters per word, the first in the low
+//                       byte, then a 0 word, for putsp
+//   .incbin "file"      the bytes of a file, two per word, the first in
+//                       the high byte like object files
+int processData(char *line, fileData *data, int *ErrorCode) {
+  int size = data->blockSizes[data->lineIndex];
+  char args[LINESIZE];
+  strcpy(args, line + strcspn(line, " \t"));
+  delSpace(args);
+  char text[LINESIZE];
+  int length;
+  uint16_t *words = NULL;
+  int directive = detectDataDirective(line);
+  if ((directive == FILL || directive == BLKW) && *args == '\0') {
+    printf("ERROR: Invalid directive: %s\n", line);
+  } else if (directive == FILL) {
+    char **list = malloc((size + 1) * sizeof(char *));
+    splitArguments(args, list, size);
+    words = size > 0 ? reserveWords(data, size) : NULL;
+    int first = data->numInstructions - size;
+    for (int i = 0; words != NULL && i < size; i++) {
+      int32_t value;
+      if (evaluate(data, list[i], &value) == ASSEMBLYERROR) {
+        words = NULL;
+        break;
+      }
+      words[i] = (uint16_t)value;
+      // like val, a word of just a label holds its address
+      data->addressWords[first + i] = findLabel(data, list[i]) != NULL;
+      if (data->addressWords[first + i]) {
+        relocateAddress(data, first + i);
+      } else if (data->exprLabels > 0) {
+        data->labelArithmetic = true;
+      }
+    }
+    free(list);
+  } else if (directive == BLKW) {
+    char *list[3];
+    int count = splitArguments(args, list, 3);
+    int32_t value = 0;
+    if (count > 2) {
+      printf("ERROR: Invalid directive: %s\n", line);
+    } else if (size < 0) {
+      if (evaluate(data, list[0], &value) == ASSEMBLYERROR) {
+        // printed
+      } else if (value < 0 || value > MAXWORDS) {
+        printf("ERROR: .blkw of %d words: %s\n", (int)value, line);
+      } else {
+        printf("ERROR: the size of .blkw must be known before it: %s\n",
+               line);
+      }
+    } else if (count < 2 || evaluate(data, list[1], &value) == SUCCESS) {
+      words = reserveWords(data, size);
+      for (int i = 0; words != NULL && i < size; i++) {
+        words[i] = (uint16_t)value;
+      }
+      if (data->exprLabels > 0) {
+        data->labelArithmetic = true;
+      }
+    }
+  } else if (directive == STRINGZ || directive == PACKED) {
+    if (parseString(args, text, &length) == ASSEMBLYERROR) {
+      printf("ERROR: Invalid string: %s\n", line);
+    } else if (directive == STRINGZ) {
+      words = reserveWords(data, length + 1);
+      for (int i = 0; words != NULL && i <= length; i++) {
+        words[i] = (uint8_t)text[i];
+      }
+    } else {
+      words = reserveWords(data, (length + 1) / 2 + 1);
+      for (int i = 0; words != NULL && i < (length + 1) / 2 + 1; i++) {
+        uint8_t low = 2 * i < length ? text[2 * i] : 0;
+        uint8_t high = 2 * i + 1 < length ? text[2 * i + 1] : 0;
+        words[i] = high << 8 | low;
+      }
+    }
+  } else {
+    long bytes;
+    uint8_t *contents = readIncbin(args, &bytes);
+    if (contents == NULL) {
+      printf("ERROR: cannot read %s\n", line);
+    } else if ((bytes + 1) / 2 != size) {
+      printf("ERROR: %s changed while it was assembled\n", args);
+    } else {
+      words = reserveWords(data, size);
+      for (long i = 0; words != NULL && i < size; i++) {
+        uint8_t low = 2 * i + 1 < bytes ? contents[2 * i + 1] : 0;
+        words[i] = contents[2 * i] << 8 | low;
+      }
+    }
+    free(contents);
+  }
+  if (words == NULL) {
+    *ErrorCode = ASSEMBLYERROR;
+    return ASSEMBLYERROR;
+  }
+  return SUCCESS;
+}
+
+// read a quoted string with the escapes of characters, and \", into out,
+// which has room for LINESIZE characters
+int parseString(char *text, char *out, int *length) {
+  if (text[0] != '"') {
+    return ASSEMBLYERROR;
+  }
+  int n = 0;
+  char *c = text + 1;
+  for (; *c != '"'; c++) {
+    if (*c == '\0') {
+      return ASSEMBLYERROR;
+    }
+    char ch = *c;
+    if (ch == '\\') {
+      c++;
+      switch (*c) {
+      case 'n':
+        ch = '\n';
+        break;
+      case 't':
+        ch = '\t';
+        break;
+      case 'r':
+        ch = '\r';
+        break;
+      case '0':
+        ch = '\0';
+        break;
+      case '\\':
+      case '"':
+      case '\'':
+        ch = *c;
+        break;
+      default:
+        return ASSEMBLYERROR;
+      }
+    }
+    out[n++] = ch;
+  }
+  out[n] = '\0';
+  *length = n;
+  return c[1] == '\0' ? SUCCESS : ASSEMBLYERROR;
+}
+
+// make room for count more data words and return them, or NULL if the
+// program would no longer fit
+uint16_t *reserveWords(fileData *data, int count) {
+  int total = data->numInstructions + count;
+  if (total > MAXWORDS) {
+    printf("ERROR: program too large, it must end before 0x%04x\n",
+           START + MAXWORDS);
+    return NULL;
+  }
+  if (total > data->capacity) {
+    // still room for the most words the remaining lines can take
+    data->capacity += total;
+    data->binaryInstructions = realloc(data->binaryInstructions,
+                                       data->capacity * sizeof(uint16_t));
+    data->sourceLines =
+        realloc(data->sourceLines, data->capacity * sizeof(uint32_t));
+    data->dataWords = realloc(data->dataWords, data->capacity * sizeof(bool));
+    data->addressWords =
+        realloc(data->addressWords, data->capacity * sizeof(bool));
+  }
+  uint16_t *words = &data->binaryInstructions[data->numInstructions];
+  memset(&data->dataWords[data->numInstructions], true, count);
+  memset(&data->addressWords[data->numInstructions], false, count);
+  data->numInstructions = total;
+  return words;
+}
+
+// read the file named by a quoted string, relative to the source file
+uint8_t *readIncbin(char *text, long *size) {
+  char name[LINESIZE];
+  int length;
+  if (parseString(text, name, &length) == ASSEMBLYERROR || length == 0) {
+    return NULL;
+  }
+  char path[2 * LINESIZE + 1];
+  const char *slash = strrchr(sourcePath, '/');
+  if (name[0] != '/' && slash != NULL &&
+      slash - sourcePath < (long)LINESIZE) {
+    snprintf(path, sizeof(path), "%.*s/%s", (int)(slash - sourcePath),
+             sourcePath, name);
+  } else {
+    snprintf(path, sizeof(path), "%s", name);
+  }
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  *size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *bytes = NULL;
+  if (*size >= 0 && *size <= 2 * MAXWORDS) {
+    bytes = malloc(*size + 1);
+    if (fread(bytes, 1, *size, file) != (size_t)*size) {
+      free(bytes);
+      bytes = NULL;
+    }
+  }
+  fclose(file);
+  return bytes;
+}
+
 // detect if this line is a val
 bool detectVal(char *line) {
   if (strstr(line, "val") != NULL) { // strstr search for "needle" in "haystack"
@@ -275,14 +1687,28 @@ bool detectVal(char *line) {
   return false;
 }
 
-// turn line with val into instruction
-uint16_t processVal(char *line) {
-  char *strInt = strchr(line, '$');
-  if (strInt != NULL) {
-    strInt++; // move strInt past $ to where the number starts
+// turn line with val into instruction. The rest of the line is an
+// expression, the $ in front of it is optional. A val of just a label holds
+// its address, which -O keeps up to date
+uint16_t processVal(char *line, fileData *data, int *ErrorCode) {
+  char *text = strstr(line, "val") + 3;
+  text += strspn(text, " \t");
+  if (*text == '$') {
+    text++; // move text past $ to where the expression starts
+  }
+  int32_t value;
+  if (evaluate(data, text, &value) == ASSEMBLYERROR) {
+    *ErrorCode = ASSEMBLYERROR;
+    return ASSEMBLYERROR;
+  }
+  bool address = findLabel(data, text) != NULL;
+  data->addressWords[data->numInstructions] = address;
+  if (address) {
+    relocateAddress(data, data->numInstructions);
+  } else if (data->exprLabels > 0) {
+    data->labelArithmetic = true;
   }
-  uint16_t val = (uint16_t)atoi(strInt); // cast strInt to uint16_t
-  return val;
+  return (uint16_t)value;
 }
 // turn line with label into just label (e.g remove the ":")
 char *processLabel(char *line) {
@@ -331,6 +1757,11 @@ processInstruction(char *line, int *ErrorCode,
   bool isRET;        // is this a ret operation (not a jmp)
 
   bool isjsrR; // is this jsrr (not jsr)
+  char *importName = NULL; // label of another module, patched by xld
+  int target = -1; // word address the instruction refers to, -1 if none
+  bool targetExpr = false; // the target is an expression, not a label
+  uint16_t currentWord = START + (data->currentAddress - START) / 2;
+  data->longFormWords = 0;
   // loop through tokens, detect component type, then process
   while (tokenizedStr != NULL) {
     // this is a subcomponent of the instruction
@@ -355,7 +1786,10 @@ processInstruction(char *line, int *ErrorCode,
       break;
     case IMM:
       // fill up value
-      ImmOffsetVal = parseImmediate(tokenizedStr);
+      ImmOffsetVal = parseImmediate(tokenizedStr, data, ErrorCode);
+      if (*ErrorCode == ASSEMBLYERROR) {
+        return ASSEMBLYERROR;
+      }
       break;
     case INST:
       // get instruction operation code and add necessary flags
@@ -367,6 +1801,28 @@ processInstruction(char *line, int *ErrorCode,
       // DEBUG: printf("processInstruction: calling parseValidLabel"); //
       // DEBUG:
       ImmOffsetVal = parseValidLabel(tokenizedStr, data);
+      strcpy(data->labelUsed, tokenizedStr);
+      target = labelWordAddress(findLabel(data, tokenizedStr));
+      break;
+    case EXPR: {
+      // e.g table+2, the offset depends on where the line is, so it is
+      // never cached
+      int32_t value;
+      if (evaluate(data, tokenizedStr, &value) == ASSEMBLYERROR) {
+        *ErrorCode = ASSEMBLYERROR;
+        return ASSEMBLYERROR;
+      }
+      target = (uint16_t)value;
+      targetExpr = true;
+      ImmOffsetVal = target - (currentWord + 1);
+      data->noCache = true;
+      break;
+    }
+    case IMPORT:
+      // the offset is filled in when linking
+      importName = tokenizedStr;
+      data->importUsed = true;
+      ImmOffsetVal = 0;
       break;
     case ASSEMBLYERROR:
 
@@ -392,15 +1848,16 @@ processInstruction(char *line, int *ErrorCode,
   tokenizedStr = instructionToken; // put instruction token back
   // FLAG COLLECTION
   if (opcode == OP_ADD) {
-    //  differentiate between two types of add
-    if (ImmOffsetVal != 0) { // this means this is add with immediate
+    //  differentiate between two types of add: with an immediate there are
+    //  only two registers, and the immediate may well be $0
+    if (registerCount == 2) { // this means this is add with immediate
       isADDwithImm = true;
     } else {
       isADDwithImm = false;
     }
   } else if (opcode == OP_AND) {
     // differentiate between two types of and
-    if (ImmOffsetVal != 0) { // this means this is add with immediate
+    if (registerCount == 2) { // this means this is and with immediate
       isANDwithImm = true;
     } else {
       isANDwithImm = false;
@@ -434,12 +1891,71 @@ processInstruction(char *line, int *ErrorCode,
       ImmOffsetVal = TRAP_HALT;
     }
   }
+  if (targetExpr && relocationBits(opcode, isjsrR) == 0) {
+    printf("ERROR: only branches, loads and stores take a target, write $ "
+           "in front of a value: %s\n",
+           line);
+    *ErrorCode = ASSEMBLYERROR;
+    return ASSEMBLYERROR;
+  }
   uint16_t instruction = assembleInstructionfromMetaData(
       opcode, numTokens, registerCount, reg1, reg2, reg3, ImmOffsetVal, neg,
       zero, pos, isADDwithImm, isANDwithImm, isRET, isjsrR, ErrorCode);
+  // an offset that does not fit would be cut short by emit, use the long
+  // form instead. It takes more words, so the labels move and it all has to
+  // be assembled again
+  if (target >= 0 && longFormSize(opcode, neg, zero, pos) > 0 &&
+      !(opcode == OP_JSR && isjsrR)) {
+    int distance = target - (currentWord + 1);
+    int reach = opcode == OP_JSR ? 1024 : 256;
+    if (data->lineSizes[data->lineIndex] > 0) {
+      reg_t reg = registerCount > 0 ? *reg1 : R_R0;
+      if (emitLongForm(data, opcode, reg, neg, zero, pos, target) ==
+          ASSEMBLYERROR) {
+        *ErrorCode = ASSEMBLYERROR;
+        return ASSEMBLYERROR;
+      }
+    } else if (distance < -reach || distance >= reach) {
+      data->lineSizes[data->lineIndex] = longFormSize(opcode, neg, zero, pos);
+      data->relaxAgain = true;
+    }
+  }
+  if (importName != NULL) {
+    int bits = relocationBits(opcode, isjsrR);
+    if (bits == 0) {
+      printf("ERROR: %s is not in this file\n", importName);
+      *ErrorCode = ASSEMBLYERROR;
+      return ASSEMBLYERROR;
+    }
+    addRelocation(data, importName, data->numInstructions, bits);
+  }
   return instruction; // NOTE: instruction can be ERROR!
 }
 
+// record that xld patches the word at index with the label name
+object_reloc_t *addRelocation(fileData *data, const char *name,
+                              int index, int bits) {
+  if (data->numRelocations == data->relocationCapacity) {
+    data->relocationCapacity *= 2;
+    data->relocations =
+        realloc(data->relocations,
+                data->relocationCapacity * sizeof(object_reloc_t));
+  }
+  object_reloc_t *reloc = &data->relocations[data->numRelocations++];
+  reloc->name = strdup(name);
+  reloc->address = START + index;
+  reloc->bits = bits;
+  return reloc;
+}
+
+// with -c the word at index holds the address of a label of the module,
+// which xld moves along with it
+void relocateAddress(fileData *data, int index) {
+  if (assembleModule) {
+    addRelocation(data, "", index, 16);
+  }
+}
+
 // Remove whitespace and comma ("%r10, " -> "%r10")
 void cleanToken(char *tokenizedStr) {
   delSpace(tokenizedStr); // delete leading and trailing spaces
@@ -481,6 +1997,16 @@ int identifyType(char *tokenizedStr, fileData *data) {
   if (detectValidLabel(tokenizedStr, data)) {
     return LABEL;
   }
+  if (findConstant(data, tokenizedStr) != NULL) {
+    return EXPR;
+  }
+  if (assembleModule && detectSymbolName(tokenizedStr)) {
+    return IMPORT;
+  }
+  if (isalnum((unsigned char)tokenizedStr[0]) ||
+      strchr("_('-~+", tokenizedStr[0]) != NULL) {
+    return EXPR;
+  }
   // if (strstr(tokenizedStr, "%") == NULL && strstr(tokenizedStr, "$") == NULL
   // &&
   //     !detectValidInstruction(tokenizedStr)) {
@@ -488,6 +2014,39 @@ int identifyType(char *tokenizedStr, fileData *data) {
   // }
   return ASSEMBLYERROR; // should never happen
 }
+
+// detect if a cleaned tokenizedStr could be a label: a letter or _, then
+// letters, digits and _
+bool detectSymbolName(char *tokenizedStr) {
+  if (!isalpha((unsigned char)tokenizedStr[0]) && tokenizedStr[0] != '_') {
+    return false;
+  }
+  for (char *c = tokenizedStr; *c != '\0'; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// bits of the PC relative offset of an instruction that can refer to a
+// label of another module, or 0 if it cannot
+int relocationBits(opcode_t opcode, bool isJsrR) {
+  switch (opcode) {
+  case OP_JSR:
+    return isJsrR ? 0 : 11;
+  case OP_BR:
+  case OP_LD:
+  case OP_LDI:
+  case OP_LEA:
+  case OP_ST:
+  case OP_STI:
+    return 9;
+  default:
+    return 0;
+  }
+}
+
 // detect if a cleaned tokenizedStr is a valid instruction (e.g ld)
 bool detectValidInstruction(char *tokenizedStr) {
   if (strcasestr(tokenizedStr, "ld") != NULL ||
@@ -618,9 +2177,18 @@ reg_t parseRegister(char *tokenizedStr) {
 }
 
 // takes in a clean token, that is an immediate value and returns its clean
-// uint16_t value
-uint16_t parseImmediate(char *tokenizedStr) {
-  return processVal(tokenizedStr); // should work
+// uint16_t value. After the $ is an expression, e.g $0x1f or $SIZE-1
+uint16_t parseImmediate(char *tokenizedStr, fileData *data, int *ErrorCode) {
+  int32_t value;
+  if (evaluate(data, strchr(tokenizedStr, '$') + 1, &value) ==
+      ASSEMBLYERROR) {
+    *ErrorCode = ASSEMBLYERROR;
+    return ASSEMBLYERROR;
+  }
+  if (data->exprLabels > 0) {
+    data->labelArithmetic = true;
+  }
+  return (uint16_t)value;
 }
 
 // fill up the boolean values n, z, and p from tokenizedStr. input shouldd be
@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "link.h"
+#include "object.h"
+
+// Link the modules written by xas -c into one image
+
+static void usage() {
+  fprintf(stderr, "Usage: xld [-g] [-o output] [-b base] module...\n");
+  exit(1);
+}
+
+// Add the module in a file. Return 0 on success or -1 for failure.
+static int add_file(linker_t* linker, const char* path, uint8_t* data) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) {
+    fprintf(stderr, "Cannot open %s\n", path);
+    return -1;
+  }
+  size_t len = fread(data, 1, OBJECT_MAX_SIZE, fp);
+  fclose(fp);
+  if (linker_add(linker, path, data, len) != 0) {
+    fprintf(stderr, "%s is not a module, assemble it with xas -c\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+// Exit with 1 if the modules do not link and 2 if a file cannot be read or
+// written
+int main(int argc, char** argv) {
+  const char* output = "a.obj";
+  bool debug = false;
+  uint16_t base = 0x3000;
+  int ch;
+  while ((ch = getopt(argc, argv, "go:b:")) != -1) {
+    switch (ch) {
+      case 'g':
+        debug = true;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'b':
+        base = strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc) {
+    usage();
+  }
+
+  linker_t* linker = linker_create(base);
+  uint8_t* data = malloc(OBJECT_MAX_SIZE);
+  for (int i = optind; i < argc; i++) {
+    if (add_file(linker, argv[i], data) != 0) {
+      free(data);
+      linker_free(linker);
+      return 2;
+    }
+  }
+  free(data);
+
+  if (linker_link(linker, stderr) > 0) {
+    linker_free(linker);
+    return 1;
+  }
+  FILE* fp = fopen(output, "wb");
+  int rv = fp ? linker_write(linker, fp, debug) : -1;
+  if (fp && fclose(fp) != 0) {
+    rv = -1;
+  }
+  linker_free(linker);
+  if (rv != 0) {
+    fprintf(stderr, "Cannot write %s\n", output);
+    return 2;
+  }
+  return 0;
+}
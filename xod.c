@@ -1,54 +1,467 @@
-#define _GNU_SOURCE
-#include <arpa/inet.h>
-#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include "cfg.h"
 #include "decode.h"
 #include "instruction.h"
+#include "object.h"
+
+// Output is built in a buffer of this size and written when nearly full
+#define OUTSIZE (1 << 16)
+
+// Longest line: location, binary column and instruction
+#define MAX_LINE (16 + 20 + DECODE_SIZE)
+
+// The binary column is made of these, one per 4 bits of the word
+static const char nibbles[16][4] = {
+    {'0', '0', '0', '0'}, {'0', '0', '0', '1'}, {'0', '0', '1', '0'},
+    {'0', '0', '1', '1'}, {'0', '1', '0', '0'}, {'0', '1', '0', '1'},
+    {'0', '1', '1', '0'}, {'0', '1', '1', '1'}, {'1', '0', '0', '0'},
+    {'1', '0', '0', '1'}, {'1', '0', '1', '0'}, {'1', '0', '1', '1'},
+    {'1', '1', '0', '0'}, {'1', '1', '0', '1'}, {'1', '1', '1', '0'},
+    {'1', '1', '1', '1'},
+};
+
+// Columns of the summary, by opcode
+static const char* opcode_names[16] = {
+    "br",  "add", "ld",  "st",  "jsr", "and", "ldr", "str",
+    "rti", "not", "ldi", "sti", "jmp", "res", "lea", "trap",
+};
+
+// What to write for each image
+typedef enum {
+  XOD_LISTING,  // location, binary and instruction of every word
+  XOD_SOURCE,   // labeled source for xas, -a
+  XOD_GRAPH,    // control flow graph in DOT, -g
+  XOD_SUMMARY   // one CSV row of opcode counts, -s
+} xod_mode_t;
+
+// Extensions of the files written with -o
+static const char* extensions[] = {
+    [XOD_LISTING] = ".lst",
+    [XOD_SOURCE] = ".x16s",
+    [XOD_GRAPH] = ".dot",
+};
+
+// A mapped object file
+typedef struct {
+  const uint8_t* data;
+  size_t size;
+  object_segment_t segments[OBJECT_MAX_SEGMENTS];
+  int nsegments;
+  object_debug_t* debug;  // labels and lines, NULL for version 1
+} image_t;
+
+// One image to do, and how it went
+typedef struct {
+  const char* filename;
+  int failed;
+  uint32_t counts[16];  // words per opcode, in summary mode
+} job_t;
+
+// Images shared out between the threads
+typedef struct {
+  job_t* jobs;
+  int njobs;
+  int next;  // first job not taken yet
+  pthread_mutex_t lock;
+  xod_mode_t mode;
+  const char* outdir;
+} pool_t;
 
 void usage() {
-  fprintf(stderr, "Usage: ./xod file\n");
+  fprintf(stderr,
+          "Usage: ./xod [-a | -g | -s] [-j threads] [-o dir] [file ...]\n");
   exit(1);
 }
 
-int main(int argc, char** argv) {
-  if (argc > 2) {
-    usage();
+// Map an object file; words are stored big endian, the origin first
+static int map_image(const char* filename, image_t* image) {
+  int fd = open(filename, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Cannot open %s\n", filename);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  if (st.st_size < 2) {
+    fprintf(stderr, "Can't read origin\n");
+    close(fd);
+    return -1;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Cannot open %s\n", filename);
+    return -1;
+  }
+  image->data = (const uint8_t*)data;
+  image->size = st.st_size;
+  image->debug = NULL;
+  int version = object_version(image->data, image->size);
+  if (version == 3) {
+    fprintf(stderr, "%s is a module, link it with xld first\n", filename);
+    munmap(data, st.st_size);
+    return -1;
+  }
+  if (version == 2) {
+    image->nsegments = object_segments(image->data, image->size,
+                                       image->segments, OBJECT_MAX_SEGMENTS);
+    image->debug = object_debug(image->data, image->size);
+  } else {
+    // Every word of a version 1 file is listed, even past memory
+    image->nsegments = 1;
+    image->segments[0].origin = image->data[0] << 8 | image->data[1];
+    image->segments[0].count = (st.st_size - 2) / 2;
+    image->segments[0].words = image->data + 2;
+  }
+  return 0;
+}
+
+static void unmap_image(image_t* image) {
+  object_debug_free(image->debug);
+  munmap((void*)image->data, image->size);
+}
+
+static uint16_t word_at(const object_segment_t* segment, size_t i) {
+  return segment->words[2 * i] << 8 | segment->words[2 * i + 1];
+}
+
+// Write out all of a buffer
+static int flush(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n <= 0) {
+      perror("xod");
+      return -1;
+    }
+    buf += n;
+    len -= n;
   }
+  return 0;
+}
 
-  char* filename = "a.obj";
-  if (argc == 2) {
-    filename = argv[1];
+// Format one line: location, the word in blocks of 4 bits, instruction
+static char* format_line(char* out, uint32_t location, uint16_t word) {
+  *out++ = '0';
+  *out++ = 'x';
+  out = decode_hex(out, location);
+  *out++ = ':';
+  for (int shift = 12; shift >= 0; shift -= 4) {
+    *out++ = ' ';
+    memcpy(out, nibbles[(word >> shift) & 15], 4);
+    out += 4;
   }
+  memcpy(out, " : ", 3);
+  out += 3;
+  out += decode_into(word, out);
+  *out++ = '\n';
+  return out;
+}
 
-  FILE* fp = fopen(filename, "rb");
-  if (fp == NULL) {
-    fprintf(stderr, "Cannot open %s\n", filename);
-    exit(2);
+// Make room for len more bytes of output, writing out what is there
+static int reserve(int fd, char* buf, char** out, size_t len) {
+  if (*out - buf > (ptrdiff_t)(OUTSIZE - len)) {
+    if (flush(fd, buf, *out - buf) != 0) {
+      return -1;
+    }
+    *out = buf;
   }
+  return 0;
+}
 
-  uint16_t origin;
-  if (fread(&origin, sizeof(origin), 1, fp) != 1) {
-    fprintf(stderr, "Can't read origin\n");
-    exit(2);
+// With debug information, labels go on lines of their own and each
+// instruction is followed by its source line
+static int write_listing(const image_t* image, int fd, char* buf) {
+  char* out = buf;
+  for (int s = 0; s < image->nsegments; s++) {
+    const object_segment_t* segment = &image->segments[s];
+    if (reserve(fd, buf, &out, MAX_LINE) != 0) {
+      return -1;
+    }
+    out += sprintf(out, "Origin: 0x%x\n", segment->origin);
+    uint32_t location = segment->origin;
+    for (size_t i = 0; i < segment->count; i++, location++) {
+      const char* label = NULL;
+      if (image->debug != NULL) {
+        label = object_symbol_at(image->debug, location);
+      }
+      size_t need = MAX_LINE + 16 + (label != NULL ? strlen(label) + 2 : 0);
+      if (need > OUTSIZE || reserve(fd, buf, &out, need) != 0) {
+        return -1;
+      }
+      if (label != NULL) {
+        out += sprintf(out, "%s:\n", label);
+      }
+      out = format_line(out, location, word_at(segment, i));
+      uint32_t line =
+          image->debug != NULL ? object_line(image->debug, location) : 0;
+      if (line != 0) {
+        out += sprintf(out - 1, "  # line %u\n", line) - 1;
+      }
+    }
+  }
+  return flush(fd, buf, out - buf);
+}
+
+// Recover the control flow graph and write it as xas source or DOT
+static int write_graph(const image_t* image, const char* filename,
+                       xod_mode_t mode, int fd, char* buf) {
+  FILE* out = fdopen(dup(fd), "w");
+  if (out == NULL) {
+    perror("xod");
+    return -1;
+  }
+  setvbuf(out, buf, _IOFBF, OUTSIZE);
+  // The graph is of the first segment, where xas puts all the code
+  const object_segment_t* segment = &image->segments[0];
+  uint16_t* words = (uint16_t*)malloc(
+      (segment->count > 0 ? segment->count : 1) * sizeof(uint16_t));
+  for (size_t i = 0; i < segment->count; i++) {
+    words[i] = word_at(segment, i);
+  }
+  cfg_t* cfg = cfg_build(words, segment->count, segment->origin);
+  if (mode == XOD_SOURCE) {
+    cfg_write_source(cfg, filename, out);
+  } else {
+    cfg_write_dot(cfg, filename, out);
+  }
+  cfg_free(cfg);
+  free(words);
+  int failed = ferror(out);
+  if (fclose(out) != 0 || failed) {
+    perror("xod");
+    return -1;
+  }
+  return 0;
+}
+
+// Disassemble one image to fd, or in summary mode count its opcodes into
+// counts. buf is OUTSIZE bytes that only this call uses and nothing else
+// is shared, so calls with buffers of their own can run at the same time.
+static int xod_image(const char* filename, xod_mode_t mode, int fd, char* buf,
+                     uint32_t counts[16]) {
+  image_t image;
+  if (map_image(filename, &image) != 0) {
+    return -1;
+  }
+  int rv = 0;
+  switch (mode) {
+    case XOD_LISTING:
+      rv = write_listing(&image, fd, buf);
+      break;
+
+    case XOD_SOURCE:
+    case XOD_GRAPH:
+      rv = write_graph(&image, filename, mode, fd, buf);
+      break;
+
+    case XOD_SUMMARY:
+      memset(counts, 0, 16 * sizeof(uint32_t));
+      for (int s = 0; s < image.nsegments; s++) {
+        for (size_t i = 0; i < image.segments[s].count; i++) {
+          counts[word_at(&image.segments[s], i) >> 12]++;
+        }
+      }
+      break;
+  }
+  unmap_image(&image);
+  return rv;
+}
+
+// Create dir/name.ext for an image, name being its file name less .obj
+static int open_output(const char* outdir, const char* filename,
+                       xod_mode_t mode) {
+  const char* base = strrchr(filename, '/');
+  base = base != NULL ? base + 1 : filename;
+  int len = strlen(base);
+  if (len > 4 && strcmp(base + len - 4, ".obj") == 0) {
+    len -= 4;
+  }
+  char* path = (char*)malloc(strlen(outdir) + len + 8);
+  sprintf(path, "%s/%.*s%s", outdir, len, base, extensions[mode]);
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot create %s\n", path);
+  }
+  free(path);
+  return fd;
+}
+
+static void run_job(pool_t* pool, job_t* job, char* buf) {
+  int fd = -1;
+  if (pool->mode != XOD_SUMMARY) {
+    fd = open_output(pool->outdir, job->filename, pool->mode);
+    if (fd < 0) {
+      job->failed = 1;
+      return;
+    }
+  }
+  job->failed =
+      xod_image(job->filename, pool->mode, fd, buf, job->counts) != 0;
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+// Take jobs until there are none left, with a buffer of its own
+static void* worker_main(void* arg) {
+  pool_t* pool = (pool_t*)arg;
+  char* buf = (char*)malloc(OUTSIZE);
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    int i = pool->next < pool->njobs ? pool->next++ : -1;
+    pthread_mutex_unlock(&pool->lock);
+    if (i < 0) {
+      break;
+    }
+    run_job(pool, &pool->jobs[i], buf);
+  }
+  free(buf);
+  return NULL;
+}
+
+// Run the jobs on a number of threads
+static void run_pool(pool_t* pool, int threads) {
+  if (threads > pool->njobs) {
+    threads = pool->njobs;
+  }
+  pthread_t* workers = (pthread_t*)malloc(threads * sizeof(pthread_t));
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&workers[i], NULL, worker_main, pool);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(workers[i], NULL);
+  }
+  free(workers);
+}
+
+// Write a CSV field, quoted if it needs to be
+static void put_csv(const char* field) {
+  if (strpbrk(field, ",\"\r\n") == NULL) {
+    fputs(field, stdout);
+    return;
+  }
+  putchar('"');
+  for (; *field != '\0'; field++) {
+    if (*field == '"') {
+      putchar('"');
+    }
+    putchar(*field);
+  }
+  putchar('"');
+}
+
+// One row per image in the order given, leaving out those that failed
+static void write_summary(const job_t* jobs, int njobs) {
+  fputs("image,words", stdout);
+  for (int op = 0; op < 16; op++) {
+    printf(",%s", opcode_names[op]);
+  }
+  putchar('\n');
+  for (int i = 0; i < njobs; i++) {
+    if (jobs[i].failed) {
+      continue;
+    }
+    uint32_t words = 0;
+    for (int op = 0; op < 16; op++) {
+      words += jobs[i].counts[op];
+    }
+    put_csv(jobs[i].filename);
+    printf(",%u", words);
+    for (int op = 0; op < 16; op++) {
+      printf(",%u", jobs[i].counts[op]);
+    }
+    putchar('\n');
+  }
+}
+
+int main(int argc, char** argv) {
+  xod_mode_t mode = XOD_LISTING;
+  int threads = 1;
+  const char* outdir = NULL;
+  int ch;
+  while ((ch = getopt(argc, argv, "agsj:o:")) != -1) {
+    xod_mode_t chosen = XOD_LISTING;
+    switch (ch) {
+      case 'a':
+        chosen = XOD_SOURCE;
+        break;
+
+      case 'g':
+        chosen = XOD_GRAPH;
+        break;
+
+      case 's':
+        chosen = XOD_SUMMARY;
+        break;
+
+      case 'j':
+        threads = atoi(optarg);
+        break;
+
+      case 'o':
+        outdir = optarg;
+        break;
+
+      default:
+        usage();
+    }
+    if (chosen != XOD_LISTING) {
+      if (mode != XOD_LISTING && mode != chosen) {
+        usage();
+      }
+      mode = chosen;
+    }
+  }
+  if (threads < 1 || (outdir != NULL && mode == XOD_SUMMARY)) {
+    usage();
   }
-  origin = ntohs(origin);
 
-  printf("Origin: 0x%x\n", origin);
-  int location = origin;
-  uint16_t instruction;
-  while (fread(&instruction, sizeof(instruction), 1, fp) == 1) {
-    instruction = ntohs(instruction);
-    printf("0x%x: ", location);
-    print_instruction(instruction);
-    char* str = decode(instruction);
-    printf(" : %s\n", str);
-    free(str);
-    location++;
+  char* fallback[] = {"a.obj"};
+  char** files = optind < argc ? argv + optind : fallback;
+  int njobs = optind < argc ? argc - optind : 1;
+  job_t* jobs = (job_t*)calloc(njobs, sizeof(job_t));
+  for (int i = 0; i < njobs; i++) {
+    jobs[i].filename = files[i];
   }
 
-  fclose(fp);
+  if (outdir != NULL || mode == XOD_SUMMARY) {
+    pool_t pool = {jobs, njobs, 0, PTHREAD_MUTEX_INITIALIZER, mode, outdir};
+    run_pool(&pool, threads);
+    if (mode == XOD_SUMMARY) {
+      write_summary(jobs, njobs);
+    }
+  } else {
+    // Everything goes to stdout, one image after another
+    char* buf = (char*)malloc(OUTSIZE);
+    for (int i = 0; i < njobs; i++) {
+      if (njobs > 1) {
+        if (i > 0) {
+          flush(STDOUT_FILENO, "\n", 1);
+        }
+        flush(STDOUT_FILENO, files[i], strlen(files[i]));
+        flush(STDOUT_FILENO, ":\n", 2);
+      }
+      jobs[i].failed = xod_image(files[i], mode, STDOUT_FILENO, buf,
+                                 jobs[i].counts) != 0;
+    }
+    free(buf);
+  }
+
+  int failed = 0;
+  for (int i = 0; i < njobs; i++) {
+    failed |= jobs[i].failed;
+  }
+  free(jobs);
+  return failed ? 2 : 0;
 }